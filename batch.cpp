@@ -0,0 +1,191 @@
+#include <algorithm>
+#include "bytecode.h"
+#include "simd.h"
+#if defined(__x86_64__) || defined(_M_X64)
+#define BATCH_X64
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+
+static void scalar_add(double *out, const double *a, const double *b, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = a[i] + b[i];
+}
+static void scalar_mul(double *out, const double *a, const double *b, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = a[i] * b[i];
+}
+static void scalar_div(double *out, const double *a, const double *b, uint8_t *err, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!b[i] && !err[i])
+            err[i] = error_division_by_0;
+        out[i] = a[i] / b[i];
+    }
+}
+static void scalar_log(double *out, const double *a, uint8_t *err, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (a[i] <= 0)
+        {
+            if (!err[i])
+                err[i] = error_log_domain;
+            out[i] = NAN;
+        }
+        else
+            out[i] = log10(a[i]);
+    }
+}
+const batch_kernels scalar_kernels = { scalar_add, scalar_mul, scalar_div, scalar_log };
+
+#ifdef BATCH_X64
+namespace {
+struct sse2
+{
+    typedef __m128d reg;
+    typedef __m128i ireg;
+    static const int width = 2;
+    static reg load(const double *p) { return _mm_loadu_pd(p); }
+    static void store(double *p, reg a) { _mm_storeu_pd(p, a); }
+    static reg set1(double v) { return _mm_set1_pd(v); }
+    static reg zero() { return _mm_setzero_pd(); }
+    static reg add(reg a, reg b) { return _mm_add_pd(a, b); }
+    static reg sub(reg a, reg b) { return _mm_sub_pd(a, b); }
+    static reg mul(reg a, reg b) { return _mm_mul_pd(a, b); }
+    static reg div(reg a, reg b) { return _mm_div_pd(a, b); }
+    static reg eq(reg a, reg b) { return _mm_cmpeq_pd(a, b); }
+    static reg ne(reg a, reg b) { return _mm_cmpneq_pd(a, b); }
+    static reg lt(reg a, reg b) { return _mm_cmplt_pd(a, b); }
+    static reg le(reg a, reg b) { return _mm_cmple_pd(a, b); }
+    static reg select(reg m, reg a, reg b) { return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+    static int mask_bits(reg m) { return _mm_movemask_pd(m); }
+    static ireg as_bits(reg a) { return _mm_castpd_si128(a); }
+    static reg from_bits(ireg a) { return _mm_castsi128_pd(a); }
+    static ireg iset1(long long v) { return _mm_set1_epi64x(v); }
+    static ireg iadd(ireg a, ireg b) { return _mm_add_epi64(a, b); }
+    static ireg iand(ireg a, ireg b) { return _mm_and_si128(a, b); }
+    static ireg ior(ireg a, ireg b) { return _mm_or_si128(a, b); }
+    static ireg srl52(ireg a) { return _mm_srli_epi64(a, 52); }
+};
+}
+const batch_kernels sse2_kernels = { simd_kernels<sse2>::add, simd_kernels<sse2>::mul, simd_kernels<sse2>::div, simd_kernels<sse2>::log };
+
+static bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    // avx and the os saving ymm registers
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#else
+const batch_kernels sse2_kernels = scalar_kernels;
+const batch_kernels avx2_kernels = scalar_kernels;
+#endif
+
+simd_level detect_simd_level()
+{
+#ifdef BATCH_X64
+    static const simd_level level = cpu_has_avx2() ? simd_avx2 : simd_sse2;
+    return level;
+#else
+    return simd_scalar;
+#endif
+}
+
+static const batch_kernels &kernels(simd_level level)
+{
+    level = std::min(level, detect_simd_level());
+    if (level == simd_avx2)
+        return avx2_kernels;
+    if (level == simd_sse2)
+        return sse2_kernels;
+    return scalar_kernels;
+}
+
+// Runs the bytecode column-wise over blocks of x. Stack entries point to
+// blocks: x and the constants (broadcast once per call) are used in place,
+// each opcode writes one kernel call's output to the slot of its depth.
+void program::run(const double *x, double *res, uint8_t *err, size_t n, simd_level level) const
+{
+    assert(!code.empty());
+    if (code.back() == op_solve)
+        throw expression_error(error_message(error_tabulate_equation), nullptr);
+    const batch_kernels &k = kernels(level);
+    const size_t block = 128;
+    std::vector<double> buf((consts.size() + max_depth + 1) * block);
+    double *cblocks = &buf[0], *slots = cblocks + consts.size() * block, *xpad = slots + max_depth * block;
+    for (size_t i = 0; i < consts.size(); ++i)
+        std::fill(cblocks + i * block, cblocks + (i + 1) * block, consts[i]);
+    std::vector<const double*> stack(max_depth);
+    uint8_t errs[block];
+    for (size_t i = 0; i < n; i += block)
+    {
+        // the last block is padded with x=1, kernels always see full blocks
+        size_t m = std::min(block, n - i);
+        const double *xs = x + i;
+        if (m < block)
+        {
+            std::copy(x + i, x + n, xpad);
+            std::fill(xpad + m, xpad + block, 1.0);
+            xs = xpad;
+        }
+        memset(errs, error_none, block);
+        const double **sp = &stack[0] - 1;
+        const double *c = cblocks;
+        for (uint8_t op : code)
+        {
+            double *out = slots + (sp - &stack[0] - 1) * block;
+            switch (op)
+            {
+            case op_const:
+                *++sp = c;
+                c += block;
+                break;
+            case op_x:
+                *++sp = xs;
+                break;
+            case op_add:
+                k.add(out, sp[-1], sp[0], block);
+                *--sp = out;
+                break;
+            case op_mul:
+                k.mul(out, sp[-1], sp[0], block);
+                *--sp = out;
+                break;
+            case op_div:
+                k.div(out, sp[-1], sp[0], errs, block);
+                *--sp = out;
+                break;
+            case op_log:
+                out += block;
+                k.log(out, sp[0], errs, block);
+                *sp = out;
+                break;
+            }
+        }
+        assert(sp == &stack[0]);
+        for (size_t j = 0; j < m; ++j)
+        {
+            err[i + j] = errs[j];
+            res[i + j] = errs[j] ? NAN : (*sp)[j];
+        }
+    }
+}
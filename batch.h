@@ -0,0 +1,30 @@
+#ifndef batch_h_
+#define batch_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum simd_level
+{
+    simd_scalar,
+    simd_sse2,
+    simd_avx2,
+    simd_auto,  // best level supported by the cpu
+};
+simd_level detect_simd_level();
+
+// Array kernels the batch interpreter dispatches to. Every call processes n
+// elements, n is a multiple of the widest vector. out[i] = a[i] op b[i], out
+// may alias a; err[i] is an error_code, only set if it is still error_none.
+struct batch_kernels
+{
+    void (*add)(double *out, const double *a, const double *b, size_t n);
+    void (*mul)(double *out, const double *a, const double *b, size_t n);
+    void (*div)(double *out, const double *a, const double *b, uint8_t *err, size_t n);
+    void (*log)(double *out, const double *a, uint8_t *err, size_t n);
+};
+extern const batch_kernels scalar_kernels, sse2_kernels, avx2_kernels;
+
+
+#endif /* batch_h_ */
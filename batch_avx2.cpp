@@ -0,0 +1,44 @@
+// AVX2 instantiation of the batch kernels. Everything here is compiled for
+// AVX2 and only reached through avx2_kernels after the cpu check in batch.cpp,
+// so keep std library code out of this file.
+#include "batch.h"
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#include <math.h>
+#ifdef __GNUC__
+#pragma GCC target("avx2")
+#endif
+#include "simd.h"
+
+
+namespace {
+struct avx2
+{
+    typedef __m256d reg;
+    typedef __m256i ireg;
+    static const int width = 4;
+    static reg load(const double *p) { return _mm256_loadu_pd(p); }
+    static void store(double *p, reg a) { _mm256_storeu_pd(p, a); }
+    static reg set1(double v) { return _mm256_set1_pd(v); }
+    static reg zero() { return _mm256_setzero_pd(); }
+    static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+    static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+    static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+    static reg div(reg a, reg b) { return _mm256_div_pd(a, b); }
+    static reg eq(reg a, reg b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+    static reg ne(reg a, reg b) { return _mm256_cmp_pd(a, b, _CMP_NEQ_UQ); }
+    static reg lt(reg a, reg b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static reg le(reg a, reg b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+    static reg select(reg m, reg a, reg b) { return _mm256_blendv_pd(b, a, m); }
+    static int mask_bits(reg m) { return _mm256_movemask_pd(m); }
+    static ireg as_bits(reg a) { return _mm256_castpd_si256(a); }
+    static reg from_bits(ireg a) { return _mm256_castsi256_pd(a); }
+    static ireg iset1(long long v) { return _mm256_set1_epi64x(v); }
+    static ireg iadd(ireg a, ireg b) { return _mm256_add_epi64(a, b); }
+    static ireg iand(ireg a, ireg b) { return _mm256_and_si256(a, b); }
+    static ireg ior(ireg a, ireg b) { return _mm256_or_si256(a, b); }
+    static ireg srl52(ireg a) { return _mm256_srli_epi64(a, 52); }
+};
+}
+const batch_kernels avx2_kernels = { simd_kernels<avx2>::add, simd_kernels<avx2>::mul, simd_kernels<avx2>::div, simd_kernels<avx2>::log };
+#endif
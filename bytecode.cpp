@@ -0,0 +1,249 @@
+#include "bytecode.h"
+
+
+void program::emit(opcode op, int depth)
+{
+    code.push_back(op);
+    this->depth += depth;
+    if (this->depth > max_depth)
+        max_depth = this->depth;
+}
+void program::emit_const(double value)
+{
+    consts.push_back(value);
+    emit(op_const, 1);
+}
+void program::compile(expression &e)
+{
+    code.clear();
+    consts.clear();
+    depth = max_depth = 0;
+    if (e.lhs != no_node && e.x_nonlinear)
+        throw expression_error("cannot compile a non-linear equation", nullptr);
+    if (e.lhs != no_node)
+    {
+        compile_linear(e.nodes, e.nodes.exprs[e.lhs]);
+        compile_linear(e.nodes, e.nodes.exprs[e.rhs]);
+        emit(op_solve, -3);
+    }
+    else
+        compile(e.nodes, e.nodes.exprs[e.rhs]);
+}
+// The programs repeat the operations of the eval() and eval_linear()
+// overloads in the same order, so run() gives the same bits as
+// expression::solve().
+void program::compile(const node_table &nodes, const term_t &term)
+{
+    if (term.expr_value == no_node)
+    {
+        emit_const(term.num_value);
+        if (term.x)
+        {
+            emit(op_x, 1);
+            emit(op_mul, -1);
+        }
+        return;
+    }
+    compile(nodes, nodes.exprs[term.expr_value]);
+    if (term.log)
+        emit(op_log, 0);
+    if (term.num_value != 1.0)
+    {
+        emit_const(term.num_value);
+        emit(op_mul, -1);
+    }
+}
+void program::compile(const node_table &nodes, const prod_t &prod)
+{
+    for (node_id i = prod.first; i != no_node; i = nodes.terms[i].next)
+    {
+        const term_t &term = nodes.terms[i];
+        // 1*x is exact, so the leading 1 is only needed for a leading division
+        if (i == prod.first && term.div)
+            emit_const(1);
+        compile(nodes, term);
+        if (i != prod.first || term.div)
+            emit(term.div ? op_div : op_mul, -1);
+    }
+}
+void program::compile(const node_table &nodes, const expr_t &expr)
+{
+    // sum starts from 0 as in eval(): 0+(-0) is +0
+    emit_const(0);
+    for (node_id i = expr.first; i != no_node; i = nodes.prods[i].next)
+    {
+        compile(nodes, nodes.prods[i]);
+        emit(op_add, -1);
+    }
+}
+void program::compile_linear(const node_table &nodes, const term_t &term)
+{
+    // x is never in a log
+    if (term.expr_value == no_node)
+    {
+        emit_const(term.num_value);
+        emit_const(term.num_value);
+        return;
+    }
+    compile_linear(nodes, nodes.exprs[term.expr_value]);
+    if (term.num_value != 1.0)
+    {
+        emit_const(term.num_value);
+        emit(op_mul2, -1);
+    }
+}
+void program::compile_linear(const node_table &nodes, const prod_t &prod)
+{
+    for (node_id i = prod.first; i != no_node; i = nodes.terms[i].next)
+    {
+        const term_t &term = nodes.terms[i];
+        if (i == prod.xterm)
+        {
+            compile_linear(nodes, term);
+            if (i != prod.first)
+                emit(op_mulp, -2);
+            continue;
+        }
+        if (i == prod.first)
+        {
+            emit_const(1);
+            emit_const(1);
+        }
+        compile(nodes, term);
+        emit(term.div ? op_div2 : op_mul2, -1);
+    }
+}
+void program::compile_linear(const node_table &nodes, const expr_t &expr)
+{
+    emit_const(0);
+    emit_const(0);
+    for (node_id i = expr.first; i != no_node; i = nodes.prods[i].next)
+    {
+        const prod_t &prod = nodes.prods[i];
+        if (prod.xterm == no_node)
+        {
+            compile(nodes, prod);
+            emit(op_addk, -1);
+        }
+        else
+        {
+            compile_linear(nodes, prod);
+            emit(has_constant(nodes, prod) ? op_add2 : op_addc, -2);
+        }
+    }
+}
+
+// The first error of each value is kept next to it and carried into the
+// values computed from it, the one of the left operand first: the error
+// run() raises at the end is the one eval() or eval_linear() reports for
+// the part, even when the two values of a pair are computed interleaved.
+double program_view::run(double x) const
+{
+    double buf[64];
+    uint8_t ebuf[64];
+    std::vector<double> heap;
+    std::vector<uint8_t> eheap;
+    double *stack = buf;
+    uint8_t *errs = ebuf;
+    if (max_depth > 64)
+    {
+        heap.resize(max_depth);
+        eheap.resize(max_depth);
+        stack = &heap[0];
+        errs = &eheap[0];
+    }
+    double *sp = stack - 1;
+    uint8_t *ep = errs - 1;
+    auto first = [](uint8_t a, uint8_t b) { return a ? a : b; };
+    const double *c = consts;
+    for (const uint8_t *op = code, *end = code + code_size; op != end; ++op)
+    {
+        switch (*op)
+        {
+        case op_const:
+            *++sp = *c++;
+            *++ep = error_none;
+            break;
+        case op_x:
+            *++sp = x;
+            *++ep = error_none;
+            break;
+        case op_add:
+            sp[-1] += sp[0];
+            ep[-1] = first(ep[-1], ep[0]);
+            --sp, --ep;
+            break;
+        case op_mul:
+            sp[-1] *= sp[0];
+            ep[-1] = first(ep[-1], ep[0]);
+            --sp, --ep;
+            break;
+        case op_div:
+            ep[-1] = first(ep[-1], first(ep[0], sp[0] ? error_none : error_division_by_0));
+            sp[-1] /= sp[0];
+            --sp, --ep;
+            break;
+        case op_log:
+            ep[0] = first(ep[0], sp[0] <= 0 ? error_log_domain : error_none);
+            sp[0] = log10(sp[0]);
+            break;
+        case op_solve:
+        {
+            // a, b, c, d of a*x + b = c*x + d
+            uint8_t e = first(first(ep[-3], ep[-2]), first(ep[-1], ep[0]));
+            double a = sp[-3] - sp[-1], b = sp[0] - sp[-2];
+            if (!e && a == 0.0)
+                e = b == 0.0 ? error_always_true : error_no_solution;
+            sp -= 3, ep -= 3;
+            sp[0] = b / a;
+            ep[0] = e;
+            break;
+        }
+        case op_mul2:
+            sp[-2] *= sp[0];
+            sp[-1] *= sp[0];
+            ep[-2] = first(ep[-2], ep[0]);
+            ep[-1] = first(ep[-1], ep[0]);
+            --sp, --ep;
+            break;
+        case op_div2:
+        {
+            uint8_t e = first(ep[0], sp[0] ? error_none : error_division_by_0);
+            sp[-2] /= sp[0];
+            sp[-1] /= sp[0];
+            ep[-2] = first(ep[-2], e);
+            ep[-1] = first(ep[-1], e);
+            --sp, --ep;
+            break;
+        }
+        case op_mulp:
+            sp[-3] *= sp[-1];
+            sp[-2] *= sp[0];
+            ep[-3] = first(ep[-3], ep[-1]);
+            ep[-2] = first(ep[-2], ep[0]);
+            sp -= 2, ep -= 2;
+            break;
+        case op_add2:
+            sp[-3] += sp[-1];
+            sp[-2] += sp[0];
+            ep[-3] = first(ep[-3], ep[-1]);
+            ep[-2] = first(ep[-2], ep[0]);
+            sp -= 2, ep -= 2;
+            break;
+        case op_addc:
+            sp[-3] += sp[-1];
+            ep[-3] = first(ep[-3], ep[-1]);
+            sp -= 2, ep -= 2;
+            break;
+        case op_addk:
+            sp[-1] += sp[0];
+            ep[-1] = first(ep[-1], ep[0]);
+            --sp, --ep;
+            break;
+        }
+    }
+    assert(sp == stack);
+    if (*ep)
+        throw expression_error(error_message((error_code)*ep), nullptr);
+    return *sp;
+}
@@ -0,0 +1,85 @@
+#ifndef bytecode_h_
+#define bytecode_h_
+
+#include "expression.h"
+#include "batch.h"
+
+
+// Linear stack-machine form of a parsed expression. Compile once, then run()
+// as many times as needed without touching the node table again.
+//
+// For an expression the program leaves its value; x (if any) is bound to the
+// argument of run(). For a linear equation a*x + b = c*x + d the program
+// evaluates each side once, as a pair of values (its a and b, or c and d)
+// that the pair ops below work on, and op_solve leaves (d - b) / (a - c),
+// raising the same errors as expression::solve().
+enum opcode : uint8_t
+{
+    op_const,   // push next constant
+    op_x,       // push x
+    op_add,
+    op_mul,
+    op_div,     // raises "division by 0"
+    op_log,     // raises "log of negative or 0"
+    op_solve,   // raises "linear equation always true" / "... has no solution"
+    op_mul2,    // pair, v: both values of the pair times v
+    op_div2,    // pair, v: both values of the pair divided by v
+    op_mulp,    // pair, pair: multiplied value by value
+    op_add2,    // pair, pair: added value by value
+    op_addc,    // pair, pair: the first values added, the second pair dropped
+    op_addk,    // pair, v: v added to the second value
+};
+
+// Code and constants of a program kept elsewhere, such as in a mapped
+// program_file; run() is program::run() on them.
+struct program_view
+{
+    const uint8_t *code;
+    const double *consts;
+    uint32_t code_size, const_count;
+    int max_depth;
+
+    double run(double x = 0) const;
+};
+
+class program
+{
+public:
+    program() : max_depth(0) {}
+    explicit program(expression &e) { compile(e); }
+    void compile(expression &e);
+    double run(double x = 0) const { return view().run(x); }
+    program_view view() const
+    {
+        program_view v = {code.data(), consts.data(), (uint32_t)code.size(), (uint32_t)consts.size(), max_depth};
+        return v;
+    }
+    // evaluates a function of x for each of x[0..n). Failing elements get
+    // res[i] = NaN and err[i] = the error_code of the first error they hit,
+    // the others error_none. Throws expression_error with
+    // error_tabulate_equation only if the program is an equation, whatever
+    // x holds.
+    void run(const double *x, double *res, uint8_t *err, size_t n, simd_level level = simd_auto) const;
+    bool empty() const { return code.empty(); }
+
+private:
+    friend class jit_function;
+    void emit(opcode op, int depth);
+    void emit_const(double value);
+    // the value of a node, x bound to the argument of run()
+    void compile(const node_table &nodes, const expr_t &expr);
+    void compile(const node_table &nodes, const prod_t &prod);
+    void compile(const node_table &nodes, const term_t &term);
+    // the a and b of a*x + b of a node of a linear equation, as a pair
+    void compile_linear(const node_table &nodes, const expr_t &expr);
+    void compile_linear(const node_table &nodes, const prod_t &prod);
+    void compile_linear(const node_table &nodes, const term_t &term);
+
+    std::vector<uint8_t> code;
+    std::vector<double> consts;
+    int depth;
+    int max_depth;
+};
+
+
+#endif /* bytecode_h_ */
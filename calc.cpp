@@ -1,257 +1,1074 @@
-#include <assert.h>
-#include <iostream>
-#include <sstream>
-#include <string>
-#include "expression.h"
-#ifndef _WIN32
-#include <readline/readline.h>
-#include <readline/history.h>
-#endif
-
-static int ok_count = 0, err_count = 0;
-static void eval(const char *expr, double &res, std::string &err_msg, int &err_pos, bool test_serialize = false)
-{
-    try
-    {
-        expression parser(expr);
-        if (test_serialize)
-        {
-            std::stringstream ss;
-            ss << parser;
-            parser.parse(ss.str().c_str());
-        }
-        res = parser.solve();
-        err_msg.clear();
-        err_pos = -1;
-    }
-    catch (const expression_error &e)
-    {
-        res = 0;
-        err_msg = e.what();
-        err_pos = (int)(e.p ? e.p - expr : -1);
-    }
-}
-
-void TEST(const char *expr, double expected_res, const char *err_msg = "", int err_pos = 0)
-{
-    double res0, res1, resX;
-    std::string err_msg0, err_msg1, err_msgX;
-    int err_pos0, err_pos1, err_posX;
-    eval(expr, res0, err_msg0, err_pos0);
-    if (err_pos0==-1)
-    {
-        eval(expr, resX, err_msgX, err_posX, true);
-        assert(res0==resX && err_msg0==err_msgX);
-    }
-
-    const char *pos = strchr(expr, '=');
-    if (pos)
-    {
-        std::string expr_m(pos+1);
-        expr_m += '=';
-        expr_m.append(expr, pos);
-        eval(expr_m.c_str(), res1, err_msg1, err_pos1);
-        if (err_pos1 != -1)
-        {
-            int e_pos = expr_m.size() - (pos - expr);
-            if (err_pos1 >= e_pos)
-                err_pos1 -= e_pos;
-            else
-                err_pos1 += (expr_m.size() - e_pos) + 1;
-        }
-        if (res0!=res1 || err_msg0!=err_msg1 ||
-            (err_msg0!="multiple variables in linear equation" && err_pos0!=err_pos1))
-        {
-            fprintf(stderr, "error: linear equation parsing\n");
-            err_count++;
-        }
-    }
-    try
-    {
-        double res = expression(expr).solve();
-        char str[256];
-        sprintf(str, "%.10f %.10f", res, expected_res);
-        double d1, d2;
-        sscanf(str, "%lf %lf", &d1, &d2);
-        if (d1 == d2 && err_msg[0]=='\0' && err_pos==0)
-            ok_count++;
-        else
-            err_count++;
-    }
-    catch (const expression_error &e)
-    {
-        if (0==strcmp(err_msg, e.what()) && err_pos == (int)(e.p ? e.p - expr : -1))
-            ok_count++;
-        else
-        {
-            err_count++;
-            fprintf(stderr, "expression error: %s (at pos=%d)\n", e.what(), (int)(e.p ? e.p - expr : -1));
-        }
-    }
-}
-
-int test()
-{
-    TEST("1", 1);
-    TEST("1.", 1);
-    TEST("1.0", 1);
-    TEST("1.0000", 1);
-    TEST("0.123", 0.123);
-    TEST("-0.123", -0.123);
-    TEST("-0.123(3+4)", -0.861);
-    TEST("-0.123/(3+log(100))", -0.0246);
-    TEST("1.0/3", 0.33333333333);
-    TEST("log 100", 2);
-    TEST("log(100)", 2);
-    TEST("log--100", 2);
-    TEST("5log--100", 10);
-    TEST("log(log(1000))", 0.47712125472);
-    TEST("log log(1000)", 0.47712125472);
-    TEST("log log 1000", 0.47712125472);
-    TEST("-0.123/(3+log 100)log(10)(1+1*5/6(3*2))", -0.1476);
-    TEST("(0.1/3+.1/3+10/300)/0.001e10", 1e-8);
-    TEST("(0.1/3+.1/3+10/300+3.14159265359)/1e8+10", 10.0000000324);
-    TEST("log((((((0.1/3+.1/3+1/30+3.14159265359)/1e8+10)))))", 1.00000000141);
-    TEST("-5log(((((.2/3+1/3+3.1415926535)/1e8+10))))(0+.1)", -0.50000000076);
-    TEST("-5log(((((.2/3+1/3+3.1415926535)/1e8+10))))(0+.1)+1", 0.49999999923);
-
-    TEST("2x=log 100", 1);
-    TEST("2x+5-x*10 = log 100/2", 0.5);
-    TEST("2 * x + 0.5 = 1", 0.25);
-    TEST("1*(2 * x) + 0.5 = 1", 0.25);
-    TEST("2x + 1 = 2(1-x)", 0.25);
-    TEST("2x + 1 = 2(1-0.5*((2x+10)))", -2.25);
-
-    TEST("", 0, "expected a value", 0);
-    TEST("abc", 0, "expected a value", 0);
-    TEST("log100", 0, "expected a value", 0);
-    TEST("()", 0, "expected a value", 1);
-    TEST("1/", 0, "expected a value", 2);
-    TEST("1//2", 0, "expected a value", 2);
-    TEST("1*-", 0, "expected a value", 3);
-    TEST("1/()", 0, "expected a value", 3);
-    TEST("2(1+", 0, "expected a value", 4);
-    TEST("0..123", 0, "unexpected input", 2);
-    TEST("1 1", 0, "unexpected input", 2);
-    TEST("1*(1+3 1)", 0, "unexpected input", 7);
-    TEST("1/(1", 0, "expected ')'", 4);
-    TEST("1/(((1", 0, "expected ')'", 6);
-    TEST("1*(1+3", 0, "expected ')'", 6);
-    TEST("1*(2 * 2*(((x+1))) + 0.5 = 1", 0, "expected ')'", 25);
-    TEST("1/0", 0, "division by 0", -1);
-    TEST("log -1", 0, "log of negative or 0", -1);
-    TEST("1=1", 0, "linear equation missing 'x'", -1);
-    TEST("x", 0, "linear equation missing right hand side", 1);
-    TEST("1/x=1", 0, "division or log in linear equation", 2);
-    TEST("log(x)=1", 0, "division or log in linear equation", 4);
-    TEST("10/((1+1(1+x)))=1", 0, "division or log in linear equation", 11);
-    TEST("log((1+1(1+x)))=1", 0, "division or log in linear equation", 11);
-    TEST("x*x=1", 0, "non-linear equation", 3);
-    TEST("1x+log 100x*5(1+x)=1", 0, "non-linear equation", 18);
-    TEST("(1+(1+x))*log(100)*((1+(1+x)))=1", 0, "non-linear equation", 30);
-    TEST("x=y", 0, "multiple variables in linear equation", 2);
-    TEST("x=6(1+y)", 0, "multiple variables in linear equation", 6);
-    TEST("1(x)=1(y)", 0, "multiple variables in linear equation", 7);
-    TEST("x=x", 0, "linear equation always true", -1);
-    TEST("x=x+1", 0, "linear equation has no solution", -1);
-
-    if (err_count)
-        printf("%d tests passed, %d tests failed\n", ok_count, err_count);
-    else
-        printf("OK (%d tests passed)\n", ok_count);
-    return err_count;
-}
-
-bool read_line(const char *msg, std::string &ret)
-{
-#ifndef _WIN32
-    rl_bind_key('\t', rl_insert);
-    char *str = readline(msg);
-    if (!str)
-        return false;
-    ret = str;
-    if (*str)
-        add_history(str);
-    free(str);
-#else
-    std::cout << msg;
-    std::cout.flush();
-    if (!std::getline(std::cin, ret))
-        return false;
-#endif
-    return true;
-}
-
-bool read_expr(std::string &expr)
-{
-    do
-    {
-        if (!read_line(">>> ", expr))
-            return false;
-    }
-    while (expr.empty());
-    while (expr[expr.size() - 1] == '\\')
-    {
-        std::string extra;
-        if (!read_line("... ", extra))
-            return false;
-        expr.resize(expr.size()-1);
-        expr.append(extra);
-    }
-    return true;
-}
-
-static std::string to_string(double d)
-{
-    char str[128];
-    sprintf(str, "%.12g", d);
-    return str;
-}
-
-void calc_help()
-{
-    std::cout <<
-        "Enter simple mathematical expressions or linear equations \n"
-        "with similar grammar as google calculator. For example: \n"
-        "    (3+(4-1))*5\n"
-        "    2 * x + 0.5 = 1\n"
-        "    2x + 1 = 2(1-x)\n"
-        "To run tests type \"test\"\n"
-        "To exit type \"exit\", \"q\", or Ctrl+C" << std::endl;
-}
-
-static int calc_eval(const std::string &expr)
-{
-    if (expr == "q" || expr == "exit")
-        return 0;
-    else if (expr == "help" || expr == "--help" || expr == "?" || expr == "/?")
-        calc_help();
-    else if (expr == "test")
-        return test();
-    else try
-    {
-        std::cout << to_string(expression(expr.c_str()).solve());
-    }
-    catch (const expression_error &e)
-    {
-        std::cout << "expression error: " << e.what();
-        if (e.p)
-            std::cout <<" (at pos=" << (int)(e.p - expr.c_str()) << ")";
-    }
-    return 1;
-}
-
-void calc()
-{
-    std::cout << "type \"help\" or \"?\" for quick help" << std::endl;
-    for (std::string expr; read_expr(expr) && calc_eval(expr);)
-        std::cout << std::endl;
-}
-
-int main(int argc, const char **argv)
-{
-    if (argc>1)
-        return calc_eval(argv[1]);
-    calc();
-    return 0;
-}
+#include <assert.h>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include "expression.h"
+#include "bytecode.h"
+#include "number.h"
+#include "calc_batch.h"
+#include "calc_server.h"
+#include "result_cache.h"
+#include "stream_eval.h"
+#include "static_expression.h"
+#include "libcalc.h"
+#include "jit.h"
+#include "parallel_eval.h"
+#include "program_file.h"
+#include "system.h"
+#include "worksheet.h"
+#include "stats.h"
+#ifdef __linux__
+#include <thread>
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
+#ifndef _WIN32
+#include <readline/readline.h>
+#include <readline/history.h>
+#endif
+
+static int ok_count = 0, err_count = 0;
+static void eval(const char *expr, double &res, std::string &err_msg, int &err_pos, bool test_serialize = false, bool test_compile = false, bool test_jit = false)
+{
+    try
+    {
+        expression parser(expr);
+        if (test_serialize)
+        {
+            std::stringstream ss;
+            ss << parser;
+            parser.parse(ss.str().c_str());
+        }
+        res = test_jit ? jit_function(parser).run() : test_compile ? program(parser).run() : parser.solve();
+        err_msg.clear();
+        err_pos = -1;
+    }
+    catch (const expression_error &e)
+    {
+        res = 0;
+        err_msg = e.what();
+        err_pos = (int)(e.p ? e.p - expr : -1);
+    }
+}
+
+// stream_eval of expr from memory and from a file read a byte at a time,
+// without and with a final line end
+static bool stream_matches(const char *expr, double res, const std::string &err_msg, int err_pos)
+{
+    for (int from_file = 0; from_file < 3; ++from_file)
+    {
+        stream_eval se(1);
+        double value;
+        stream_status s;
+        if (from_file)
+        {
+            FILE *f = tmpfile();
+            fputs(expr, f);
+            if (from_file == 2)
+                fputs("\n", f);
+            rewind(f);
+            s = se.eval(f, value);
+            fclose(f);
+        }
+        else
+            s = se.eval(expr, strlen(expr), value);
+        if (memcmp(&value, &res, sizeof(res)) || err_msg != s.message() || err_pos != s.pos)
+            return false;
+    }
+    return true;
+}
+
+// calc::compile, run here at run time, has the result, message and position of expr
+static bool compile_matches(const char *expr, double res, const std::string &err_msg, int err_pos)
+{
+    try
+    {
+        return calc::compile(expr).solve(expr) == res && err_msg.empty();
+    }
+    catch (const expression_error &e)
+    {
+        return err_msg == e.what() && err_pos == (int)(e.p ? e.p - expr : -1);
+    }
+}
+static_assert(calc::compile("2x + 1")(3) == 7, "");
+static_assert(calc::compile("3(2(x+1)+1)/2 = 3").solve() == -0.5, "");
+static_assert(calc::compile("-5log--100 (1+1)").solve() == -20, "");
+static_assert(calc::compile("2x/(1-1) = 1").error() == error_division_by_0, "");
+static_assert(calc::compile("2x + 1  ").end == 8, "");
+static_assert(calc::compile("9007199254740993.0000000000000000001").solve() == 9007199254740994.0, "");
+static_assert(calc::compile("2.4703282292062328e-324").solve() == 4.9406564584124654e-324, "");
+static_assert(calc::compile("2.2250738585072011e-308").solve() == 2.2250738585072009e-308, "");
+
+void TEST(const char *expr, double expected_res, const char *err_msg = "", int err_pos = 0)
+{
+    double res0, res1, resX;
+    std::string err_msg0, err_msg1, err_msgX;
+    int err_pos0, err_pos1, err_posX;
+    eval(expr, res0, err_msg0, err_pos0);
+    if (err_pos0==-1)
+    {
+        eval(expr, resX, err_msgX, err_posX, true);
+        assert(res0==resX && err_msg0==err_msgX);
+    }
+    eval(expr, resX, err_msgX, err_posX, false, true);
+    if (res0!=resX || err_msg0!=err_msgX || err_pos0!=err_posX)
+    {
+        fprintf(stderr, "error: bytecode evaluation\n");
+        err_count++;
+    }
+    eval(expr, resX, err_msgX, err_posX, false, false, true);
+    if (res0!=resX || err_msg0!=err_msgX || err_pos0!=err_posX)
+    {
+        fprintf(stderr, "error: jit evaluation\n");
+        err_count++;
+    }
+    {
+        // the non-throwing interface gives the same result, message and position
+        expression parser;
+        expression_status s = parser.try_parse(expr);
+        if (s.ok())
+            s = parser.try_solve(resX);
+        else
+            resX = 0;
+        if (res0!=resX || err_msg0!=s.message() || err_pos0!=s.pos)
+        {
+            fprintf(stderr, "error: status evaluation\n");
+            err_count++;
+        }
+        if (s.pos == -1)
+        {
+            // so does evaluation with the sub-expressions shared
+            parser.try_parse(expr);
+            parser.share_subexpressions();
+            s = parser.try_solve(resX);
+            if (res0!=resX || err_msg0!=s.message())
+            {
+                fprintf(stderr, "error: shared evaluation\n");
+                err_count++;
+            }
+        }
+    }
+
+    // so does the streaming evaluator, which has no x
+    bool one_letter = false;
+    for (const char *c = expr; *c; ++c)
+        one_letter |= isalpha(*c) && (c == expr || !isalpha(c[-1])) && !isalpha(c[1]);
+    if (!strchr(expr, '=') && !one_letter && !stream_matches(expr, res0, err_msg0, err_pos0))
+    {
+        fprintf(stderr, "error: stream evaluation\n");
+        err_count++;
+    }
+    if (!compile_matches(expr, res0, err_msg0, err_pos0))
+    {
+        fprintf(stderr, "error: constexpr evaluation\n");
+        err_count++;
+    }
+
+    const char *pos = strchr(expr, '=');
+    if (pos)
+    {
+        std::string expr_m(pos+1);
+        expr_m += '=';
+        expr_m.append(expr, pos);
+        eval(expr_m.c_str(), res1, err_msg1, err_pos1);
+        if (err_pos1 != -1)
+        {
+            int e_pos = expr_m.size() - (pos - expr);
+            if (err_pos1 >= e_pos)
+                err_pos1 -= e_pos;
+            else
+                err_pos1 += (expr_m.size() - e_pos) + 1;
+        }
+        if (res0!=res1 || err_msg0!=err_msg1 ||
+            (err_msg0!="multiple variables in linear equation" && err_pos0!=err_pos1))
+        {
+            fprintf(stderr, "error: linear equation parsing\n");
+            err_count++;
+        }
+    }
+    try
+    {
+        double res = expression(expr).solve();
+        char str[256];
+        sprintf(str, "%.10f %.10f", res, expected_res);
+        double d1, d2;
+        sscanf(str, "%lf %lf", &d1, &d2);
+        if (d1 == d2 && err_msg[0]=='\0' && err_pos==0)
+            ok_count++;
+        else
+            err_count++;
+    }
+    catch (const expression_error &e)
+    {
+        if (0==strcmp(err_msg, e.what()) && err_pos == (int)(e.p ? e.p - expr : -1))
+            ok_count++;
+        else
+        {
+            err_count++;
+            fprintf(stderr, "expression error: %s (at pos=%d)\n", e.what(), (int)(e.p ? e.p - expr : -1));
+        }
+    }
+}
+
+// tabulates a function of x with every simd level and compares with the scalar VM
+void TEST_BATCH(const char *expr)
+{
+    std::vector<double> x(1000), res(x.size());
+    std::vector<uint8_t> err(x.size());
+    for (size_t i = 0; i < x.size(); ++i)
+        x[i] = i / 64.0 - 5;
+    x[1] = 1e-310;
+    x[2] = INFINITY;
+    x[3] = NAN;
+    try
+    {
+        expression parser(expr, true);
+        program prog(parser);
+        for (int level = simd_scalar; level <= simd_auto; ++level)
+        {
+            prog.run(&x[0], &res[0], &err[0], x.size(), (simd_level)level);
+            for (size_t i = 0; i < x.size(); ++i)
+            {
+                double expected = 0;
+                std::string msg;
+                try
+                {
+                    expected = prog.run(x[i]);
+                }
+                catch (const expression_error &e)
+                {
+                    msg = e.what();
+                }
+                if (msg != error_message((error_code)err[i]) ||
+                    (!err[i] && res[i] != expected && !(fabs(res[i] - expected) <= 1e-15 * fabs(expected))
+                        && !(res[i] != res[i] && expected != expected)))
+                {
+                    fprintf(stderr, "error: batch evaluation of %s at x=%g\n", expr, x[i]);
+                    err_count++;
+                    return;
+                }
+            }
+        }
+        // the native code gives the same bits, or NaN where the VM raises
+        jit_function jit(parser);
+        for (size_t i = 0; i < x.size() && jit.native(); ++i)
+        {
+            double native = jit.native()(x[i]), expected = NAN;
+            try
+            {
+                expected = prog.run(x[i]);
+            }
+            catch (const expression_error &)
+            {
+            }
+            if (memcmp(&native, &expected, sizeof(native)) && !(native != native && expected != expected))
+            {
+                fprintf(stderr, "error: jit evaluation of %s at x=%g\n", expr, x[i]);
+                err_count++;
+                return;
+            }
+        }
+        ok_count++;
+    }
+    catch (const expression_error &e)
+    {
+        fprintf(stderr, "expression error: %s (at pos=%d)\n", e.what(), (int)(e.p ? e.p - expr : -1));
+        err_count++;
+    }
+}
+
+// parses a whole number string and compares bit for bit, then checks that
+// the formatted value parses back to the same bits
+void TEST_NUMBER(const char *str, double expected, char decimal_point = '.')
+{
+    double res, back = 0;
+    char text[number_buffer_size];
+    const char *end = parse_number(str, res, decimal_point);
+    format_number(res, text, decimal_point);
+    if (!parse_number(text, back, decimal_point))   // "inf"
+        back = res;
+    // calc::compile() knows only '.'
+    double compiled = decimal_point == '.' ? calc::compile(str).solve() : res;
+    if (end && !*end && memcmp(&res, &expected, sizeof(res)) == 0 && memcmp(&back, &res, sizeof(res)) == 0
+        && memcmp(&compiled, &res, sizeof(res)) == 0)
+        ok_count++;
+    else
+    {
+        fprintf(stderr, "error: parsing number %s\n", str);
+        err_count++;
+    }
+}
+
+// evaluates expr through cache, compares with an uncached evaluation and
+// checks whether it was a cache hit
+void TEST_CACHE(result_cache &cache, const char *expr, bool hit)
+{
+    double res;
+    std::string err_msg;
+    int err_pos;
+    eval(expr, res, err_msg, err_pos);
+    size_t hits = cache.hits();
+    double value;
+    expression_status cached = cache.eval(expr, value);
+    if (value == res && err_msg == cached.message() && cached.pos == err_pos
+        && (cache.hits() > hits) == hit)
+        ok_count++;
+    else
+    {
+        fprintf(stderr, "error: cached evaluation of %s\n", expr);
+        err_count++;
+    }
+}
+
+// shares the sub-expressions of expr, checks the number of nodes removed and
+// that the tree prints and evaluates as before
+void TEST_SHARE(const char *expr, size_t removed)
+{
+    expression parser(expr);
+    std::stringstream before, after;
+    before << parser;
+    double expected = parser.solve();
+    size_t n = parser.share_subexpressions();
+    after << parser;
+    double res = parser.solve();
+    if (n == removed && before.str() == after.str() && res == expected && parser.solve() == expected)
+        ok_count++;
+    else
+    {
+        fprintf(stderr, "error: shared sub-expressions of %s (%zu removed)\n", expr, n);
+        err_count++;
+    }
+}
+
+// tokenizes str at every simd level and at every offset in a 32-byte block,
+// the scanners must agree with the scalar one; count is the expected number
+// of tokens before token_end
+void TEST_TOKENS(const char *str, size_t count)
+{
+    size_t len = strlen(str);
+    std::vector<char> buf(len + 64);
+    char *base = (char*)(((uintptr_t)&buf[0] + 31) & ~(uintptr_t)31);
+    std::vector<token> expected, tokens;
+    tokenize(str, expected, simd_scalar);
+    bool ok = expected.size() == count + 1 && expected.back().kind == token_end && expected.back().pos == len;
+    for (size_t offset = 0; ok && offset < 32; ++offset)
+    {
+        memcpy(base + offset, str, len + 1);
+        for (int level = simd_scalar; ok && level <= simd_auto; ++level)
+        {
+            tokenize(base + offset, tokens, (simd_level)level);
+            ok = tokens.size() == expected.size();
+            for (size_t i = 0; ok && i < tokens.size(); ++i)
+                ok = tokens[i].pos == expected[i].pos && tokens[i].kind == expected[i].kind && tokens[i].c == expected[i].c;
+        }
+    }
+    if (ok)
+        ok_count++;
+    else
+    {
+        fprintf(stderr, "error: tokens of %s\n", str);
+        err_count++;
+    }
+}
+
+// writes exprs to a program file image and checks that the programs run in
+// place give the same bits and errors as the compiled ones, and that damaged
+// images are rejected
+void TEST_PROGRAM_FILE(const std::vector<const char*> &exprs, bool x_free)
+{
+    std::vector<program> progs(exprs.size());
+    program_file_writer writer;
+    for (size_t i = 0; i < exprs.size(); ++i)
+    {
+        expression e(exprs[i], x_free);
+        progs[i].compile(e);
+        writer.add(progs[i]);
+    }
+    std::vector<uint64_t> img = writer.image();
+    program_file file;
+    bool ok = file.attach(&img[0], 8 * img.size()) && file.size() == exprs.size();
+    const double xs[] = {-1, 0, 0.5, 3};
+    for (size_t i = 0; ok && i < file.size(); ++i)
+    {
+        for (double x : xs)
+        {
+            double expected = 0, res = 0;
+            std::string msg, expected_msg;
+            try { expected = progs[i].run(x); } catch (const expression_error &e) { expected_msg = e.what(); }
+            try { res = file[i].run(x); } catch (const expression_error &e) { msg = e.what(); }
+            ok = ok && memcmp(&res, &expected, sizeof(res)) == 0 && msg == expected_msg;
+        }
+    }
+    if (ok)
+    {
+        size_t code = file[0].code - (const uint8_t*)&img[0];
+        std::vector<uint64_t> bad = img;
+        ok = !file.attach(&bad[0], 8 * bad.size() - 8);
+        ((program_file_header*)&bad[0])->version++;
+        ok = ok && !file.attach(&bad[0], 8 * bad.size());
+        bad = img;
+        ((uint8_t*)&bad[0])[code] = op_add;
+        ok = ok && !file.attach(&bad[0], 8 * bad.size());
+    }
+    if (ok)
+        ok_count++;
+    else
+    {
+        fprintf(stderr, "error: program file of %s\n", exprs[0]);
+        err_count++;
+    }
+}
+
+// the C interface gives the results of expression for a batch of texts, and
+// the ones of program for a tabulated function
+void TEST_LIBRARY(const std::vector<const char*> &texts, const char *function)
+{
+    calc_context *ctx = calc_context_create();
+    std::vector<double> values(texts.size());
+    std::vector<int32_t> codes(texts.size()), positions(texts.size());
+    size_t solved = calc_solve(ctx, &texts[0], texts.size(), &values[0], &codes[0], &positions[0]), expected_solved = 0;
+    bool ok = true;
+    for (size_t i = 0; i < texts.size(); ++i)
+    {
+        double expected = 0;
+        expression e;
+        expression_status s = e.try_parse(texts[i]);
+        if (s.ok())
+            s = e.try_solve(expected);
+        expected_solved += s.ok();
+        ok = ok && memcmp(&values[i], &expected, sizeof(expected)) == 0 && codes[i] == s.code && positions[i] == s.pos
+            && strcmp(calc_error_message(codes[i]), s.message()) == 0;
+    }
+    ok = ok && solved == expected_solved && strcmp(calc_error_message(CALC_ERROR_COUNT), "unknown error") == 0
+        && strcmp(calc_error_message(CALC_ERROR_OUT_OF_MEMORY), "out of memory") == 0;
+
+    int32_t code, pos;
+    calc_function *fn = calc_parse(ctx, function, &code, &pos);
+    expression e;
+    expression_status s = e.try_parse(function, true);
+    ok = ok && (fn != nullptr) == s.ok() && code == s.code && pos == s.pos;
+    if (fn)
+    {
+        std::vector<double> x(300), res(x.size()), expected(x.size());
+        std::vector<int32_t> errs(x.size());
+        std::vector<uint8_t> expected_errs(x.size());
+        for (size_t i = 0; i < x.size(); ++i)
+            x[i] = i / 16.0 - 5;
+        calc_tabulate(ctx, fn, &x[0], &res[0], &errs[0], x.size());
+        program(e).run(&x[0], &expected[0], &expected_errs[0], x.size());
+        for (size_t i = 0; i < x.size(); ++i)
+            ok = ok && memcmp(&res[i], &expected[i], sizeof(double)) == 0
+                && strcmp(calc_error_message(errs[i]), error_message((error_code)expected_errs[i])) == 0;
+        calc_function_destroy(fn);
+    }
+    calc_context_destroy(ctx);
+    if (ok)
+        ok_count++;
+    else
+    {
+        fprintf(stderr, "error: libcalc with %s\n", function);
+        err_count++;
+    }
+}
+
+// sends pipelined lines to an eval_server, the last one without '\n', and
+// compares the answers with expected
+void TEST_SERVER(const char *lines, const char *expected)
+{
+#ifdef __linux__
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/calc_test_%d.sock", (int)getpid());
+    eval_server server(2);
+    std::string answers;
+    if (server.listen(path))
+    {
+        std::thread t([&] { server.run(); });
+        int fd = connect_server(path);
+        if (fd >= 0 && send(fd, lines, strlen(lines), MSG_NOSIGNAL) == (ssize_t)strlen(lines) && shutdown(fd, SHUT_WR) == 0)
+        {
+            char buf[256];
+            for (ssize_t n; (n = recv(fd, buf, sizeof(buf), 0)) > 0;)
+                answers.append(buf, (size_t)n);
+        }
+        if (fd >= 0)
+            close(fd);
+        server.stop();
+        t.join();
+    }
+    if (answers == expected)
+        ok_count++;
+    else
+    {
+        fprintf(stderr, "error: server answers to %s\n", lines);
+        err_count++;
+    }
+#endif
+}
+
+// solves a system with the dense and with the sparse solver and compares
+// the values of the named variables, or the error of the first equation
+// that fails (or of solve) and that it added no variables
+void TEST_SYSTEM(const std::vector<std::string> &equations, const std::vector<std::pair<std::string, double>> &expected,
+    const char *err_msg = "", int err_pos = -1)
+{
+    bool ok = true;
+    for (size_t dense_limit : {1000, 0})
+    {
+        linear_system sys;
+        sys.set_dense_limit(dense_limit);
+        expression_status s = {error_none, -1};
+        for (size_t i = 0; s.ok() && i < equations.size(); ++i)
+        {
+            size_t known = sys.variables().size();
+            s = sys.add(equations[i].c_str());
+            ok = ok && (s.ok() || sys.variables().size() == known);
+        }
+        std::vector<double> values;
+        if (s.ok())
+            s = sys.solve(values);
+        ok = ok && 0==strcmp(s.message(), err_msg) && s.pos == err_pos;
+        std::map<std::string, double> named;
+        for (size_t i = 0; i < values.size(); ++i)
+            named[sys.variables().name((uint32_t)i)] = values[i];
+        for (size_t i = 0; ok && s.ok() && i < expected.size(); ++i)
+            ok = named.count(expected[i].first) && fabs(named[expected[i].first] - expected[i].second) <= 1e-9 * (1 + fabs(expected[i].second));
+    }
+    if (ok)
+        ok_count++;
+    else
+    {
+        fprintf(stderr, "error: system of %s\n", equations[0].c_str());
+        err_count++;
+    }
+}
+
+// heat balance on a k x k grid whose solution is t(i,j) = i - j/2; with
+// singular, the first equation is repeated instead of the last one
+static void TEST_GRID_SYSTEM(int k, bool singular)
+{
+    std::vector<std::string> equations;
+    std::vector<std::pair<std::string, double>> expected;
+    char eq[256];
+    for (int i = 0; i < k; ++i)
+    {
+        for (int j = 0; j < k; ++j)
+        {
+            std::string rhs;
+            double c = 4.5 * (i - j / 2.0);
+            const int di[] = {-1, 1, 0, 0}, dj[] = {0, 0, -1, 1};
+            for (int d = 0; d < 4; ++d)
+            {
+                int a = i + di[d], b = j + dj[d];
+                if (a < 0 || a >= k || b < 0 || b >= k)
+                    continue;
+                snprintf(eq, sizeof(eq), "t%d_%d + ", a, b);
+                rhs += eq;
+                c -= a - b / 2.0;
+            }
+            snprintf(eq, sizeof(eq), "4.5t%d_%d = %s%.17g", i, j, rhs.c_str(), c);
+            equations.push_back(eq);
+            snprintf(eq, sizeof(eq), "t%d_%d", i, j);
+            expected.push_back(std::make_pair(std::string(eq), i - j / 2.0));
+        }
+    }
+    if (singular)
+        equations.back() = equations[0];
+    TEST_SYSTEM(equations, expected, singular ? "linear system has infinitely many solutions" : "");
+}
+
+// defines the lines of a sheet and recomputes it, then applies update and
+// compares the names it changed as "name=value name=error ..." and the
+// number of formulas evaluated; or the error of the first line that fails
+// and its cycle as "a b a"
+void TEST_SHEET(const std::vector<const char*> &lines, const char *update, const char *changed, size_t evaluated,
+    const char *err_msg = "", int err_pos = -1, const char *cycle = "")
+{
+    worksheet sheet;
+    expression_status s = {error_none, -1};
+    for (size_t i = 0; s.ok() && i < lines.size(); ++i)
+        s = sheet.set(lines[i]);
+    sheet.recompute();
+    if (s.ok() && update)
+        s = sheet.set(update);
+    std::string names, cycle_names;
+    size_t count = 0;
+    if (s.ok())
+    {
+        for (uint32_t name : sheet.recompute())
+        {
+            double value;
+            expression_status v = sheet.value(name, value);
+            char str[number_buffer_size];
+            format_number(value, str);
+            names += (names.empty() ? "" : " ") + sheet.variables().name(name) + "=" + (v.ok() ? str : v.message());
+        }
+        count = sheet.evaluated();
+    }
+    for (uint32_t name : sheet.cycle())
+        cycle_names += (cycle_names.empty() ? "" : " ") + sheet.variables().name(name);
+    if (names == changed && count == evaluated && 0==strcmp(s.message(), err_msg) && s.pos == err_pos && cycle_names == cycle)
+        ok_count++;
+    else
+    {
+        fprintf(stderr, "error: sheet of %s, changed %s\n", lines[0], names.c_str());
+        err_count++;
+    }
+}
+
+// solves expr with set_nonlinear(); the root is checked to 1e-12
+void TEST_NONLINEAR(const char *expr, double expected, const char *err_msg = "")
+{
+    expression e;
+    e.set_nonlinear(true);
+    double res = 0;
+    expression_status s = e.try_parse(expr);
+    if (s.ok())
+        s = e.try_solve(res);
+    if (0==strcmp(s.message(), err_msg) && (!s.ok() || fabs(res - expected) <= 1e-12 * (1 + fabs(expected))))
+        ok_count++;
+    else
+    {
+        fprintf(stderr, "error: %s = %.17g (%s)\n", expr, res, s.message());
+        err_count++;
+    }
+}
+
+// n copies of item joined by op, %d in item replaced by the index
+static std::string repeat(const char *item, const char *op, int n)
+{
+    std::string s;
+    char buf[256];
+    for (int i = 0; i < n; ++i)
+    {
+        snprintf(buf, sizeof(buf), item, i);
+        s += (i ? op : "") + std::string(buf);
+    }
+    return s;
+}
+// solves expr with parallel_eval in runs of chunk on 1, 2 and 5 threads: the
+// same bits every time, the error of solve() and its value to 1e-12
+void TEST_PARALLEL(const std::string &expr, size_t chunk)
+{
+    expression e;
+    double expected = 0, res[3] = {0, 0, 0};
+    expression_status s = e.try_parse(expr.c_str()), ps[3];
+    if (s.ok())
+        s = e.try_solve(expected);
+    bool ok = true;
+    unsigned threads[] = {1, 2, 5};
+    for (int i = 0; i < 3; ++i)
+    {
+        thread_pool pool(threads[i]);
+        parallel_eval p(pool, chunk);
+        e.set_parallel(&p);
+        ps[i] = e.try_parse(expr.c_str());
+        if (ps[i].ok())
+            ps[i] = e.try_solve(res[i]);
+        e.set_parallel(nullptr);
+        ok = ok && ps[i].code == s.code && memcmp(&res[i], &res[0], sizeof(double)) == 0;
+    }
+    if (ok && s.ok())
+        ok = fabs(res[0] - expected) <= 1e-12 * fabs(expected);
+    if (ok)
+        ok_count++;
+    else
+    {
+        fprintf(stderr, "error: parallel %.40s... = %.17g, %.17g (%s)\n", expr.c_str(), res[0], expected, ps[0].message());
+        err_count++;
+    }
+}
+
+int test()
+{
+    TEST("1", 1);
+    TEST("1.", 1);
+    TEST("1.0", 1);
+    TEST("1.0000", 1);
+    TEST("0.123", 0.123);
+    TEST("-0.123", -0.123);
+    TEST("-0.123(3+4)", -0.861);
+    TEST("-0.123/(3+log(100))", -0.0246);
+    TEST("1.0/3", 0.33333333333);
+    TEST("log 100", 2);
+    TEST("log(100)", 2);
+    TEST("log--100", 2);
+    TEST("5log--100", 10);
+    TEST("log(log(1000))", 0.47712125472);
+    TEST("log log(1000)", 0.47712125472);
+    TEST("log log 1000", 0.47712125472);
+    TEST("-0.123/(3+log 100)log(10)(1+1*5/6(3*2))", -0.1476);
+    TEST("(0.1/3+.1/3+10/300)/0.001e10", 1e-8);
+    TEST("(0.1/3+.1/3+10/300+3.14159265359)/1e8+10", 10.0000000324);
+    TEST("log((((((0.1/3+.1/3+1/30+3.14159265359)/1e8+10)))))", 1.00000000141);
+    TEST("-5log(((((.2/3+1/3+3.1415926535)/1e8+10))))(0+.1)", -0.50000000076);
+    TEST("-5log(((((.2/3+1/3+3.1415926535)/1e8+10))))(0+.1)+1", 0.49999999923);
+
+    TEST("2x=log 100", 1);
+    TEST("2x+5-x*10 = log 100/2", 0.5);
+    TEST("2 * x + 0.5 = 1", 0.25);
+    TEST("1*(2 * x) + 0.5 = 1", 0.25);
+    TEST("2x + 1 = 2(1-x)", 0.25);
+    TEST("2x + 1 = 2(1-0.5*((2x+10)))", -2.25);
+    TEST("3(2(x+1)+1)/2 = 3", -0.5);
+    TEST("1e308*10x = 1", 0);
+
+    TEST("", 0, "expected a value", 0);
+    TEST("abc", 0, "expected a value", 0);
+    TEST("log100", 0, "expected a value", 0);
+    TEST("()", 0, "expected a value", 1);
+    TEST("1/", 0, "expected a value", 2);
+    TEST("1//2", 0, "expected a value", 2);
+    TEST("1*-", 0, "expected a value", 3);
+    TEST("1/()", 0, "expected a value", 3);
+    TEST("2(1+", 0, "expected a value", 4);
+    TEST("0..123", 0, "unexpected input", 2);
+    TEST("1 1", 0, "unexpected input", 2);
+    TEST("1,5", 0, "unexpected input", 1);
+    TEST(",5", 0, "cannot parse number", 0);
+    TEST("1*(1+3 1)", 0, "unexpected input", 7);
+    TEST("1/(1", 0, "expected ')'", 4);
+    TEST("1/(((1", 0, "expected ')'", 6);
+    TEST("1*(1+3", 0, "expected ')'", 6);
+    TEST("1+2*(3", 0, "expected ')'", 6);
+    TEST("1/(1-1)+(2", 0, "expected ')'", 10);
+    TEST("1*(2 * 2*(((x+1))) + 0.5 = 1", 0, "expected ')'", 25);
+    TEST("1/0", 0, "division by 0", -1);
+    TEST("log -1", 0, "log of negative or 0", -1);
+    TEST("log(1-1) + 2log(1-1)/(1-1)", 0, "log of negative or 0", -1);
+    std::string deep = std::string(3000, '(') + "2x" + std::string(3000, ')') + "=1";
+    TEST(deep.c_str(), 0.5);
+    std::string too_deep = std::string(expression::default_max_depth + 1, '(') + "1" + std::string(expression::default_max_depth + 1, ')');
+    TEST(too_deep.c_str(), 0, "expression nested too deeply", expression::default_max_depth);
+    TEST("1=1", 0, "linear equation missing 'x'", -1);
+    TEST("x", 0, "linear equation missing right hand side", 1);
+    TEST("1/x=1", 0, "division or log in linear equation", 2);
+    TEST("log(x)=1", 0, "division or log in linear equation", 4);
+    TEST("10/((1+1(1+x)))=1", 0, "division or log in linear equation", 11);
+    TEST("log((1+1(1+x)))=1", 0, "division or log in linear equation", 11);
+    TEST("x*x=1", 0, "non-linear equation", 3);
+    TEST("1x+log 100x*5(1+x)=1", 0, "non-linear equation", 18);
+    TEST("(1+(1+x))*log(100)*((1+(1+x)))=1", 0, "non-linear equation", 30);
+    TEST("x=y", 0, "multiple variables in linear equation", 2);
+    TEST("x=6(1+y)", 0, "multiple variables in linear equation", 6);
+    TEST("1(x)=1(y)", 0, "multiple variables in linear equation", 7);
+    TEST("x=x", 0, "linear equation always true", -1);
+    TEST("x=x+1", 0, "linear equation has no solution", -1);
+    TEST("2x/(1-1) = 1", 0, "division by 0", -1);
+    TEST("1/(1-1) + log(1-1)x = 1", 0, "log of negative or 0", -1);
+
+    TEST_NUMBER("0.001e10", 1e7);
+    TEST_NUMBER("1E+2", 100);
+    TEST_NUMBER("0,25", 0.25, ',');
+    TEST_NUMBER("9007199254740993", 9007199254740992.0);
+    TEST_NUMBER("9007199254740993.0000000000000000001", 9007199254740994.0);
+    TEST_NUMBER("6.2601049967038641795e194", 6.260104996703865e194);
+    TEST_NUMBER("1e23", 1e23);
+    TEST_NUMBER("2.2250738585072011e-308", 2.2250738585072011e-308);
+    TEST_NUMBER("2.4703282292062328e-324", 4.9406564584124654e-324);
+    TEST_NUMBER("1e400", INFINITY);
+    TEST_NUMBER("0.30000000000000004", 0.1 + 0.2);
+    TEST_NUMBER("4,9e-324", 4.9406564584124654e-324, ',');
+
+    result_cache cache(3);
+    TEST_CACHE(cache, "2x + 1 = 0.50", false);
+    TEST_CACHE(cache, "2x+1=.5", true);
+    TEST_CACHE(cache, "log x", false);
+    TEST_CACHE(cache, "logx", false);
+    TEST_CACHE(cache, "x*x  = 1", false);
+    TEST_CACHE(cache, "x * x=1", true);
+    TEST_CACHE(cache, "2x+1=.5", false);
+
+    TEST_BATCH("1");
+    TEST_BATCH("2x+1");
+    TEST_BATCH("-x*x/3 - 5");
+    TEST_BATCH("1/x");
+    TEST_BATCH("log x");
+    TEST_BATCH("log(x*x)/(x-1)(x+1)");
+    TEST_BATCH("5log(-x)x + 1/log(1/(x+2))");
+    TEST_BATCH("1+2(3+4(5+6(7+8(9+10(11+log(x+12)/x)))))");
+
+    TEST_PROGRAM_FILE({"2x + 1 = 0.5", "log 100", "1/(1-1)", "x = x"}, false);
+    TEST_LIBRARY({"2x + 1 = 0.5", "log 100", "1/(1-1)", "1+", "x = x", "log -1"}, "log(x*x)/(x-1) + 1/x");
+    TEST_LIBRARY({"1 + 1"}, "2(x+");
+    TEST_SERVER("1+1\n2x = 1\r\n1+\nlog 0\n3*(4+5)", "2\n0.5\nexpression error: expected a value (at pos=2)\n"
+        "expression error: log of negative or 0\n27\n");
+
+    TEST_SHARE("1+2", 0);
+    TEST_SHARE("log(1+2) + log(1+2)", 8);
+    TEST_SHARE("(1+2)*(1+2) - log(1+2)/(3)", 10);
+    TEST_SHARE("log(log(5)+1)*2 + 3log(log(5)+1) + log(5)", 20);
+    TEST_SHARE("2x + (1+2) = log(1+2)x", 5);
+    TEST_SHARE("((1+2)(3+4)) + ((3+4)(1+2))", 10);
+
+    TEST_TOKENS("", 0);
+    TEST_TOKENS("x", 1);
+    TEST_TOKENS("  12.5e-3 *log(x_1)\t\t=  Abc9", 20);
+    TEST_TOKENS("1234567890123456789012345678901234567890abcdefghijklmnopqrstuvwxyzABCDEFGHIJ                                 ++", 5);
+    TEST_TOKENS("(1+2)*(3+4)/(5+6)-(7+8)*(9+10)/(11+12) - log log 2.5 = x", 49);
+
+    TEST_SYSTEM({"a + b = 3", "2a - b = 0"}, {{"a", 1}, {"b", 2}});
+    TEST_SYSTEM({"in = 10", "in = left + right", "left = 2right + 1", "out_1 = left + right"},
+        {{"in", 10}, {"left", 7}, {"right", 3}, {"out_1", 10}});
+    TEST_SYSTEM({"3(a - 2b)/2 = log 100 * c", "a = 1", "c + b = a - 4b"}, {{"a", 1}, {"b", 1 / 14.0}, {"c", 9 / 14.0}});
+    TEST_SYSTEM({"x + y = 1", "2x + 2y = 2"}, {}, "linear system has infinitely many solutions");
+    TEST_SYSTEM({"x + y = 1", "x + y = 2"}, {}, "linear system has no solution");
+
+    TEST_SHEET({"rate = 0.05", "y = 2*rate(1+rate)", "z = y/rate", "w = 7"}, "rate = 0.1", "rate=0.1 y=0.22000000000000003 z=2.2", 3);
+    TEST_SHEET({"rate = 0.05", "y = 2*rate(1+rate)", "z = y/rate", "w = 7"}, "w = log w2", "w=undefined variable", 1);
+    TEST_SHEET({"a = 1", "b = a*0", "c = b + 1", "d = c + a"}, "a = 2", "a=2 d=3", 3);
+    TEST_SHEET({"a = 1", "b = a", "c = b"}, "a = 1", "a=1", 1);
+    TEST_SHEET({"total = part1 + part2", "part1 = 2"}, "part2 = 3", "part2=3 total=5", 2);
+    TEST_SHEET({"d = 1/(a - a)", "e = d + 1", "a = 5"}, "d = 1/a", "d=0.2 e=1.2", 2);
+    TEST_SHEET({"x1 = 2", "x2 = log(x1 - 2)"}, "x3 = x2*x2 + x1", "x3=log of negative or 0", 1);
+    TEST_SHEET({"a = b + 1", "b = c", "c = a"}, nullptr, "", 0, "circular reference", 0, "c a b c");
+    TEST_SHEET({"a = 1", " b = 2b"}, nullptr, "", 0, "circular reference", 1, "b b");
+    TEST_SHEET({"a = 1", "b = a +"}, nullptr, "", 0, "expected a value", 7);
+    TEST_SHEET({"2 = 3"}, nullptr, "", 0, "expected 'name = formula'", 0);
+    TEST_SHEET({"a b = 3"}, nullptr, "", 0, "expected 'name = formula'", 2);
+    TEST_SHEET({"log = 3"}, nullptr, "", 0, "expected 'name = formula'", 4);
+    TEST_NONLINEAR("x*x = 2", sqrt(2));
+    TEST_NONLINEAR("1/x = 4", 0.25);
+    TEST_NONLINEAR("log(x) = 1", 10);
+    TEST_NONLINEAR("x*x*x = -8", -2);
+    TEST_NONLINEAR("(x - 3)(x - 3) = 0", 3);
+    TEST_NONLINEAR("x/(x + 1) = 0.5", 1);
+    TEST_NONLINEAR("2x + 1 = 0.5", -0.25);
+    TEST_NONLINEAR("x*x = -1", 0, "non-linear equation: no root found");
+    TEST_NONLINEAR("1/x = 0", 0, "non-linear equation: no root found");
+    TEST_NONLINEAR("1/(x - 3) = 2", 3.5);
+    TEST_PARALLEL(repeat("%d.1/3", " + ", 1000), 7);
+    TEST_PARALLEL(repeat("1.0%d", " * ", 500) + "/" + repeat("0.99", " / ", 300), 16);
+    TEST_PARALLEL("log(" + repeat("%d.5*(1 + 1/7)", " - ", 300) + " + 1e9) * (" + repeat("0.%d", " + ", 200) + ")", 5);
+    TEST_PARALLEL(repeat("%dx/3 + 1", " + ", 400) + " = 7 - " + repeat("0.%dx", " - ", 100), 9);
+    TEST_PARALLEL(repeat("%d", " + ", 100) + " + 1/0 + " + repeat("%d", " + ", 100) + " + log(-1)", 10);
+    TEST_PARALLEL(repeat("%d", " + ", 100) + " + log 0 + " + repeat("%d", " + ", 100) + " + 1/0", 10);
+    TEST_SYSTEM({"x = 1", "y = 2", "x + y = 3"}, {{"x", 1}, {"y", 2}});
+    TEST_SYSTEM({"x = 1", "x + y = 2", "2x * y = 3"}, {}, "non-linear equation", 6);
+    TEST_SYSTEM({"x = 1", "y + z", "z = 2"}, {}, "linear equation missing right hand side", 5);
+    TEST_SYSTEM({"x = 1/(1-1) + y", "y = 1"}, {}, "division by 0", -1);
+    TEST_GRID_SYSTEM(30, false);
+    TEST_GRID_SYSTEM(30, true);
+
+    TEST_PROGRAM_FILE({"x", "-x*x/3 - 5", "log(x*x)/(x-1)(x+1)", "1+2(3+4(5+6(7+8(9+10(11+log(x+12)/x)))))"}, true);
+
+    if (err_count)
+        printf("%d tests passed, %d tests failed\n", ok_count, err_count);
+    else
+        printf("OK (%d tests passed)\n", ok_count);
+    return err_count;
+}
+
+bool read_line(const char *msg, std::string &ret)
+{
+#ifndef _WIN32
+    rl_bind_key('\t', rl_insert);
+    char *str = readline(msg);
+    if (!str)
+        return false;
+    ret = str;
+    if (*str)
+        add_history(str);
+    free(str);
+#else
+    std::cout << msg;
+    std::cout.flush();
+    if (!std::getline(std::cin, ret))
+        return false;
+#endif
+    return true;
+}
+
+bool read_expr(std::string &expr)
+{
+    do
+    {
+        if (!read_line(">>> ", expr))
+            return false;
+    }
+    while (expr.empty());
+    while (expr[expr.size() - 1] == '\\')
+    {
+        std::string extra;
+        if (!read_line("... ", extra))
+            return false;
+        expr.resize(expr.size()-1);
+        expr.append(extra);
+    }
+    return true;
+}
+
+static std::string to_string(double d)
+{
+    char str[number_buffer_size];
+    format_number(d, str);
+    return str;
+}
+
+void calc_help()
+{
+    std::cout <<
+        "Enter simple mathematical expressions or linear equations \n"
+        "with similar grammar as google calculator. For example: \n"
+        "    (3+(4-1))*5\n"
+        "    2 * x + 0.5 = 1\n"
+        "    2x + 1 = 2(1-x)\n"
+        "To run tests type \"test\"\n"
+        "To evaluate a file line by line run\n"
+        "    calc --batch [file] [--threads N] [--cache N] [--nonlinear] [--split N] [--stats] [--trace file]\n"
+        "(--threads 0 uses all cores, --cache N remembers results of N lines,\n"
+        "--nonlinear also solves equations like x*x = 2 or 1/x = 4 numerically,\n"
+        "--split N spreads sums and products of more than N items over the threads,\n"
+        "--stats prints time per phase, --trace saves a Chrome trace; both need make STATS=1)\n"
+        "To evaluate a file of any size as one expression while reading it\n"
+        "    calc --stream [file]\n"
+        "To solve a file of equations over named variables, one per line\n"
+        "    calc --system [file]\n"
+        "To evaluate a sheet of named formulas, then updates of them (- for stdin)\n"
+        "    calc --sheet file [updates]\n"
+        "To compile a file of formulas once and run them later without parsing\n"
+        "    calc --compile [file] --output programs [--functions]\n"
+        "    calc --load programs [--x value]\n"
+        "(--functions compiles functions of x, --load runs every program at x)\n"
+        "To answer lines sent to a Unix socket until Ctrl+C\n"
+        "    calc --serve socket [--threads N]\n"
+        "(make calc_client builds a load generator for it)\n"
+        "To show how often results were reused type \"cache\"\n"
+        "To show time and allocations per phase type \"stats\"\n"
+        "To exit type \"exit\", \"q\", or Ctrl+C" << std::endl;
+}
+
+static int calc_eval(const std::string &expr, result_cache *cache = nullptr)
+{
+    if (expr == "q" || expr == "exit")
+        return 0;
+    else if (expr == "help" || expr == "--help" || expr == "?" || expr == "/?")
+        calc_help();
+    else if (expr == "test")
+        return test();
+    else if (expr == "cache" && cache)
+        std::cout << cache->size() << " cached results, " << cache->hits() << " hits, " << cache->misses() << " misses";
+    else if (expr == "stats")
+    {
+        std::cout.flush();
+        print_stats(stdout);
+        fflush(stdout);
+    }
+    else
+    {
+        double value = 0;
+        expression_status s;
+        if (cache)
+            s = cache->eval(expr.c_str(), value);
+        else
+        {
+            expression parser;
+            s = parser.try_parse(expr.c_str());
+            if (s.ok())
+                s = parser.try_solve(value);
+        }
+        if (s.ok())
+            std::cout << to_string(value);
+        else
+        {
+            std::cout << "expression error: " << s.message();
+            if (s.pos >= 0)
+                std::cout << " (at pos=" << s.pos << ")";
+        }
+    }
+    return 1;
+}
+
+void calc_interactive()
+{
+    std::cout << "type \"help\" or \"?\" for quick help" << std::endl;
+    result_cache cache(1024);
+    for (std::string expr; read_expr(expr) && calc_eval(expr, &cache);)
+        std::cout << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+    if (argc>1 && 0==strcmp(argv[1], "--batch"))
+    {
+        const char *path = nullptr;
+        unsigned threads = 1;
+        size_t cache_size = 0, split = 0;
+        bool nonlinear = false, stats = false;
+        const char *trace_path = nullptr;
+        for (int i = 2; i < argc; ++i)
+        {
+            if (0==strcmp(argv[i], "--threads") && i+1 < argc)
+                threads = (unsigned)atoi(argv[++i]);
+            else if (0==strcmp(argv[i], "--cache") && i+1 < argc)
+                cache_size = (size_t)atol(argv[++i]);
+            else if (0==strcmp(argv[i], "--split") && i+1 < argc)
+                split = (size_t)atol(argv[++i]);
+            else if (0==strcmp(argv[i], "--nonlinear"))
+                nonlinear = true;
+            else if (0==strcmp(argv[i], "--stats"))
+                stats = true;
+            else if (0==strcmp(argv[i], "--trace") && i+1 < argc)
+                trace_path = argv[++i];
+            else
+                path = argv[i];
+        }
+        if (trace_path && !start_trace())
+            trace_path = nullptr;
+        int ret = calc_batch(path, threads, cache_size, nonlinear, split);
+        if (stats)
+            print_stats(stderr);
+        if (trace_path && !write_trace(trace_path))
+            ret = 1;
+        return ret;
+    }
+    if (argc>2 && 0==strcmp(argv[1], "--serve"))
+    {
+        unsigned threads = 0;
+        if (argc>4 && 0==strcmp(argv[3], "--threads"))
+            threads = (unsigned)atoi(argv[4]);
+        return calc_serve(argv[2], threads);
+    }
+    if (argc>1 && 0==strcmp(argv[1], "--stream"))
+        return calc_stream(argc>2 ? argv[2] : nullptr);
+    if (argc>1 && 0==strcmp(argv[1], "--system"))
+        return calc_system(argc>2 ? argv[2] : nullptr);
+    if (argc>2 && 0==strcmp(argv[1], "--sheet"))
+        return calc_sheet(argv[2], argc>3 ? argv[3] : nullptr);
+    if (argc>1 && 0==strcmp(argv[1], "--compile"))
+    {
+        const char *path = nullptr, *out = nullptr;
+        bool functions = false;
+        for (int i = 2; i < argc; ++i)
+        {
+            if (0==strcmp(argv[i], "--functions"))
+                functions = true;
+            else if (0==strcmp(argv[i], "--output") && i+1 < argc)
+                out = argv[++i];
+            else
+                path = argv[i];
+        }
+        if (!out)
+        {
+            fprintf(stderr, "usage: calc --compile [file] --output programs [--functions]\n");
+            return 1;
+        }
+        return calc_compile(path, out, functions);
+    }
+    if (argc>2 && 0==strcmp(argv[1], "--load"))
+    {
+        double x = 0;
+        const char *arg = argc>4 && 0==strcmp(argv[3], "--x") ? argv[4] : nullptr;
+        const char *end = arg ? parse_number(arg + (*arg == '-'), x) : nullptr;
+        if (arg && (!end || *end))
+        {
+            fprintf(stderr, "cannot parse number %s\n", argv[4]);
+            return 1;
+        }
+        return calc_load(argv[2], arg && *arg == '-' ? -x : x);
+    }
+    if (argc>1)
+        return calc_eval(argv[1]);
+    calc_interactive();
+    return 0;
+}
@@ -0,0 +1,500 @@
+#include "calc_batch.h"
+#include "number.h"
+#include "parallel_eval.h"
+#include "program_file.h"
+#include "stream_eval.h"
+#include "system.h"
+#include "thread_pool.h"
+#include "worksheet.h"
+
+
+// reads more input after the unconsumed part, returns false at end of input
+bool line_reader::fill()
+{
+    if (eof)
+        return false;
+    if (begin > 0)
+    {
+        memmove(&buf[0], &buf[begin], end - begin);
+        end -= begin;
+        begin = 0;
+    }
+    // +1 keeps room for the terminator of a last line without '\n'
+    if (buf.size() < end + chunk + 1)
+        buf.resize(end + chunk + 1);
+    size_t n = fread(&buf[end], 1, chunk, f);
+    if (n < chunk)
+        eof = true;
+    end += n;
+    return n > 0;
+}
+char *line_reader::next(size_t &len)
+{
+    size_t scanned = 0;     // bytes after begin known to have no '\n'
+    char *nl;
+    while (end == begin + scanned || !(nl = (char*)memchr(&buf[begin + scanned], '\n', end - begin - scanned)))
+    {
+        scanned = end - begin;
+        if (!fill())
+        {
+            if (begin == end)
+                return nullptr;
+            // last line without '\n', fill() left room for the terminator
+            nl = &buf[end];
+            break;
+        }
+    }
+    char *line = &buf[begin];
+    len = nl - line;
+    begin = nl - &buf[0] < (ptrdiff_t)end ? nl - &buf[0] + 1 : end;
+    if (len && line[len - 1] == '\r')
+        --len;
+    line[len] = '\0';
+    return line;
+}
+
+void output_buffer::flush(FILE *f)
+{
+    if (!f)
+        return;
+    if (!buf.empty())
+        fwrite(&buf[0], 1, buf.size(), f);
+    buf.clear();
+    fflush(f);
+}
+
+static void write_error(output_buffer &out, const char *msg, int64_t pos)
+{
+    out.write("expression error: ");
+    out.write(msg);
+    if (pos >= 0)
+    {
+        char str[32];
+        int n = snprintf(str, sizeof(str), " (at pos=%lld)", (long long)pos);
+        out.write(str, n);
+    }
+    out.put('\n');
+}
+static void write_value(output_buffer &out, double value)
+{
+    char str[number_buffer_size + 1];
+    int n = format_number(value, str);
+    str[n] = '\n';
+    out.write(str, n + 1);
+}
+void eval_line(expression &parser, const char *line, output_buffer &out)
+{
+    double value;
+    expression_status s = parser.try_parse(line);
+    if (s.ok())
+        s = parser.try_solve(value);
+    if (s.ok())
+        write_value(out, value);
+    else
+        write_error(out, s.message(), s.pos);
+}
+void eval_line(result_cache &cache, const char *line, output_buffer &out)
+{
+    double value;
+    expression_status s = cache.eval(line, value);
+    if (s.ok())
+        write_value(out, value);
+    else
+        write_error(out, s.message(), s.pos);
+}
+
+// Reads about size bytes of whole lines into block. The incomplete last line
+// is kept in carry for the next block. Returns false at end of input.
+static bool read_block(FILE *f, std::vector<char> &block, std::vector<char> &carry, size_t size)
+{
+    block.swap(carry);
+    carry.clear();
+    for (;;)
+    {
+        size_t n = block.size();
+        block.resize(n + size);
+        size_t got = fread(&block[n], 1, size, f);
+        block.resize(n + got);
+        if (got == 0)
+        {
+            if (!block.empty() && block.back() != '\n')
+                block.push_back('\n');
+            return !block.empty();
+        }
+        for (size_t i = block.size(); i-- > n;)
+        {
+            if (block[i] == '\n')
+            {
+                carry.assign(block.begin() + i + 1, block.end());
+                block.resize(i + 1);
+                return true;
+            }
+        }
+        // no line end yet, the line continues in the next read
+    }
+}
+
+struct batch_block
+{
+    std::vector<char> text;
+    output_buffer out;
+    size_t hits, misses;    // of the cache of the thread that evaluated it
+    bool done;
+    batch_block() : out(nullptr), hits(0), misses(0), done(false) {}
+};
+
+// evaluates the '\n' terminated lines of block
+static void eval_block(batch_block &block, size_t cache_size, bool nonlinear)
+{
+    static thread_local expression parser;
+    static thread_local std::unique_ptr<result_cache> cache;
+    if (cache_size && !cache)
+    {
+        cache.reset(new result_cache(cache_size));
+        cache->set_nonlinear(nonlinear);
+    }
+    parser.set_nonlinear(nonlinear);
+    size_t hits = cache ? cache->hits() : 0, misses = cache ? cache->misses() : 0;
+    char *line = &block.text[0], *end = line + block.text.size();
+    while (line < end)
+    {
+        char *nl = (char*)memchr(line, '\n', end - line);
+        *nl = '\0';
+        if (nl > line && nl[-1] == '\r')
+            nl[-1] = '\0';
+        if (cache)
+            eval_line(*cache, line, block.out);
+        else
+            eval_line(parser, line, block.out);
+        line = nl + 1;
+    }
+    if (cache)
+    {
+        block.hits = cache->hits() - hits;
+        block.misses = cache->misses() - misses;
+    }
+}
+
+static void print_cache_stats(size_t hits, size_t misses)
+{
+    fprintf(stderr, "cache: %zu hits, %zu misses\n", hits, misses);
+}
+
+static void calc_batch_threads(FILE *f, unsigned threads, size_t cache_size, bool nonlinear)
+{
+    const size_t block_size = 1 << 16;
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<std::unique_ptr<batch_block>> blocks;
+    std::vector<char> carry;
+    thread_pool pool(threads);
+    const size_t max_blocks = 16 * pool.size();
+    size_t hits = 0, misses = 0;
+    // writes finished blocks in input order, waits while more than limit
+    // blocks are in flight
+    auto write_done = [&](size_t limit)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        while (!blocks.empty())
+        {
+            if (blocks.size() > limit)
+                cv.wait(lock, [&] { return blocks.front()->done; });
+            else if (!blocks.front()->done)
+                break;
+            std::unique_ptr<batch_block> block = std::move(blocks.front());
+            blocks.pop_front();
+            lock.unlock();
+            block->out.flush(stdout);
+            hits += block->hits;
+            misses += block->misses;
+            lock.lock();
+        }
+    };
+    for (;;)
+    {
+        std::unique_ptr<batch_block> block(new batch_block);
+        if (!read_block(f, block->text, carry, block_size))
+            break;
+        batch_block *b = block.get();
+        {
+            std::lock_guard<std::mutex> lock(m);
+            blocks.push_back(std::move(block));
+        }
+        pool.submit([&, b]
+        {
+            eval_block(*b, cache_size, nonlinear);
+            std::lock_guard<std::mutex> lock(m);
+            b->done = true;
+            cv.notify_one();
+        });
+        write_done(max_blocks - 1);
+    }
+    write_done(0);
+    if (cache_size)
+        print_cache_stats(hits, misses);
+}
+
+int calc_batch(const char *path, unsigned threads, size_t cache_size, bool nonlinear, size_t split)
+{
+    FILE *f = path ? fopen(path, "rb") : stdin;
+    if (!f)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+    // with split the lines go one at a time, the pool splits each one
+    std::unique_ptr<thread_pool> pool;
+    std::unique_ptr<parallel_eval> splitter;
+    if (split)
+    {
+        pool.reset(new thread_pool(threads));
+        splitter.reset(new parallel_eval(*pool, split));
+    }
+    if (threads != 1 && !split)
+        calc_batch_threads(f, threads, cache_size, nonlinear);
+    else if (cache_size)
+    {
+        line_reader in(f);
+        output_buffer out(stdout);
+        result_cache cache(cache_size);
+        cache.set_nonlinear(nonlinear);
+        cache.set_parallel(splitter.get());
+        size_t len;
+        while (char *line = in.next(len))
+            eval_line(cache, line, out);
+        out.flush();
+        print_cache_stats(cache.hits(), cache.misses());
+    }
+    else
+    {
+        line_reader in(f);
+        output_buffer out(stdout);
+        expression parser;
+        parser.set_nonlinear(nonlinear);
+        parser.set_parallel(splitter.get());
+        size_t len;
+        while (char *line = in.next(len))
+            eval_line(parser, line, out);
+    }
+    if (f != stdin)
+        fclose(f);
+    return 0;
+}
+
+int calc_compile(const char *path, const char *out, bool functions)
+{
+    FILE *f = path ? fopen(path, "rb") : stdin;
+    if (!f)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+    line_reader in(f);
+    expression parser;
+    program prog;
+    program_file_writer writer;
+    size_t len, line_number = 0;
+    int ret = 0;
+    while (char *line = in.next(len))
+    {
+        ++line_number;
+        expression_status s = parser.try_parse(line, functions);
+        if (!s.ok())
+        {
+            fprintf(stderr, "line %zu: expression error: %s", line_number, s.message());
+            if (s.pos >= 0)
+                fprintf(stderr, " (at pos=%d)", s.pos);
+            fprintf(stderr, "\n");
+            ret = 1;
+            break;
+        }
+        prog.compile(parser);
+        writer.add(prog);
+    }
+    if (f != stdin)
+        fclose(f);
+    if (!ret && !writer.save(out))
+        ret = 1;
+    return ret;
+}
+
+int calc_stream(const char *path)
+{
+    FILE *f = path ? fopen(path, "rb") : stdin;
+    if (!f)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+    stream_eval se;
+    double value;
+    stream_status s = se.eval(f, value);
+    if (f != stdin)
+        fclose(f);
+    output_buffer out(stdout);
+    if (s.ok())
+        write_value(out, value);
+    else
+        write_error(out, s.message(), s.pos);
+    return 0;
+}
+
+int calc_system(const char *path)
+{
+    FILE *f = path ? fopen(path, "rb") : stdin;
+    if (!f)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+    line_reader in(f);
+    linear_system sys;
+    size_t len, line_number = 0;
+    bool parsed = true;
+    expression_status s = {error_none, -1};
+    while (char *line = in.next(len))
+    {
+        ++line_number;
+        if (strspn(line, " \t") == len)
+            continue;
+        s = sys.add(line);
+        if (!s.ok())
+        {
+            parsed = false;
+            break;
+        }
+    }
+    if (f != stdin)
+        fclose(f);
+    std::vector<double> values;
+    if (s.ok())
+        s = sys.solve(values);
+    output_buffer out(stdout);
+    if (!s.ok())
+    {
+        if (!parsed)
+        {
+            char str[32];
+            int n = snprintf(str, sizeof(str), "line %zu: ", line_number);
+            out.write(str, n);
+        }
+        write_error(out, s.message(), s.pos);
+        return 1;
+    }
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        out.write(sys.variables().name((uint32_t)i).c_str());
+        out.write(" = ");
+        write_value(out, values[i]);
+    }
+    return 0;
+}
+
+static void write_name(output_buffer &out, const worksheet &sheet, uint32_t name)
+{
+    out.write(sheet.variables().name(name).c_str());
+    out.write(" = ");
+    double value;
+    expression_status s = sheet.value(name, value);
+    if (s.ok())
+        write_value(out, value);
+    else
+        write_error(out, s.message(), s.pos);
+}
+// "line n: expression error: ...", a rejected cycle as "a -> b -> a"
+static void write_sheet_error(output_buffer &out, const worksheet &sheet, size_t line_number, expression_status s)
+{
+    char str[32];
+    int n = snprintf(str, sizeof(str), "line %zu: ", line_number);
+    out.write(str, n);
+    std::string msg = s.message();
+    for (size_t i = 0; i < sheet.cycle().size(); ++i)
+        msg += (i ? " -> " : ": ") + sheet.variables().name(sheet.cycle()[i]);
+    write_error(out, msg.c_str(), s.pos);
+}
+
+int calc_sheet(const char *path, const char *updates)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+    worksheet sheet;
+    output_buffer out(stdout);
+    size_t len, line_number = 0;
+    {
+        line_reader in(f);
+        while (char *line = in.next(len))
+        {
+            ++line_number;
+            if (strspn(line, " \t") == len)
+                continue;
+            expression_status s = sheet.set(line);
+            if (!s.ok())
+            {
+                write_sheet_error(out, sheet, line_number, s);
+                fclose(f);
+                return 1;
+            }
+        }
+    }
+    fclose(f);
+    sheet.recompute();
+    for (uint32_t i = 0; i < sheet.variables().size(); ++i)
+        if (sheet.defined(i))
+            write_name(out, sheet, i);
+    if (!updates)
+        return 0;
+    f = strcmp(updates, "-") ? fopen(updates, "rb") : stdin;
+    if (!f)
+    {
+        fprintf(stderr, "cannot open %s\n", updates);
+        return 1;
+    }
+    out.put('\n');
+    // a pipe gets the answer to each update before it sends the next one
+    line_reader in(f, f == stdin ? 1 : 1 << 20);
+    line_number = 0;
+    while (char *line = in.next(len))
+    {
+        ++line_number;
+        if (strspn(line, " \t") == len)
+            continue;
+        expression_status s = sheet.set(line);
+        if (s.ok())
+        {
+            for (uint32_t name : sheet.recompute())
+                write_name(out, sheet, name);
+        }
+        else
+            write_sheet_error(out, sheet, line_number, s);
+        out.put('\n');
+        if (f == stdin)
+            out.flush();
+    }
+    if (f != stdin)
+        fclose(f);
+    return 0;
+}
+
+int calc_load(const char *path, double x)
+{
+    program_file file;
+    if (!file.open(path))
+        return 1;
+    output_buffer out(stdout);
+    for (size_t i = 0; i < file.size(); ++i)
+    {
+        try
+        {
+            write_value(out, file[i].run(x));
+        }
+        catch (const expression_error &e)
+        {
+            write_error(out, e.what(), -1);
+        }
+    }
+    return 0;
+}
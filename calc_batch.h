@@ -0,0 +1,97 @@
+#ifndef calc_batch_h_
+#define calc_batch_h_
+
+#include <stdio.h>
+#include <vector>
+#include "expression.h"
+#include "result_cache.h"
+
+
+// Reads newline separated lines in large chunks. Lines are returned in place,
+// NUL-terminated, without the trailing "\n" or "\r\n"; a line stays valid
+// until the next call.
+class line_reader
+{
+public:
+    explicit line_reader(FILE *f, size_t chunk = 1 << 20) : f(f), chunk(chunk), begin(0), end(0), eof(false) {}
+    char *next(size_t &len);
+
+private:
+    bool fill();
+
+    FILE *f;
+    size_t chunk;
+    std::vector<char> buf;
+    size_t begin, end;
+    bool eof;
+};
+
+// Collects output and writes it to f in large blocks. Without f the output
+// stays in memory until flushed to a file with flush(f).
+class output_buffer
+{
+public:
+    explicit output_buffer(FILE *f, size_t size = 1 << 16) : f(f), size(size) { buf.reserve(f ? size + 256 : 0); }
+    ~output_buffer() { flush(); }
+    void write(const char *s, size_t n)
+    {
+        buf.insert(buf.end(), s, s + n);
+        if (buf.size() >= size)
+            flush();
+    }
+    void write(const char *s) { write(s, strlen(s)); }
+    void put(char c)
+    {
+        buf.push_back(c);
+        if (buf.size() >= size)
+            flush();
+    }
+    void flush() { flush(f); }
+    void flush(FILE *f);
+    // output not flushed yet
+    const std::vector<char> &data() const { return buf; }
+
+private:
+    FILE *f;
+    size_t size;
+    std::vector<char> buf;
+};
+
+// Evaluates line and writes the value or "expression error: ..." as calc_eval
+// prints it, followed by '\n'. parser is reused between lines.
+void eval_line(expression &parser, const char *line, output_buffer &out);
+// same through cache
+void eval_line(result_cache &cache, const char *line, output_buffer &out);
+
+// --batch mode: evaluates every line of path (stdin if null) and prints one
+// result line per input line. With threads != 1 blocks of lines are
+// evaluated on a thread pool (0: one thread per core), output keeps the
+// input order. cache_size > 0 puts a result_cache of that many lines in
+// front of every thread and prints its hit rate to stderr. nonlinear lets
+// equations use x anywhere, see expression::set_nonlinear(). With split > 0
+// lines are evaluated one at a time instead, sums and products of more
+// than split items spread over the threads by parallel_eval.
+int calc_batch(const char *path, unsigned threads = 1, size_t cache_size = 0, bool nonlinear = false, size_t split = 0);
+
+// --stream mode: evaluates all of path (stdin if null) as one expression
+// while reading it, see stream_eval, and prints the value as --batch does
+int calc_stream(const char *path);
+// --compile mode: compiles every line of path (stdin if null) into the
+// program file out. With functions the lines are functions of x, otherwise
+// expressions or linear equations. Stops at the first line with an error.
+int calc_compile(const char *path, const char *out, bool functions);
+// --system mode: solves the equations of path (stdin if null), one per line,
+// as a system over named variables and prints "name = value" for each
+// variable in order of appearance
+int calc_system(const char *path);
+// --sheet mode: defines the formulas "name = formula" of path, one per
+// line, and prints "name = value" for every defined name in order of
+// appearance. Then applies the lines of updates (stdin for "-") one at a
+// time, each followed by the names it changed and an empty line.
+int calc_sheet(const char *path, const char *updates);
+// --load mode: runs every program of a program file at x and prints the
+// results as --batch does
+int calc_load(const char *path, double x);
+
+
+#endif /* calc_batch_h_ */
@@ -0,0 +1,344 @@
+// Benchmark of the expression pipeline on a generated corpus:
+//     calc_bench [--lines N] [--depth N] [--numbers P] [--logs P]
+//                [--equations P] [--invalid P] [--seed N] [--repeat N] [--write file]
+// P are shares from 0 to 1. The same options and seed give the same corpus
+// on every platform; --write saves it for `calc --batch`.
+#include <stdlib.h>
+#include <chrono>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "expression.h"
+#include "stats.h"
+
+// every operator new of the process, to report allocations per expression.
+// With CALC_STATS stats_alloc.cpp already counts them.
+#ifdef CALC_STATS
+static size_t allocations()
+{
+    return (size_t)thread_allocations();
+}
+#else
+static size_t alloc_count = 0;
+static size_t allocations()
+{
+    return alloc_count;
+}
+void *operator new(size_t size)
+{
+    ++alloc_count;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+#endif
+
+struct corpus_options
+{
+    size_t lines;
+    unsigned depth;         // deepest nesting of parentheses and log arguments
+    double numbers;         // share of terms that are plain numbers
+    double logs;            // share of the other terms that are logs
+    double equations;       // share of lines that are linear equations
+    double invalid;         // share of lines with a syntax error
+    uint64_t seed;
+};
+
+// Writes random lines of the calculator grammar. Equations keep x out of
+// divisions and logs and to one term per product, so they parse.
+class corpus_generator
+{
+public:
+    explicit corpus_generator(const corpus_options &opt) : opt(opt), state(opt.seed * 2 + 1) {}
+    void line(std::string &s);
+
+private:
+    // xorshift64*, the same sequence everywhere unlike <random> distributions
+    uint64_t next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+    unsigned below(unsigned n) { return (unsigned)(next() % n); }
+    bool chance(double p) { return uniform() < p; }
+    void blank(std::string &s) { if (chance(0.3)) s += ' '; }
+    void number(std::string &s);
+    bool term(std::string &s, unsigned depth, bool x);
+    bool prod(std::string &s, unsigned depth, bool x);
+    bool expr(std::string &s, unsigned depth, bool x);
+    void corrupt(std::string &s);
+
+    corpus_options opt;
+    uint64_t state;
+};
+
+void corpus_generator::number(std::string &s)
+{
+    char buf[32];
+    switch (below(4))
+    {
+    case 0:
+        snprintf(buf, sizeof(buf), "%u", below(100));
+        break;
+    case 1:
+        snprintf(buf, sizeof(buf), "%u.%u", below(1000), below(1000));
+        break;
+    case 2:
+        snprintf(buf, sizeof(buf), ".%u", below(100000));
+        break;
+    default:
+        snprintf(buf, sizeof(buf), "%u.%ue%d", below(10), below(100), (int)below(41) - 20);
+        break;
+    }
+    s += buf;
+}
+// returns true if the term contains x
+bool corpus_generator::term(std::string &s, unsigned depth, bool x)
+{
+    if (chance(0.1))
+        s += '-';
+    if (depth >= opt.depth || chance(opt.numbers))
+    {
+        number(s);
+        if (!x || !chance(0.3))
+            return false;
+        s += 'x';
+        return true;
+    }
+    if (chance(opt.logs))
+    {
+        if (chance(0.5))
+        {
+            s += "log ";
+            number(s);
+            return false;
+        }
+        s += "log(";
+        expr(s, depth + 1, false);
+        s += ')';
+        return false;
+    }
+    if (chance(0.5))
+        number(s);
+    s += '(';
+    bool has_x = expr(s, depth + 1, x);
+    s += ')';
+    return has_x;
+}
+bool corpus_generator::prod(std::string &s, unsigned depth, bool x)
+{
+    bool has_x = term(s, depth, x);
+    for (unsigned n = below(2); n; --n)
+    {
+        blank(s);
+        bool div = chance(0.3);
+        s += div ? '/' : '*';
+        blank(s);
+        has_x |= term(s, depth, x && !has_x && !div);
+    }
+    return has_x;
+}
+bool corpus_generator::expr(std::string &s, unsigned depth, bool x)
+{
+    bool has_x = false;
+    for (unsigned n = below(3) + 1; n; --n)
+    {
+        has_x |= prod(s, depth, x);
+        if (n > 1)
+        {
+            blank(s);
+            s += chance(0.5) ? '+' : '-';
+            blank(s);
+        }
+    }
+    return has_x;
+}
+// replaces, inserts or removes one character, or cuts the line short
+void corpus_generator::corrupt(std::string &s)
+{
+    static const char chars[] = "()*/+=x.,e";
+    size_t i = next() % s.size();
+    switch (below(4))
+    {
+    case 0:
+        s[i] = chars[below(sizeof(chars) - 1)];
+        break;
+    case 1:
+        s.insert(s.begin() + i, chars[below(sizeof(chars) - 1)]);
+        break;
+    case 2:
+        s.erase(i, 1);
+        break;
+    default:
+        s.resize(i);
+        break;
+    }
+}
+void corpus_generator::line(std::string &s)
+{
+    s.clear();
+    if (chance(opt.equations))
+    {
+        bool has_x = expr(s, 0, true);
+        s += " = ";
+        if (!expr(s, 0, true) && !has_x)
+            s += " + x";
+    }
+    else
+        expr(s, 0, false);
+    if (chance(opt.invalid))
+        corrupt(s);
+}
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct phase_result
+{
+    size_t count, bytes, allocs;
+    double seconds;
+};
+
+static void print_phase(const char *name, const phase_result &r)
+{
+    if (!r.count)
+        return;
+    printf("%-10s %8zu %12.1f %12.2f %10.1f\n", name, r.count, r.seconds * 1e9 / r.count,
+        (double)r.allocs / r.count, r.bytes / r.seconds / 1e6);
+}
+
+// runs f(i) for each of items, repeat times; keeps the fastest run
+template<class F> static phase_result run_phase(size_t count, size_t bytes, unsigned repeat, F f)
+{
+    phase_result best = {count, bytes, 0, 0};
+    for (unsigned r = 0; r < repeat; ++r)
+    {
+        size_t allocs = allocations();
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t i = 0; i < count; ++i)
+            f(i);
+        double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+        if (r == 0 || seconds < best.seconds)
+        {
+            best.seconds = seconds;
+            best.allocs = allocations() - allocs;
+        }
+    }
+    return best;
+}
+
+int main(int argc, const char **argv)
+{
+    corpus_options opt = {100000, 3, 0.75, 0.2, 0.3, 0.05, 1};
+    unsigned repeat = 3;
+    const char *write_path = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i], *val = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!val)
+        {
+            fprintf(stderr, "usage: calc_bench [--lines N] [--depth N] [--numbers P] [--logs P] [--equations P] [--invalid P] [--seed N] [--repeat N] [--write file]\n");
+            return 1;
+        }
+        ++i;
+        if (0==strcmp(arg, "--lines"))
+            opt.lines = (size_t)atol(val);
+        else if (0==strcmp(arg, "--depth"))
+            opt.depth = (unsigned)atoi(val);
+        else if (0==strcmp(arg, "--numbers"))
+            opt.numbers = atof(val);
+        else if (0==strcmp(arg, "--logs"))
+            opt.logs = atof(val);
+        else if (0==strcmp(arg, "--equations"))
+            opt.equations = atof(val);
+        else if (0==strcmp(arg, "--invalid"))
+            opt.invalid = atof(val);
+        else if (0==strcmp(arg, "--seed"))
+            opt.seed = (uint64_t)atoll(val);
+        else if (0==strcmp(arg, "--repeat"))
+            repeat = (unsigned)atoi(val);
+        else if (0==strcmp(arg, "--write"))
+            write_path = val;
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", arg);
+            return 1;
+        }
+    }
+
+    std::vector<std::string> corpus(opt.lines);
+    corpus_generator gen(opt);
+    size_t bytes = 0;
+    for (std::string &s : corpus)
+    {
+        gen.line(s);
+        bytes += s.size() + 1;
+    }
+    if (write_path)
+    {
+        FILE *f = fopen(write_path, "wb");
+        if (!f)
+        {
+            fprintf(stderr, "cannot open %s\n", write_path);
+            return 1;
+        }
+        for (const std::string &s : corpus)
+            fprintf(f, "%s\n", s.c_str());
+        fclose(f);
+    }
+
+    // lines that parse, split by kind, for the phases that need a tree
+    std::vector<expression> exprs, equations, parsed;
+    size_t expr_bytes = 0, equation_bytes = 0;
+    for (const std::string &s : corpus)
+    {
+        expression e;
+        if (!e.try_parse(s.c_str()).ok())
+            continue;
+        bool equation = s.find('=') != std::string::npos;
+        (equation ? equations : exprs).push_back(e);
+        (equation ? equation_bytes : expr_bytes) += s.size() + 1;
+    }
+    parsed = exprs;
+    parsed.insert(parsed.end(), equations.begin(), equations.end());
+    size_t errors = 0;
+    for (const expression &e : parsed)
+    {
+        double value;
+        if (!expression(e).try_solve(value).ok())
+            ++errors;
+    }
+    printf("corpus: %zu lines, %zu bytes, seed %llu; %zu expressions, %zu equations, %zu parse errors, %zu eval errors\n",
+        corpus.size(), bytes, (unsigned long long)opt.seed, exprs.size(), equations.size(),
+        corpus.size() - parsed.size(), errors);
+    printf("%-10s %8s %12s %12s %10s\n", "phase", "count", "ns/expr", "allocs/expr", "MB/s");
+
+    expression parser;
+    print_phase("parse", run_phase(corpus.size(), bytes, repeat, [&](size_t i)
+    {
+        parser.try_parse(corpus[i].c_str());
+    }));
+    volatile double sink = 0;   // keeps the try_solve() calls
+    auto solve = [&](std::vector<expression> &v, size_t i)
+    {
+        double value;
+        v[i].try_solve(value);
+        sink += value;
+    };
+    print_phase("eval", run_phase(exprs.size(), expr_bytes, repeat, [&](size_t i) { solve(exprs, i); }));
+    print_phase("solve", run_phase(equations.size(), equation_bytes, repeat, [&](size_t i) { solve(equations, i); }));
+    std::ostringstream os;
+    print_phase("serialize", run_phase(parsed.size(), expr_bytes + equation_bytes, repeat, [&](size_t i)
+    {
+        os.seekp(0);
+        os << parsed[i];
+    }));
+    return 0;
+}
@@ -0,0 +1,167 @@
+// Load generator for calc --serve:
+//     calc_client socket [--connections N] [--requests N] [--pipeline N] [--file lines]
+// Every connection runs on its own thread and keeps up to --pipeline requests
+// in flight; each request is timed from its send to its answer. Requests are
+// the lines of --file in turn, or a few built-in ones.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "calc_server.h"
+
+typedef std::chrono::steady_clock client_clock;
+
+struct client_result
+{
+    std::vector<double> latencies;      // ns
+    size_t errors;                      // "expression error" answers
+    bool failed;
+};
+
+static bool send_all(int fd, const std::string &s)
+{
+    for (size_t pos = 0; pos < s.size();)
+    {
+        ssize_t n = send(fd, &s[pos], s.size() - pos, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        pos += (size_t)n;
+    }
+    return true;
+}
+
+static void run_client(const char *path, const std::vector<std::string> &lines, size_t first, size_t requests,
+    size_t pipeline, client_result &res)
+{
+    res.errors = 0;
+    res.failed = true;
+    int fd = connect_server(path);
+    if (fd < 0)
+        return;
+    std::deque<client_clock::time_point> sent;
+    std::string batch, answer;
+    size_t next = first, done = 0;
+    char buf[1 << 16];
+    while (done < requests)
+    {
+        batch.clear();
+        client_clock::time_point now = client_clock::now();
+        for (; sent.size() < pipeline && done + sent.size() < requests; ++next)
+        {
+            batch += lines[next % lines.size()];
+            batch += '\n';
+            sent.push_back(now);
+        }
+        if (!batch.empty() && !send_all(fd, batch))
+            break;
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            break;
+        now = client_clock::now();
+        for (ssize_t i = 0; i < n; ++i)
+        {
+            if (buf[i] != '\n')
+            {
+                answer += buf[i];
+                continue;
+            }
+            res.latencies.push_back(std::chrono::duration<double, std::nano>(now - sent.front()).count());
+            sent.pop_front();
+            res.errors += answer.compare(0, 16, "expression error") == 0;
+            answer.clear();
+            ++done;
+        }
+    }
+    close(fd);
+    res.failed = done < requests;
+}
+
+int main(int argc, const char **argv)
+{
+    size_t connections = 4, requests = 100000, pipeline = 16;
+    const char *path = argc > 1 ? argv[1] : nullptr, *file = nullptr;
+    for (int i = 2; i < argc; ++i)
+    {
+        const char *arg = argv[i], *val = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!val)
+            path = nullptr;
+        else if (0==strcmp(arg, "--connections"))
+            connections = (size_t)atol(val);
+        else if (0==strcmp(arg, "--requests"))
+            requests = (size_t)atol(val);
+        else if (0==strcmp(arg, "--pipeline"))
+            pipeline = (size_t)atol(val);
+        else if (0==strcmp(arg, "--file"))
+            file = val;
+        else
+            path = nullptr;
+        ++i;
+    }
+    if (!path || !connections || !pipeline)
+    {
+        fprintf(stderr, "usage: calc_client socket [--connections N] [--requests N] [--pipeline N] [--file lines]\n");
+        return 1;
+    }
+
+    std::vector<std::string> lines;
+    if (file)
+    {
+        FILE *f = fopen(file, "rb");
+        if (!f)
+        {
+            fprintf(stderr, "cannot open %s\n", file);
+            return 1;
+        }
+        char buf[4096];
+        while (fgets(buf, sizeof(buf), f))
+        {
+            std::string s(buf);
+            while (!s.empty() && (s.back() == '\n' || s.back() == '\r'))
+                s.pop_back();
+            lines.push_back(s);
+        }
+        fclose(f);
+    }
+    if (lines.empty())
+        lines = {"2x + 1 = 0.5", "(3+(4-1))*5", "log(100)/3 + 1e-3", "2x + 1 = 2(1-x)", "1/(1-1)", "1+"};
+
+    std::vector<client_result> results(connections);
+    std::vector<std::thread> threads;
+    client_clock::time_point start = client_clock::now();
+    for (size_t i = 0; i < connections; ++i)
+    {
+        size_t count = requests / connections + (i < requests % connections);
+        threads.emplace_back(run_client, path, std::cref(lines), i * (requests / connections), count, pipeline,
+            std::ref(results[i]));
+    }
+    for (std::thread &t : threads)
+        t.join();
+    double seconds = std::chrono::duration<double>(client_clock::now() - start).count();
+
+    std::vector<double> all;
+    size_t errors = 0, failed = 0;
+    for (const client_result &r : results)
+    {
+        all.insert(all.end(), r.latencies.begin(), r.latencies.end());
+        errors += r.errors;
+        failed += r.failed;
+    }
+    if (failed)
+        fprintf(stderr, "%zu connections failed\n", failed);
+    if (all.empty())
+        return 1;
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double p) { return all[std::min(all.size() - 1, (size_t)(p * all.size()))] / 1e3; };
+    printf("%zu requests (%zu errors) on %zu connections, pipeline %zu: %.0f requests/s\n",
+        all.size(), errors, connections, pipeline, all.size() / seconds);
+    printf("latency us: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+        percentile(0.5), percentile(0.9), percentile(0.99), all.back() / 1e3);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,374 @@
+#include "calc_server.h"
+#include "calc_batch.h"
+#ifdef __linux__
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+
+// epoll data of the listening socket and the eventfd, connections count from first_id
+enum { listen_id, event_id, first_id };
+
+eval_server::eval_server(unsigned threads)
+    : threads(threads), listen_fd(-1), epoll_fd(-1), event_fd(-1), accepting(false), next_id(first_id), stopping(false)
+{
+}
+
+#ifdef __linux__
+
+eval_server::~eval_server()
+{
+    // the workers post to event_fd, they finish first
+    pool.reset();
+    for (auto &c : conns)
+        ::close(c.second->fd);
+    if (listen_fd >= 0)
+    {
+        ::close(listen_fd);
+        unlink(path.c_str());
+    }
+    if (epoll_fd >= 0)
+        ::close(epoll_fd);
+    if (event_fd >= 0)
+        ::close(event_fd);
+}
+
+static bool make_address(const char *path, sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    return true;
+}
+
+bool eval_server::listen(const char *path)
+{
+    sockaddr_un addr;
+    if (!make_address(path, addr))
+        return false;
+    // a socket file left by a server that did not exit cleanly
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        int fd = connect_server(path);
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fprintf(stderr, "a server is already running on %s\n", path);
+            return false;
+        }
+        unlink(path);
+    }
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listen_fd, SOMAXCONN) != 0)
+    {
+        fprintf(stderr, "cannot listen on %s: %s\n", path, strerror(errno));
+        if (listen_fd >= 0)
+            ::close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    this->path = path;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = listen_id;
+    bool ok = epoll_fd >= 0 && event_fd >= 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == 0;
+    ev.data.u64 = event_id;
+    if (!ok || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &ev) != 0)
+    {
+        fprintf(stderr, "cannot create epoll: %s\n", strerror(errno));
+        return false;
+    }
+    accepting = true;
+    pool.reset(new thread_pool(threads));
+    return true;
+}
+
+void eval_server::stop()
+{
+    stopping = true;
+    uint64_t one = 1;
+    ssize_t n = event_fd >= 0 ? write(event_fd, &one, sizeof(one)) : 0;
+    (void)n;
+}
+
+void eval_server::run()
+{
+    epoll_event events[64];
+    while (!stopping)
+    {
+        int n = epoll_wait(epoll_fd, events, 64, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
+            return;
+        }
+        for (int i = 0; i < n && !stopping; ++i)
+        {
+            uint64_t id = events[i].data.u64;
+            if (id == listen_id)
+                accept_all();
+            else if (id == event_id)
+                finish_jobs();
+            else
+            {
+                auto it = conns.find(id);
+                if (it == conns.end())
+                    continue;
+                connection &c = *it->second;
+                if (events[i].events & (EPOLLERR | EPOLLHUP))
+                {
+                    close(id);
+                    continue;
+                }
+                if (events[i].events & EPOLLIN)
+                    read_some(c);
+                if (events[i].events & EPOLLOUT)
+                    write_some(c);
+                dispatch(id, c);
+                update(id, c);
+            }
+        }
+    }
+}
+
+void eval_server::accept_all()
+{
+    for (;;)
+    {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0 && (errno == EMFILE || errno == ENFILE) && !conns.empty())
+        {
+            // the pending connection keeps listen_fd readable: stop polling
+            // it until close() frees a descriptor (with no connection open
+            // there is nothing to wait for, the descriptors are held elsewhere)
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, nullptr);
+            accepting = false;
+        }
+        if (fd < 0)
+            return;
+        std::unique_ptr<connection> c(new connection);
+        c->fd = fd;
+        c->events = EPOLLIN;
+        c->out_pos = 0;
+        c->busy = c->eof = false;
+        epoll_event ev;
+        ev.events = c->events;
+        ev.data.u64 = next_id;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            ::close(fd);
+            continue;
+        }
+        conns[next_id++] = std::move(c);
+    }
+}
+
+void eval_server::read_some(connection &c)
+{
+    char buf[1 << 16];
+    while (!c.eof && c.in.size() < max_line)
+    {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n > 0)
+            c.in.append(buf, (size_t)n);
+        else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+            c.eof = true;
+        else if (errno == EAGAIN)
+            return;
+    }
+}
+
+void eval_server::write_some(connection &c)
+{
+    while (c.out_pos < c.out.size())
+    {
+        ssize_t n = send(c.fd, &c.out[c.out_pos], c.out.size() - c.out_pos, MSG_NOSIGNAL);
+        if (n > 0)
+            c.out_pos += (size_t)n;
+        else if (errno == EAGAIN)
+            return;
+        else if (errno != EINTR)
+        {
+            // the client is gone: drop what it sent and what it would get
+            c.eof = true;
+            c.in.clear();
+            break;
+        }
+    }
+    c.out.clear();
+    c.out_pos = 0;
+}
+
+// queues the complete lines of c as one job
+void eval_server::dispatch(uint64_t id, connection &c)
+{
+    if (c.busy || c.out.size() - c.out_pos >= max_output)
+        return;
+    // the last line needs no '\n' once the client has finished sending
+    if (c.eof && !c.in.empty() && c.in.back() != '\n')
+        c.in += '\n';
+    size_t end = c.in.rfind('\n');
+    if (end == std::string::npos)
+        return;
+    std::string text = c.in.substr(0, end + 1);
+    c.in.erase(0, end + 1);
+    c.busy = true;
+    pool->submit([this, id, text]() mutable
+    {
+        static thread_local expression parser;
+        output_buffer out(nullptr);
+        for (size_t line = 0, nl; line < text.size(); line = nl + 1)
+        {
+            nl = text.find('\n', line);
+            text[nl] = '\0';
+            if (nl > line && text[nl - 1] == '\r')
+                text[nl - 1] = '\0';
+            eval_line(parser, &text[line], out);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m);
+            answers.push_back(answer{id, out.data()});
+        }
+        uint64_t one = 1;
+        ssize_t n = write(event_fd, &one, sizeof(one));
+        (void)n;
+    });
+}
+
+// closes c once it is done, otherwise sets the events it waits for
+void eval_server::update(uint64_t id, connection &c)
+{
+    bool unsent = c.out_pos < c.out.size();
+    bool line_too_long = c.in.size() >= max_line && c.in.find('\n') == std::string::npos;
+    if ((c.eof && !c.busy && c.in.empty() && !unsent) || line_too_long)
+    {
+        close(id);
+        return;
+    }
+    uint32_t events = (c.eof || c.in.size() >= max_line ? 0 : (uint32_t)EPOLLIN) | (unsent ? (uint32_t)EPOLLOUT : 0);
+    if (events == c.events)
+        return;
+    c.events = events;
+    epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = id;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+void eval_server::close(uint64_t id)
+{
+    auto it = conns.find(id);
+    ::close(it->second->fd);
+    conns.erase(it);
+    if (!accepting)
+    {
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = listen_id;
+        accepting = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == 0;
+    }
+}
+
+// sends the answers of finished jobs and queues the next lines
+void eval_server::finish_jobs()
+{
+    uint64_t count;
+    if (read(event_fd, &count, sizeof(count)) < 0)
+        return;
+    std::vector<answer> done;
+    {
+        std::lock_guard<std::mutex> lock(m);
+        done.swap(answers);
+    }
+    for (answer &a : done)
+    {
+        auto it = conns.find(a.id);
+        if (it == conns.end())
+            continue;
+        connection &c = *it->second;
+        c.busy = false;
+        if (!a.text.empty())
+            c.out.append(&a.text[0], a.text.size());
+        write_some(c);
+        dispatch(a.id, c);
+        update(a.id, c);
+    }
+}
+
+int connect_server(const char *path)
+{
+    sockaddr_un addr;
+    if (!make_address(path, addr))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static eval_server *serving;
+static void stop_serving(int)
+{
+    if (serving)
+        serving->stop();
+}
+
+int calc_serve(const char *path, unsigned threads)
+{
+    eval_server server(threads);
+    if (!server.listen(path))
+        return 1;
+    serving = &server;
+    signal(SIGINT, stop_serving);
+    signal(SIGTERM, stop_serving);
+    server.run();
+    serving = nullptr;
+    return 0;
+}
+
+#else
+
+eval_server::~eval_server()
+{
+}
+bool eval_server::listen(const char *)
+{
+    fprintf(stderr, "the server needs Linux\n");
+    return false;
+}
+void eval_server::run()
+{
+}
+void eval_server::stop()
+{
+}
+int connect_server(const char *)
+{
+    return -1;
+}
+int calc_serve(const char *path, unsigned threads)
+{
+    eval_server server(threads);
+    return server.listen(path) ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef calc_server_h_
+#define calc_server_h_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "thread_pool.h"
+
+
+// Evaluation server on a Unix domain socket (Linux, epoll). A request is a
+// line; each one is answered with a line as --batch prints it: the value or
+// "expression error: <message> (at pos=N)". Clients may pipeline any number
+// of requests, answers come back in request order.
+//
+// One thread runs all socket I/O with non-blocking sockets. The complete
+// lines a connection has sent are evaluated as one job on the thread pool,
+// one job per connection at a time; the workers hand the answers back to the
+// I/O thread through an eventfd. A connection that has too much output
+// unsent, or a line longer than max_line, is not read further. Out of file
+// descriptors, new connections wait in the backlog until one closes.
+class eval_server
+{
+public:
+    // threads == 0: one worker per hardware thread
+    explicit eval_server(unsigned threads = 0);
+    ~eval_server();
+    eval_server(const eval_server&) = delete;
+    eval_server &operator=(const eval_server&) = delete;
+
+    // binds path, replacing a stale socket file; false with a message on stderr
+    bool listen(const char *path);
+    // serves until stop()
+    void run();
+    // from any thread or a signal handler
+    void stop();
+
+    static const size_t max_line = 1 << 20;
+    static const size_t max_output = 1 << 22;
+
+private:
+    struct connection
+    {
+        int fd;
+        uint32_t events;        // registered with epoll
+        std::string in;         // received, not yet evaluated
+        std::string out;        // answers from out_pos on are not sent yet
+        size_t out_pos;
+        bool busy;              // a job of the connection is queued or running
+        bool eof;
+    };
+    struct answer
+    {
+        uint64_t id;
+        std::vector<char> text;
+    };
+    void accept_all();
+    void read_some(connection &c);
+    void write_some(connection &c);
+    void dispatch(uint64_t id, connection &c);
+    void update(uint64_t id, connection &c);
+    void close(uint64_t id);
+    void finish_jobs();
+
+    unsigned threads;
+    int listen_fd, epoll_fd, event_fd;
+    bool accepting;             // listen_fd is registered with epoll
+    std::string path;
+    std::unordered_map<uint64_t, std::unique_ptr<connection>> conns;
+    uint64_t next_id;
+    std::atomic<bool> stopping;
+    std::mutex m;
+    std::vector<answer> answers;        // of finished jobs, guarded by m
+    std::unique_ptr<thread_pool> pool;
+};
+
+// connects to an eval_server; returns a blocking socket or -1
+int connect_server(const char *path);
+
+// --serve mode: serves on path until SIGINT or SIGTERM
+int calc_serve(const char *path, unsigned threads);
+
+
+#endif /* calc_server_h_ */
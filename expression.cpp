@@ -1,366 +1,1142 @@
-#include "expression.h"
-
-
-static void clear(expr_t &e)
-{
-    e.clear();
-    e.xprods.clear();
-}
-static void expand_x(expr_t &expr);
-
-void expression::parse(const char *expression, char expect, bool x_allowed, char x_name)
-{
-    this->x_allowed = x_allowed;
-    this->x_name = x_name;
-    p = expression;
-    clear(parsed_expression);
-    clear(lhs_parsed_expression);
-    expr();
-    skip_ws();
-    if (expect == '\0' && *p == '=')
-    {
-        ++p;
-        lhs_parsed_expression.swap(parsed_expression);
-        lhs_parsed_expression.xprods.swap(parsed_expression.xprods);
-        expr();
-        skip_ws();
-    }
-    if (*p && *p != expect && !(*p=='=' && expect==')'))
-        err("unexpected input");
-    if (!lhs_parsed_expression.empty())
-    {
-        if (lhs_parsed_expression.xprods.empty() && parsed_expression.xprods.empty())
-            err("linear equation missing 'x'", 0);
-    }
-    else if (expect == '\0' && !parsed_expression.xprods.empty())
-        err("linear equation missing right hand side");
-}
-
-void expression::expr()
-{
-    prod();
-    for (;;)
-    {
-        skip_ws();
-        if (!next('+') && *p!='-') // treat (a-b) as (a+-b)
-            break;
-        prod();
-    }
-}
-void expression::prod()
-{
-    parsed_expression.resize(parsed_expression.size()+1);
-    term(true);
-    for (;;)
-    {
-        skip_ws();
-        if (!next('/') && !next('*'))
-            break;
-        term(true, p[-1]=='/');
-    }
-}
-bool expression::term(bool num_allowed, bool div, bool log)
-{
-    parsed_expression.back().resize(parsed_expression.back().size()+1);
-    term_t &t = parsed_expression.back().back();
-    t.num_value = 1;
-    t.div = div;
-    t.log = false;
-    t.x = 0;
-    skip_ws();
-    bool has_value = false;
-    if (num_allowed)
-    {
-        bool neg = false;
-        while (next('-'))
-        {
-            skip_ws();
-            neg = !neg;
-        }
-        // last comma for locales that use comma as decimal mark
-        if ((*p >= '0' && *p <= '9') || *p == '.' || *p == ',')
-        {
-            has_value = true;
-            num(t.num_value);
-        }
-        if (neg)
-            t.num_value *= -1;
-    }
-    if(!has_value && next_term("log"))
-    {
-        std::unique_ptr<expression> parser(new expression(nullptr, '\0', false, x_name));
-        parser->parsed_expression.resize(1);
-        parser->p = p;
-        parser->term(true, false, true);
-        p = parser->p;
-        t.expr_value.swap(parser->parsed_expression);
-        t.expr_value.xprods.swap(parser->parsed_expression.xprods);
-        t.log = true;
-        has_value = true;
-    }
-    if(!has_value)
-    {
-        bool x_allowed = this->x_allowed && !t.div && !log;
-        if (((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')) && check_term(p[1]))
-        {
-            if (!x_allowed)
-                err("division or log in linear equation");
-            if (x_name && x_name != *p)
-                err("multiple variables in linear equation");
-            t.x = x_name = *p++;
-        }
-        else
-        {
-            if (!next('('))
-            {
-                if (num_allowed)
-                    err("expected a value");
-                parsed_expression.back().resize(parsed_expression.back().size() - 1);
-                return false;
-            }
-            std::unique_ptr<expression> parser(new expression);
-            parser->parse(p, ')', x_allowed, x_name);
-            p = parser->p;
-            t.expr_value.swap(parser->parsed_expression);
-            t.expr_value.xprods.swap(parser->parsed_expression.xprods);
-            x_name = parser->x_name;
-            skip_ws();
-            if (!next(')'))
-                err("expected ')'");
-        }
-        if (t.x || !t.expr_value.xprods.empty())
-        {
-            if (parsed_expression.xprods.empty() || parsed_expression.xprods.back() != --parsed_expression.end())
-                parsed_expression.xprods.push_back(--parsed_expression.end());
-            if (!parsed_expression.back().xterms.empty())
-                err("non-linear equation");
-            parsed_expression.back().xterms.push_back(--parsed_expression.back().end());
-        }
-    }
-    while (num_allowed && !log)
-    {
-        const char *tmp = p;
-        if (!term(false))
-        {
-            p = tmp;
-            break;
-        }
-    }
-    return true;
-}
-void expression::num(double &f)
-{
-    int n;
-    if (sscanf(p, "%lf%n", &f, &n) < 1)
-        err("cannot parse number");
-    p += n;
-}
-void expression::skip_ws()
-{
-    while (*p == ' ' || *p == '\t')
-        ++p;
-}
-bool expression::next(char c)
-{
-    if (*p != c)
-        return false;
-    ++p;
-    return true;
-}
-bool expression::next_term(const char *str)
-{
-    size_t len = strlen(str);
-    if (0 != memcmp(str, p, len))
-        return false;
-    // check that function or variable has to end after len chars:
-    if (!check_term(p[len]))
-        return false;
-    p += len;
-    return true;
-}
-bool expression::check_term(char c)
-{
-    return !((c >= 'a' && c <= 'z') || (c >= 'A'&& c <= 'Z')
-        || (c >= '0' && c <= '1') || c == '_');
-}
-void expression::err(const char *msg, const char *pos)
-{
-    throw expression_error(msg, pos);
-}
-void expression::err(const char *msg)
-{
-    err(msg, p);
-}
-void expression::simplify()
-{
-    expand_x(lhs_parsed_expression);
-    expand_x(parsed_expression);
-    // move terms containing x to lhs
-    for (auto &it : parsed_expression.xprods)
-    {
-        it->front().num_value *= -1;
-        lhs_parsed_expression.splice(lhs_parsed_expression.end(), parsed_expression, it);
-    }
-    lhs_parsed_expression.xprods.splice(lhs_parsed_expression.xprods.end(), parsed_expression.xprods);
-    // move terms that don not contain x to rhs
-    auto it_x = lhs_parsed_expression.xprods.begin();
-    for (auto it1 = lhs_parsed_expression.begin(); it1!=lhs_parsed_expression.end();)
-    {
-        auto it = it1;
-        ++it1;
-        if (it_x!=lhs_parsed_expression.xprods.end() && *it_x == it)
-        {
-            ++it_x;
-            continue;
-        }
-        it->front().num_value *= -1;
-        parsed_expression.splice(parsed_expression.end(), lhs_parsed_expression, it);
-    }
-}
-double expression::solve()
-{
-    double lhs_res = 0, res;
-    bool linear = !lhs_parsed_expression.empty();
-    if (linear)
-    {
-        simplify();
-        lhs_res = eval(lhs_parsed_expression);
-    }
-    res = eval(parsed_expression);
-    if (!linear)
-        return res;
-    if (lhs_res == 0.0)
-        err(res == 0.0 ? "linear equation always true" : "linear equation has no solution", 0);
-    return res / lhs_res;
-}
-
-double eval(const term_t &term)
-{
-    double ret = term.expr_value.empty() ? 1 : eval(term.expr_value);
-    if (term.log)
-    {
-        if (ret <= 0)
-            throw expression_error("log of negative or 0", nullptr);
-        ret = log10(ret);
-    }
-    return term.num_value * ret;
-}
-double eval(const prod_t &terms)
-{
-    double ret = 1;
-    for (const auto &term : terms)
-    {
-        double x = eval(term);
-        if (term.div && !x)
-            throw expression_error("division by 0", nullptr);
-        if (term.div)
-            ret /= x;
-        else
-            ret *= x;
-    }
-    return ret;
-}
-double eval(const expr_t &expr)
-{
-    double ret = 0;
-    for (const auto &prod : expr)
-        ret += eval(prod);
-    return ret;
-}
-double eval(const char *expr)
-{
-    try
-    {
-        return expression(expr).solve();
-    }
-    catch (const expression_error &e)
-    {
-        fprintf(stderr, "expression error: %s (at pos=%d)\n", e.what(), (int)((e.p ? e.p - expr : -1)));
-    }
-    return 0;
-}
-std::ostream& operator<<(std::ostream &os, const term_t &term)
-{
-    if (term.num_value != 1.0)
-        os << std::setprecision(15) << term.num_value;
-    if (term.x)
-        os << term.x;
-    if (term.log)
-    {
-        os << "log";
-        if (term.x)
-            os << ' ';
-    }
-    if (!term.expr_value.empty())
-        os << term.expr_value;
-    if (!term.x && term.expr_value.empty() && term.num_value == 1.0)
-        os << std::setprecision(15) << term.num_value;
-    return os;
-}
-std::ostream& operator<<(std::ostream &os, const prod_t &prod)
-{
-    bool first = true;
-    for (auto &it : prod)
-    {
-        if (!first && !it.div)
-            os << '*';
-        else if (it.div)
-            os << '/';
-        os << it;
-        first = false;
-    }
-    return os;
-}
-std::ostream& operator<<(std::ostream &os, const expr_t &expr)
-{
-    os << '(';
-    bool first = true;
-    for (auto &it : expr)
-    {
-        if (!first && it.front().num_value >= 0)
-            os << '+';
-        os << it;
-        first = false;
-    }
-    return os << ')';
-}
-// (1*2 + 3*x + 5*6 + x*7) => (x*(3+7) + (1*2 + 5*6))
-static void compact_x(expr_t &expr)
-{
-    expr_t e;
-    e.resize(2);
-    e.front().resize(1);
-    term_t &x = e.front().back();
-    x.div = x.log = false;
-    x.num_value = expr.xprods.empty() ? 0 : 1.0;
-    for (auto &it : expr.xprods)
-        x.expr_value.splice(x.expr_value.end(), expr, it);
-    expr.xprods.clear();
-
-    e.back().resize(1);
-    term_t &y = e.back().back();
-    y.div = y.log = false;
-    y.num_value = expr.empty() ? 0 : 1.0;
-    y.expr_value.swap(expr);
-    expr.swap(e);
-    expr.xprods.push_back(expr.begin());
-}
-// (1*2*(3*4 + x*5 + 6*7 + 8*x)*9) => (1*2*x*(5+8)*9 + 1*2*(3*4+6*7)*9)
-static void expand_x(expr_t &expr)
-{
-    for (auto &it : expr.xprods)
-    {
-        assert(it->xterms.size()<2);
-        if (it->xterms.size() == 1 && !it->xterms.front()->expr_value.xprods.empty())
-        {
-            auto &p = it->xterms.front();
-            expand_x(p->expr_value);
-            compact_x(p->expr_value);
-            expr_t e;
-            e.splice(e.end(), p->expr_value, p->expr_value.begin());
-            expr.push_back(*it);
-            p->expr_value.splice(p->expr_value.end(), e, e.begin());
-            e.splice(e.end(), p->expr_value, p->expr_value.begin());
-        }
-    }
-}
+#include "expression.h"
+#include "number.h"
+#include "parallel_eval.h"
+#include "stats.h"
+#include <algorithm>
+
+
+node_id node_table::add_expr()
+{
+    STAT_NODE();
+    expr_t e;
+    e.first = e.last = no_node;
+    e.xprods = 0;
+    exprs.push_back(e);
+    return (node_id)(exprs.size() - 1);
+}
+node_id node_table::add_prod(node_id expr)
+{
+    STAT_NODE();
+    prod_t p;
+    p.first = p.last = p.next = p.xterm = no_node;
+    prods.push_back(p);
+    node_id id = (node_id)(prods.size() - 1);
+    append(expr, id);
+    return id;
+}
+node_id node_table::add_term(node_id prod)
+{
+    STAT_NODE();
+    term_t t;
+    t.num_value = 1;
+    t.expr_value = t.next = no_node;
+    t.div = t.log = false;
+    t.x = 0;
+    t.var = 0;
+    terms.push_back(t);
+    node_id id = (node_id)(terms.size() - 1);
+    prod_t &p = prods[prod];
+    if (p.last == no_node)
+        p.first = id;
+    else
+        terms[p.last].next = id;
+    p.last = id;
+    return id;
+}
+void node_table::append(node_id expr, node_id prod)
+{
+    expr_t &e = exprs[expr];
+    prods[prod].next = no_node;
+    if (e.last == no_node)
+        e.first = prod;
+    else
+        prods[e.last].next = prod;
+    e.last = prod;
+    if (prods[prod].xterm != no_node)
+        e.xprods++;
+}
+// removes the last added term of prod, prev is the term that preceded it
+void node_table::pop_term(node_id prod, node_id prev)
+{
+    assert(prods[prod].last == terms.size() - 1);
+    terms.pop_back();
+    prods[prod].last = prev;
+    if (prev == no_node)
+        prods[prod].first = no_node;
+    else
+        terms[prev].next = no_node;
+}
+
+uint32_t variable_table::add(const char *name, size_t len)
+{
+    auto it = ids.emplace(std::string(name, len), (uint32_t)names.size()).first;
+    if (it->second == names.size())
+        names.push_back(it->first);
+    return it->second;
+}
+void variable_table::truncate(size_t n)
+{
+    for (size_t i = n; i < names.size(); ++i)
+        ids.erase(names[i]);
+    names.resize(n);
+}
+
+static const char *const error_messages[] =
+{
+    "",
+    "expected a value",
+    "unexpected input",
+    "expected ')'",
+    "cannot parse number",
+    "expression nested too deeply",
+    "division or log in linear equation",
+    "multiple variables in linear equation",
+    "non-linear equation",
+    "linear equation missing 'x'",
+    "linear equation missing right hand side",
+    "linear equation always true",
+    "linear equation has no solution",
+    "division by 0",
+    "log of negative or 0",
+    "linear system has infinitely many solutions",
+    "linear system has no solution",
+    "expected 'name = formula'",
+    "undefined variable",
+    "circular reference",
+    "non-linear equation: no root found",
+    "non-linear equation did not converge",
+    "cannot tabulate an equation",
+};
+static_assert(sizeof(error_messages) / sizeof(*error_messages) == error_count, "a message for every error_code");
+const char *error_message(error_code code)
+{
+    return error_messages[code];
+}
+
+void expression::parse(const char *expression, bool x_free)
+{
+    expression_status s = try_parse(expression, x_free);
+    if (!s.ok())
+        raise(s);
+}
+expression_status expression::try_parse(const char *expression, bool x_free)
+{
+    STAT_SCOPE(phase_parse);
+    this->x_free = x_free;
+    x_name = 0;
+    x_nonlinear = false;
+    text = expression;
+    tokenize(expression, tokens);
+    tk = tokens.data();
+    error = error_none;
+    nodes.clear();
+    cache.clear();
+    lhs = no_node;
+    rhs = expr(true);
+    if (failed())
+        return status();
+    skip_ws();
+    if (cur() == '=' && !x_free)
+    {
+        ++tk;
+        lhs = rhs;
+        rhs = expr(true);
+        if (failed())
+            return status();
+        skip_ws();
+    }
+    if (cur())
+        err(error_unexpected_input);
+    else if (lhs != no_node)
+    {
+        if (!nodes.exprs[lhs].xprods && !nodes.exprs[rhs].xprods)
+            err(error_missing_x, nullptr);
+    }
+    else if (nodes.exprs[rhs].xprods && !x_free)
+        err(error_missing_rhs);
+    return status();
+}
+expression_status expression::status() const
+{
+    expression_status s = {error, failed() && error_p ? (int)(error_p - text) : -1};
+    return s;
+}
+void expression::raise(const expression_status &s) const
+{
+    throw expression_error(s.message(), s.pos >= 0 ? text + s.pos : nullptr);
+}
+
+// states of the parser functions kept in parse_frame::state
+enum
+{
+    expr_start, expr_next,          // EXPR: PROD([+\-]PROD)*
+    prod_start, prod_next,          // PROD: TERM([*\/]TERM)*
+    term_start, term_log, term_group, term_more, term_more_end,
+};
+
+void expression::call(uint8_t state, node_id e, node_id pr, bool x_allowed, bool num_allowed, bool div, bool log)
+{
+    parse_frame f = {state, x_allowed, num_allowed, div, log, e, pr, no_node, no_node, no_node, nullptr};
+    stack.push_back(f);
+}
+// Recursive descent on an explicit stack: every parse_frame is a pending call
+// of expr, prod or term. A call pushes a frame and continues with it; its
+// caller resumes in the state it left when the frame is popped, with the
+// returned values in ret and ret_ok. Nesting only grows the reused stack.
+// On an error the whole parse returns no_node at once.
+node_id expression::expr(bool x_allowed)
+{
+    stack.clear();
+    call(expr_start, no_node, no_node, x_allowed);
+    node_id ret = no_node;
+    bool ret_ok = false;
+    unsigned depth = 0;
+    while (!stack.empty())
+    {
+        parse_frame &f = stack.back();
+        switch (f.state)
+        {
+        case expr_start:
+            f.e = nodes.add_expr();
+            f.state = expr_next;
+            call(prod_start, f.e, no_node, f.x_allowed);
+            continue;
+        case expr_next:
+            skip_ws();
+            if (!next('+') && cur()!='-') // treat (a-b) as (a+-b)
+            {
+                ret = f.e;
+                break;
+            }
+            call(prod_start, f.e, no_node, f.x_allowed);
+            continue;
+
+        case prod_start:
+            f.pr = nodes.add_prod(f.e);
+            f.state = prod_next;
+            call(term_start, f.e, f.pr, f.x_allowed);
+            continue;
+        case prod_next:
+            skip_ws();
+            if (!next('/') && !next('*'))
+                break;
+            call(term_start, f.e, f.pr, f.x_allowed, true, tk[-1].c=='/');
+            continue;
+
+        case term_start:
+            f.prev = nodes.prods[f.pr].last;
+            f.t = nodes.add_term(f.pr);
+            nodes.terms[f.t].div = f.div;
+            skip_ws();
+            if (value(f))
+            {
+                f.state = term_more;
+                continue;
+            }
+            if (failed())
+                return no_node;
+            if (next_term("log"))
+            {
+                if (depth++ == max_depth)
+                {
+                    err(error_nested_too_deeply, text + tk[-1].pos);
+                    return no_node;
+                }
+                STAT_DEPTH(depth);
+                f.sub = nodes.add_expr();
+                f.state = term_log;
+                call(term_start, f.sub, nodes.add_prod(f.sub), false, true, false, true);
+                continue;
+            }
+            {
+                bool x_ok = f.x_allowed && !f.div && !f.log;
+                if (tk->kind == token_letters && (vars || check_term(at()[1])))
+                {
+                    if (!x_ok && !x_free)
+                    {
+                        if (!nonlinear)
+                        {
+                            err(error_division_or_log);
+                            return no_node;
+                        }
+                        x_nonlinear = true;
+                    }
+                    if (vars)
+                    {
+                        const char *name = at();
+                        while (tk->kind == token_letters || tk->kind == token_digits || cur() == '_')
+                            ++tk;
+                        nodes.terms[f.t].x = *name;
+                        nodes.terms[f.t].var = vars->add(name, at() - name);
+                    }
+                    else if (x_name && x_name != cur())
+                    {
+                        err(error_multiple_variables);
+                        return no_node;
+                    }
+                    else
+                        nodes.terms[f.t].x = x_name = (tk++)->c;
+                    if (!x_term(f))
+                        return no_node;
+                    f.state = term_more;
+                    continue;
+                }
+                if (!next('('))
+                {
+                    if (f.num_allowed)
+                    {
+                        err(error_expected_value);
+                        return no_node;
+                    }
+                    nodes.pop_term(f.pr, f.prev);
+                    ret_ok = false;
+                    break;
+                }
+                if (depth++ == max_depth)
+                {
+                    err(error_nested_too_deeply, text + tk[-1].pos);
+                    return no_node;
+                }
+                STAT_DEPTH(depth);
+                f.state = term_group;
+                call(expr_start, no_node, no_node, x_ok);
+                continue;
+            }
+        case term_log:
+            --depth;
+            nodes.terms[f.t].expr_value = f.sub;
+            nodes.terms[f.t].log = true;
+            // counts the x in the argument, "log(x) = 1" is not missing it
+            if (nonlinear && !x_free && !x_term(f))
+                return no_node;
+            f.state = term_more;
+            continue;
+        case term_group:
+            --depth;
+            skip_ws();
+            if (cur() && cur() != ')' && cur() != '=')
+            {
+                err(error_unexpected_input);
+                return no_node;
+            }
+            nodes.terms[f.t].expr_value = ret;
+            if (!next(')'))
+            {
+                err(error_expected_paren);
+                return no_node;
+            }
+            if (!x_term(f))
+                return no_node;
+            f.state = term_more;
+            continue;
+        case term_more:
+            // implicit products: 2x, 5log 100, 2(1+x)log(x)
+            if (!f.num_allowed || f.log)
+            {
+                ret_ok = true;
+                break;
+            }
+            f.tmp = tk;
+            skip_ws();
+            // only a name or '(' can follow without an operator
+            if (!(tk->kind == token_letters || cur() == '('))
+            {
+                tk = f.tmp;
+                ret_ok = true;
+                break;
+            }
+            f.state = term_more_end;
+            call(term_start, f.e, f.pr, f.x_allowed, false);
+            continue;
+        case term_more_end:
+            if (!ret_ok)
+            {
+                tk = f.tmp;
+                ret_ok = true;
+                break;
+            }
+            f.state = term_more;
+            continue;
+        }
+        stack.pop_back();
+    }
+    return ret;
+}
+// optional minus signs and a number of term f; returns false if there is no
+// number or it cannot be parsed
+bool expression::value(parse_frame &f)
+{
+    if (!f.num_allowed)
+        return false;
+    bool neg = false, has_value = false;
+    while (next('-'))
+    {
+        skip_ws();
+        neg = !neg;
+    }
+    // either mark starts a number, so the wrong one is "cannot parse number"
+    if (tk->kind == token_digits || cur() == '.' || cur() == ',')
+    {
+        if (!num(nodes.terms[f.t].num_value))
+            return false;
+        has_value = true;
+    }
+    if (neg)
+        nodes.terms[f.t].num_value *= -1;
+    return has_value;
+}
+// records that the x or sub-expression of term f contains x; false if that
+// makes the equation non-linear
+bool expression::x_term(const parse_frame &f)
+{
+    const term_t &tt = nodes.terms[f.t];
+    if (tt.x || (tt.expr_value != no_node && nodes.exprs[tt.expr_value].xprods))
+    {
+        if (nodes.prods[f.pr].xterm == no_node)
+        {
+            nodes.prods[f.pr].xterm = f.t;
+            nodes.exprs[f.e].xprods++;
+        }
+        else if (!x_free)
+        {
+            if (!nonlinear)
+            {
+                err(error_non_linear);
+                return false;
+            }
+            x_nonlinear = true;
+        }
+    }
+    return true;
+}
+bool expression::num(double &f)
+{
+    const char *end = parse_number(at(), f, decimal_point);
+    if (!end)
+    {
+        err(error_cannot_parse_number);
+        return false;
+    }
+    // a number ends where a digit, letter or other character starts
+    while (at() < end)
+        ++tk;
+    return true;
+}
+void expression::skip_ws()
+{
+    if (tk->kind == token_blank)
+        ++tk;
+}
+bool expression::next(char c)
+{
+    if (tk->kind != token_char || cur() != c)
+        return false;
+    ++tk;
+    return true;
+}
+bool expression::next_term(const char *str)
+{
+    // str is a token of letters: the function or variable has to end after it
+    size_t len = strlen(str);
+    if (tk->kind != token_letters || 0 != memcmp(str, at(), len) || !check_term(at()[len]))
+        return false;
+    ++tk;
+    return true;
+}
+bool expression::check_term(char c)
+{
+    return !((c >= 'a' && c <= 'z') || (c >= 'A'&& c <= 'Z')
+        || (c >= '0' && c <= '1') || c == '_');
+}
+void expression::err(error_code code, const char *pos)
+{
+    error = code;
+    error_p = pos;
+}
+void expression::err(error_code code)
+{
+    err(code, at());
+}
+double expression::solve()
+{
+    double value;
+    expression_status s = try_solve(value);
+    if (!s.ok())
+        raise(s);
+    return value;
+}
+
+// lhs - rhs at x and its slope; size is |lhs| + |rhs|, a root has f small
+// next to it, a pole where f changes sign does not
+namespace {
+struct sample
+{
+    double x, f, slope, size;
+    bool ok;        // x is in the domain and f is finite
+};
+}
+static sample at(const node_table &nodes, const expr_t &lhs, const expr_t &rhs, double x)
+{
+    error_code error = error_none;
+    dual a = eval(nodes, lhs, x, error), b = eval(nodes, rhs, x, error);
+    sample s = {x, a.value - b.value, a.slope - b.slope, fabs(a.value) + fabs(b.value), false};
+    s.ok = !error && std::isfinite(s.f);
+    return s;
+}
+static bool is_root(const sample &s)
+{
+    return s.ok && fabs(s.f) <= 1e-9 * s.size;
+}
+// Newton steps inside the bracket of lo and hi, where f changes sign; a step
+// that would leave it or not halve it is a bisection instead. Ends when the
+// step no longer moves x or no double is left between the ends.
+static error_code bracketed_root(const node_table &nodes, const expr_t &lhs, const expr_t &rhs, sample lo, sample hi, sample &root)
+{
+    if (lo.f > 0)
+        std::swap(lo, hi);
+    double x = lo.x / 2 + hi.x / 2, step = fabs(hi.x - lo.x), last = step;
+    for (int i = 0; i < 4096; ++i)
+    {
+        sample s = at(nodes, lhs, rhs, x);
+        if (!s.ok)
+        {
+            root = s;       // a gap in the domain, no sign to go on
+            return error_none;
+        }
+        if (s.f == 0)
+        {
+            root = s;
+            return error_none;
+        }
+        (s.f < 0 ? lo : hi) = s;
+        double next = x - s.f / s.slope, mid = lo.x / 2 + hi.x / 2;
+        bool inside = next > std::min(lo.x, hi.x) && next < std::max(lo.x, hi.x);
+        if (inside && fabs(2 * s.f) <= fabs(last * s.slope))
+        {
+            last = step;
+            step = fabs(next - x);
+        }
+        else
+        {
+            last = step;
+            step = fabs(hi.x - lo.x) / 2;
+            next = mid;
+        }
+        if (next == x || next == lo.x || next == hi.x)
+        {
+            root = fabs(lo.f) < fabs(hi.f) ? lo : hi;
+            if (fabs(s.f) <= fabs(root.f))
+                root = s;
+            return error_none;
+        }
+        x = next;
+    }
+    return error_no_convergence;
+}
+// a root of lhs = rhs, see expression::set_nonlinear()
+static error_code find_root(const node_table &nodes, const expr_t &lhs, const expr_t &rhs, double &root)
+{
+    sample zero = at(nodes, lhs, rhs, 0), best = zero, found = sample();
+    if (zero.ok && zero.f == 0)
+    {
+        root = 0;
+        return error_none;
+    }
+    // Outward from 1 in both directions, both signs: +-2^k up to the largest
+    // double, compared with 0 first, and +-2^-k down to the smallest one,
+    // compared with +-1 first (0 is out of the domain of 1/x = 4, log(x) = 1).
+    // Each chain keeps its last sample in the domain.
+    sample prev[4] = {zero, zero, sample(), sample()};
+    for (int k = 0; k < 1074; ++k)
+    {
+        for (int chain = 0; chain < 4; ++chain)
+        {
+            bool down = chain >= 2;
+            if (!down && k >= 1024)
+                continue;
+            double x = down ? ldexp(1, -1 - k) : ldexp(1, k);
+            sample s = at(nodes, lhs, rhs, chain & 1 ? -x : x);
+            if (!s.ok)
+                continue;
+            if (s.f == 0)
+            {
+                root = s.x;
+                return error_none;
+            }
+            if (!best.ok || fabs(s.f) < fabs(best.f))
+                best = s;
+            if (prev[chain].ok && (prev[chain].f < 0) != (s.f < 0))
+            {
+                error_code code = bracketed_root(nodes, lhs, rhs, prev[chain], s, found);
+                if (code)
+                    return code;
+                if (is_root(found))
+                {
+                    root = found.x;
+                    return error_none;
+                }
+            }
+            prev[chain] = s;
+            if (k == 0 && !down)
+                prev[chain + 2] = s;
+        }
+    }
+    // No sign change the scan could see: a double root such as
+    // (x-3)(x-3) = 0, one next to a pole, or none at all. Newton from the
+    // best sample, each step halved until it lands in the domain with a
+    // smaller |f|. At a double root it slows down to halving the distance
+    // and f ends up far below where it started; near a minimum above 0 the
+    // steps shrink to nothing with f where it was.
+    if (!best.ok)
+        return error_no_root;
+    sample s = best;
+    for (int i = 0; i < 256; ++i)
+    {
+        if (s.f == 0)
+        {
+            root = s.x;
+            return error_none;
+        }
+        double step = s.f / s.slope;
+        if (!std::isfinite(step))
+            return error_no_root;
+        sample next;
+        for (int halved = 0; ; ++halved, step /= 2)
+        {
+            if (halved == 64)
+                return error_no_root;
+            next = at(nodes, lhs, rhs, s.x - step);
+            if (next.ok && fabs(next.f) < fabs(s.f))
+                break;
+        }
+        if (fabs(step) <= 1e-15 * fabs(next.x))
+        {
+            if (fabs(next.f) > 1e-9 * fabs(best.f))
+                return error_no_root;
+            root = next.x;
+            return error_none;
+        }
+        s = next;
+    }
+    return error_no_convergence;
+}
+
+expression_status expression::try_solve(double &value)
+{
+    STAT_SCOPE(phase_solve);
+    value = 0;
+    if (failed())
+        return status();
+    error_code code = error_none;
+    eval_cache *shared = nullptr;
+    if (!cache.empty())
+    {
+        cache.next();
+        shared = &cache;
+    }
+    if (lhs == no_node)
+    {
+        if (nodes.exprs[rhs].xprods)
+            code = error_missing_rhs;
+        else if (parallel)
+            value = parallel->eval(nodes, nodes.exprs[rhs], code);
+        else
+            value = eval(nodes, nodes.exprs[rhs], code, shared);
+    }
+    else if (x_nonlinear)
+        code = find_root(nodes, nodes.exprs[lhs], nodes.exprs[rhs], value);
+    else
+    {
+        // a*x + b = c*x + d  =>  x = (d - b) / (a - c), the errors in the
+        // order of a, b, c and d
+        const expr_t &l = nodes.exprs[lhs], &r = nodes.exprs[rhs];
+        linear left = parallel ? parallel->eval_linear(nodes, l) : eval_linear(nodes, l, shared);
+        linear right = parallel ? parallel->eval_linear(nodes, r) : eval_linear(nodes, r, shared);
+        code = left.coef_error ? left.coef_error : left.cons_error ? left.cons_error
+            : right.coef_error ? right.coef_error : right.cons_error;
+        double a = left.coef, b = left.cons, c = right.coef, d = right.cons;
+        if (!code && a - c == 0.0)
+            code = d - b == 0.0 ? error_always_true : error_no_solution;
+        value = (d - b) / (a - c);
+    }
+    if (code)
+        value = 0;
+    expression_status s = {code, -1};
+    return s;
+}
+
+size_t expression::share_subexpressions()
+{
+    if (failed())
+        return 0;
+    // Hash every expr by its prods and terms with the sub-expressions already
+    // replaced by the first one equal to them. A sub-expression is added
+    // after the expr of its term, going down from the last id every one is
+    // resolved before it is used. Equal hashes are compared node by node in
+    // an open addressing table of expr ids.
+    size_t n = nodes.exprs.size(), size = 16;
+    while (size < 2 * n)
+        size *= 2;
+    std::vector<node_id> same(n), table(size, no_node);
+    std::vector<uint64_t> hashes(n);
+    auto sub = [&](const term_t &term) { return term.expr_value == no_node ? no_node : same[term.expr_value]; };
+    auto equal = [&](node_id a, node_id b)
+    {
+        node_id i = nodes.exprs[a].first, j = nodes.exprs[b].first;
+        for (; i != no_node && j != no_node; i = nodes.prods[i].next, j = nodes.prods[j].next)
+        {
+            node_id u = nodes.prods[i].first, v = nodes.prods[j].first;
+            for (; u != no_node && v != no_node; u = nodes.terms[u].next, v = nodes.terms[v].next)
+            {
+                const term_t &s = nodes.terms[u], &t = nodes.terms[v];
+                if (memcmp(&s.num_value, &t.num_value, sizeof(double)) || sub(s) != sub(t) || s.var != t.var
+                    || s.div != t.div || s.log != t.log || s.x != t.x)
+                    return false;
+            }
+            if (u != v)
+                return false;
+        }
+        return i == j;
+    };
+    for (size_t i = n; i-- > 0;)
+    {
+        uint64_t h = 14695981039346656037ull;
+        auto mix = [&h](uint64_t v) { h = (h ^ v) * 1099511628211ull; };
+        for (node_id pr = nodes.exprs[i].first; pr != no_node; pr = nodes.prods[pr].next)
+        {
+            mix(0);
+            for (node_id t = nodes.prods[pr].first; t != no_node; t = nodes.terms[t].next)
+            {
+                const term_t &term = nodes.terms[t];
+                assert(term.expr_value == no_node || term.expr_value > i);
+                uint64_t bits;
+                memcpy(&bits, &term.num_value, sizeof(bits));
+                mix(bits);
+                mix((uint64_t)sub(term) << 32 | term.var);
+                mix((uint64_t)term.div << 16 | (uint64_t)term.log << 8 | (uint8_t)term.x);
+            }
+        }
+        h = (h ^ h >> 31) * 0xbf58476d1ce4e5b9ull;
+        hashes[i] = h ^= h >> 32;
+        size_t k = (size_t)h & (size - 1);
+        while (table[k] != no_node && !(hashes[table[k]] == h && equal(table[k], (node_id)i)))
+            k = (k + 1) & (size - 1);
+        if (table[k] == no_node)
+            table[k] = (node_id)i;
+        same[i] = table[k];
+    }
+
+    // Keep the nodes reachable from lhs and rhs, in their order. Going up
+    // from the roots marks every sub-expression before it is reached, the
+    // new ids are never larger than the old ones: the tables are compacted
+    // in place.
+    size_t prods = nodes.prods.size(), terms = nodes.terms.size();
+    std::vector<node_id> expr_id(n, no_node), prod_id(prods, no_node), term_id(terms, no_node);
+    if (lhs != no_node)
+        expr_id[same[lhs]] = 0;
+    expr_id[same[rhs]] = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (expr_id[i] == no_node)
+            continue;
+        for (node_id pr = nodes.exprs[i].first; pr != no_node; pr = nodes.prods[pr].next)
+        {
+            prod_id[pr] = 0;
+            for (node_id t = nodes.prods[pr].first; t != no_node; t = nodes.terms[t].next)
+            {
+                term_id[t] = 0;
+                if (nodes.terms[t].expr_value != no_node)
+                    expr_id[same[nodes.terms[t].expr_value]] = 0;
+            }
+        }
+    }
+    auto number = [](std::vector<node_id> &ids)
+    {
+        node_id count = 0;
+        for (node_id &id : ids)
+            if (id != no_node)
+                id = count++;
+        return count;
+    };
+    auto map = [](const std::vector<node_id> &ids, node_id id) { return id == no_node ? no_node : ids[id]; };
+    size_t kept_exprs = number(expr_id), kept_prods = number(prod_id), kept_terms = number(term_id);
+    std::vector<uint32_t> uses(kept_exprs, 0);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (expr_id[i] == no_node)
+            continue;
+        expr_t e = nodes.exprs[i];
+        e.first = map(prod_id, e.first);
+        e.last = map(prod_id, e.last);
+        nodes.exprs[expr_id[i]] = e;
+    }
+    for (size_t i = 0; i < prods; ++i)
+    {
+        if (prod_id[i] == no_node)
+            continue;
+        prod_t p = nodes.prods[i];
+        p.first = map(term_id, p.first);
+        p.last = map(term_id, p.last);
+        p.next = map(prod_id, p.next);
+        p.xterm = map(term_id, p.xterm);
+        nodes.prods[prod_id[i]] = p;
+    }
+    for (size_t i = 0; i < terms; ++i)
+    {
+        if (term_id[i] == no_node)
+            continue;
+        term_t t = nodes.terms[i];
+        t.next = map(term_id, t.next);
+        if (t.expr_value != no_node)
+            ++uses[t.expr_value = expr_id[same[t.expr_value]]];
+        nodes.terms[term_id[i]] = t;
+    }
+    if (lhs != no_node)
+        ++uses[lhs = expr_id[same[lhs]]];
+    ++uses[rhs = expr_id[same[rhs]]];
+    nodes.exprs.resize(kept_exprs);
+    nodes.prods.resize(kept_prods);
+    nodes.terms.resize(kept_terms);
+    cache.reset(uses);
+    return n + prods + terms - kept_exprs - kept_prods - kept_terms;
+}
+
+void eval_cache::reset(const std::vector<uint32_t> &uses)
+{
+    slot.assign(uses.size(), no_node);
+    uint32_t n = 0;
+    for (size_t i = 0; i < uses.size(); ++i)
+        if (uses[i] > 1)
+            slot[i] = n++;
+    if (!n)
+        slot.clear();
+    values.resize(2 * n);
+    errors.resize(2 * n);
+    done.assign(2 * n, 0);
+    generation = 1;
+}
+void eval_cache::next()
+{
+    if (++generation == 0)
+    {
+        std::fill(done.begin(), done.end(), 0);
+        generation = 1;
+    }
+}
+double eval_cache::value(const node_table &nodes, const term_t &term, error_code &error)
+{
+    uint32_t i = 2 * slot[term.expr_value];
+    if (done[i] != generation)
+    {
+        errors[i] = error_none;
+        values[i] = eval(nodes, nodes.exprs[term.expr_value], errors[i], this);
+        done[i] = generation;
+    }
+    if (term.log && done[i + 1] != generation)
+    {
+        errors[i + 1] = errors[i] ? errors[i] : values[i] <= 0 ? error_log_domain : error_none;
+        values[i + 1] = log10(values[i]);
+        done[i + 1] = generation;
+    }
+    i += term.log;
+    if (!error)
+        error = errors[i];
+    return values[i];
+}
+
+double term_value(const term_t &term, double inner, error_code &error)
+{
+    if (term.log)
+    {
+        if (inner <= 0 && !error)
+            error = error_log_domain;
+        inner = log10(inner);
+    }
+    return term.num_value * inner;
+}
+double mul_term(double ret, const term_t &term, double x, error_code &error)
+{
+    if (term.div && !x && !error)
+        error = error_division_by_0;
+    return term.div ? ret / x : ret * x;
+}
+double eval(const node_table &nodes, const term_t &term, error_code &error, eval_cache *cache)
+{
+    STAT_SCOPE(phase_eval);
+    if (cache && term.expr_value != no_node && cache->shared(term.expr_value))
+        return term.num_value * cache->value(nodes, term, error);
+    double ret = term.expr_value == no_node ? 1 : eval(nodes, nodes.exprs[term.expr_value], error, cache);
+    return term_value(term, ret, error);
+}
+double eval(const node_table &nodes, const prod_t &prod, error_code &error, eval_cache *cache)
+{
+    STAT_SCOPE(phase_eval);
+    double ret = 1;
+    for (node_id i = prod.first; i != no_node; i = nodes.terms[i].next)
+    {
+        const term_t &term = nodes.terms[i];
+        ret = mul_term(ret, term, eval(nodes, term, error, cache), error);
+    }
+    return ret;
+}
+double eval(const node_table &nodes, const expr_t &expr, error_code &error, eval_cache *cache)
+{
+    STAT_SCOPE(phase_eval);
+    double ret = 0;
+    for (node_id i = expr.first; i != no_node; i = nodes.prods[i].next)
+        ret += eval(nodes, nodes.prods[i], error, cache);
+    return ret;
+}
+
+// A term or prod that contains x is only reached through its xterm, the other
+// terms are constant (x in a division or log is a parse error) and count
+// towards the errors of the coefficient. Prods without x have no coefficient,
+// a bare x times constants has no constant part: it is skipped rather than
+// taken as 0, so 1e400x = 1 is 1/inf and not inf*0. Each part goes through
+// the operations eval() would do on it alone, in the same order.
+linear term_value(const term_t &term, const linear &inner)
+{
+    return linear{term.num_value * inner.coef, term.num_value * inner.cons, inner.coef_error, inner.cons_error};
+}
+linear mul_term(linear ret, const term_t &term, double x, error_code x_error)
+{
+    if (!ret.coef_error)
+        ret.coef_error = x_error;
+    ret.coef = mul_term(ret.coef, term, x, ret.coef_error);
+    ret.cons = term.div ? ret.cons / x : ret.cons * x;
+    return ret;
+}
+linear add_prod(linear ret, const node_table &nodes, const prod_t &prod, const linear &p)
+{
+    if (prod.xterm != no_node)
+    {
+        ret.coef += p.coef;
+        if (!ret.coef_error)
+            ret.coef_error = p.coef_error;
+    }
+    if (has_constant(nodes, prod))
+    {
+        ret.cons += p.cons;
+        if (!ret.cons_error)
+            ret.cons_error = p.cons_error;
+    }
+    return ret;
+}
+linear add_linear(linear a, const linear &b)
+{
+    a.coef += b.coef;
+    a.cons += b.cons;
+    if (!a.coef_error)
+        a.coef_error = b.coef_error;
+    if (!a.cons_error)
+        a.cons_error = b.cons_error;
+    return a;
+}
+linear mul_linear(linear a, const linear &b)
+{
+    a.coef *= b.coef;
+    a.cons *= b.cons;
+    if (!a.coef_error)
+        a.coef_error = b.coef_error;
+    if (!a.cons_error)
+        a.cons_error = b.cons_error;
+    return a;
+}
+linear eval_linear(const node_table &nodes, const term_t &term, eval_cache *cache)
+{
+    STAT_SCOPE(phase_eval);
+    const linear one = {1, 1, error_none, error_none};
+    return term_value(term, term.expr_value == no_node ? one : eval_linear(nodes, nodes.exprs[term.expr_value], cache));
+}
+linear eval_linear(const node_table &nodes, const prod_t &prod, eval_cache *cache)
+{
+    STAT_SCOPE(phase_eval);
+    linear ret = {1, 1, error_none, error_none};
+    for (node_id i = prod.first; i != no_node; i = nodes.terms[i].next)
+    {
+        const term_t &term = nodes.terms[i];
+        if (i == prod.xterm)
+        {
+            ret = mul_linear(ret, eval_linear(nodes, term, cache));
+            continue;
+        }
+        error_code error = error_none;
+        double x = eval(nodes, term, error, cache);
+        ret = mul_term(ret, term, x, error);
+    }
+    return ret;
+}
+linear eval_linear(const node_table &nodes, const expr_t &expr, eval_cache *cache)
+{
+    STAT_SCOPE(phase_eval);
+    linear ret = {0, 0, error_none, error_none};
+    for (node_id i = expr.first; i != no_node; i = nodes.prods[i].next)
+    {
+        const prod_t &prod = nodes.prods[i];
+        if (prod.xterm != no_node)
+        {
+            ret = add_prod(ret, nodes, prod, eval_linear(nodes, prod, cache));
+            continue;
+        }
+        linear p = {0, 0, error_none, error_none};
+        p.cons = eval(nodes, prod, p.cons_error, cache);
+        ret = add_prod(ret, nodes, prod, p);
+    }
+    return ret;
+}
+
+// The rules of eval() carried to the slope: (uv)' = u'v + uv',
+// (u/v)' = (u' - (u/v)v')/v, (log10 u)' = u'/(u ln 10).
+dual eval(const node_table &nodes, const term_t &term, double x, error_code &error)
+{
+    STAT_SCOPE(phase_eval);
+    if (term.x)
+        return dual{term.num_value * x, term.num_value};
+    dual ret = {1, 0};
+    if (term.expr_value != no_node)
+        ret = eval(nodes, nodes.exprs[term.expr_value], x, error);
+    if (term.log)
+    {
+        if (ret.value <= 0 && !error)
+            error = error_log_domain;
+        ret.slope /= ret.value * log(10.0);
+        ret.value = log10(ret.value);
+    }
+    return dual{term.num_value * ret.value, term.num_value * ret.slope};
+}
+dual eval(const node_table &nodes, const prod_t &prod, double x, error_code &error)
+{
+    STAT_SCOPE(phase_eval);
+    dual ret = {1, 0};
+    for (node_id i = prod.first; i != no_node; i = nodes.terms[i].next)
+    {
+        const term_t &term = nodes.terms[i];
+        dual t = eval(nodes, term, x, error);
+        if (term.div && !t.value && !error)
+            error = error_division_by_0;
+        if (term.div)
+        {
+            double q = ret.value / t.value;
+            ret = dual{q, (ret.slope - q * t.slope) / t.value};
+        }
+        else
+            ret = dual{ret.value * t.value, ret.slope * t.value + ret.value * t.slope};
+    }
+    return ret;
+}
+dual eval(const node_table &nodes, const expr_t &expr, double x, error_code &error)
+{
+    STAT_SCOPE(phase_eval);
+    dual ret = {0, 0};
+    for (node_id i = expr.first; i != no_node; i = nodes.prods[i].next)
+    {
+        dual p = eval(nodes, nodes.prods[i], x, error);
+        ret.value += p.value;
+        ret.slope += p.slope;
+    }
+    return ret;
+}
+double eval(const node_table &nodes, const term_t &term, const double *values, error_code &error)
+{
+    STAT_SCOPE(phase_eval);
+    if (term.x)
+        return term.num_value * values[term.var];
+    double ret = term.expr_value == no_node ? 1 : eval(nodes, nodes.exprs[term.expr_value], values, error);
+    if (term.log)
+    {
+        if (ret <= 0 && !error)
+            error = error_log_domain;
+        ret = log10(ret);
+    }
+    return term.num_value * ret;
+}
+double eval(const node_table &nodes, const prod_t &prod, const double *values, error_code &error)
+{
+    STAT_SCOPE(phase_eval);
+    double ret = 1;
+    for (node_id i = prod.first; i != no_node; i = nodes.terms[i].next)
+    {
+        const term_t &term = nodes.terms[i];
+        double x = eval(nodes, term, values, error);
+        if (term.div && !x && !error)
+            error = error_division_by_0;
+        if (term.div)
+            ret /= x;
+        else
+            ret *= x;
+    }
+    return ret;
+}
+double eval(const node_table &nodes, const expr_t &expr, const double *values, error_code &error)
+{
+    STAT_SCOPE(phase_eval);
+    double ret = 0;
+    for (node_id i = expr.first; i != no_node; i = nodes.prods[i].next)
+        ret += eval(nodes, nodes.prods[i], values, error);
+    return ret;
+}
+double eval(const char *expr)
+{
+    expression e;
+    double value = 0;
+    expression_status s = e.try_parse(expr);
+    if (s.ok())
+        s = e.try_solve(value);
+    if (!s.ok())
+        fprintf(stderr, "expression error: %s (at pos=%d)\n", s.message(), s.pos);
+    return value;
+}
+// shortest text that parses back to the same value
+static void print_number(std::ostream &os, double value)
+{
+    char buf[number_buffer_size];
+    os.write(buf, format_number(value, buf));
+}
+std::ostream& operator<<(std::ostream &os, node_ref<term_t> t)
+{
+    const term_t &term = t.node;
+    if (term.num_value != 1.0)
+        print_number(os, term.num_value);
+    if (term.x)
+        os << term.x;
+    if (term.log)
+    {
+        os << "log";
+        if (term.x)
+            os << ' ';
+    }
+    if (term.expr_value != no_node)
+        os << ref(t.nodes, t.nodes.exprs[term.expr_value]);
+    if (!term.x && term.expr_value == no_node && term.num_value == 1.0)
+        print_number(os, term.num_value);
+    return os;
+}
+std::ostream& operator<<(std::ostream &os, node_ref<prod_t> prod)
+{
+    bool first = true;
+    for (node_id i = prod.node.first; i != no_node; i = prod.nodes.terms[i].next)
+    {
+        const term_t &it = prod.nodes.terms[i];
+        if (!first && !it.div)
+            os << '*';
+        else if (it.div)
+            os << '/';
+        os << ref(prod.nodes, it);
+        first = false;
+    }
+    return os;
+}
+std::ostream& operator<<(std::ostream &os, node_ref<expr_t> expr)
+{
+    os << '(';
+    bool first = true;
+    for (node_id i = expr.node.first; i != no_node; i = expr.nodes.prods[i].next)
+    {
+        const prod_t &it = expr.nodes.prods[i];
+        if (!first && expr.nodes.terms[it.first].num_value >= 0)
+            os << '+';
+        os << ref(expr.nodes, it);
+        first = false;
+    }
+    return os << ')';
+}
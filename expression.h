@@ -1,88 +1,347 @@
-#ifndef expression_h_
-#define expression_h_
-
-#include <stdio.h>
-#include <string.h>
-#include <assert.h>
-#include <math.h>
-#include <list>
-#include <stdexcept>
-#include <ostream>
-#include <iomanip>
-#include <memory>
-
-
-//  EXPR          ::= PROD+EXPR | PROD-EXPR | PROD             PROD([+\-]PROD)*
-//  PROD          ::= TERM*PROD | TERM/PROD | TERM             TERM([*\/]TERM)*
-//  TERM          ::= -TERM | TERM FUNC | FUNC | NUM           -*(NUM|FUNC)(FUNC)*
-//  FUNC          ::= log(EXPR) | log TERM | x                 \(EXPR\) | log TERM | x
-
-struct term_t;
-struct prod_t : std::list<term_t> { std::list<std::list<term_t>::iterator> xterms; };
-struct expr_t : std::list<prod_t> { std::list<std::list<prod_t>::iterator> xprods; };
-struct term_t
-{
-    bool div, log;
-    char x;
-    double num_value;
-    expr_t expr_value;
-};
-double eval(const expr_t &expr);
-double eval(const prod_t &terms);
-double eval(const term_t &term);
-double eval(const char *expr);
-
-std::ostream& operator<<(std::ostream &os, const expr_t &expr);
-std::ostream& operator<<(std::ostream &os, const term_t &term);
-std::ostream& operator<<(std::ostream &os, const prod_t &prod);
-
-
-class expression_error : public std::invalid_argument
-{
-public:
-    explicit expression_error(const char *msg, const char *p) : std::invalid_argument(msg), p(p) {}
-    const char *p;
-};
-
-
-class expression
-{
-public:
-    explicit expression(const char *expr = nullptr, char expect = '\0', bool x_allowed = true, char x_name = 0)
-    {
-        if (expr)
-            parse(expr, expect, x_allowed, x_name);
-    }
-    void parse(const char *expression, char expect = '\0', bool x_allowed = true, char x_name = 0);
-
-protected:
-    void expr();
-    void prod();
-    bool term(bool num_allowed, bool div = false, bool log = false);
-    void num(double &f);
-    void skip_ws();
-    bool next(char c);
-    bool next_term(const char *str);
-    static bool check_term(char c);
-    void err(const char *msg, const char *pos);
-    void err(const char *msg);
-    void simplify();
-    friend std::ostream& operator<<(std::ostream &os, const expression &ep)
-    {
-        if (!ep.lhs_parsed_expression.empty())
-            os << ep.lhs_parsed_expression << '=';
-        return os << ep.parsed_expression;
-    }
-
-public:
-    double solve();
-
-private:
-    const char *p;
-    expr_t lhs_parsed_expression, parsed_expression;
-    bool x_allowed;
-    char x_name;
-};
-
-
-#endif /* expression_h_ */
+#ifndef expression_h_
+#define expression_h_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <stdexcept>
+#include <ostream>
+#include "tokenizer.h"
+
+
+//  EXPR          ::= PROD+EXPR | PROD-EXPR | PROD             PROD([+\-]PROD)*
+//  PROD          ::= TERM*PROD | TERM/PROD | TERM             TERM([*\/]TERM)*
+//  TERM          ::= -TERM | TERM FUNC | FUNC | NUM           -*(NUM|FUNC)(FUNC)*
+//  FUNC          ::= log(EXPR) | log TERM | x                 \(EXPR\) | log TERM | x
+
+// Parsed expressions live in a node_table: one contiguous array per node kind,
+// nodes reference each other by 32-bit index. Sums and products are singly
+// linked lists threaded through the `next` fields of their elements.
+typedef uint32_t node_id;
+static const node_id no_node = 0xffffffffu;
+
+struct term_t
+{
+    double num_value;
+    node_id expr_value;     // sub-expression; no_node means 1
+    node_id next;
+    bool div, log;
+    char x;
+    uint32_t var;           // variable_table index of x, with set_variables()
+};
+struct prod_t
+{
+    node_id first, last, next;
+    node_id xterm;          // term containing x or no_node
+};
+struct expr_t
+{
+    node_id first, last;
+    uint32_t xprods;        // number of prods containing x
+};
+
+struct node_table
+{
+    std::vector<expr_t> exprs;
+    std::vector<prod_t> prods;
+    std::vector<term_t> terms;
+
+    void clear()
+    {
+        exprs.clear();
+        prods.clear();
+        terms.clear();
+    }
+    void reserve(size_t n)
+    {
+        exprs.reserve(n);
+        prods.reserve(n);
+        terms.reserve(n);
+    }
+    node_id add_expr();
+    node_id add_prod(node_id expr);
+    node_id add_term(node_id prod);
+    void append(node_id expr, node_id prod);
+    void pop_term(node_id prod, node_id prev);
+};
+
+// what went wrong in parsing or solving, error_message() has the text
+enum error_code : uint8_t
+{
+    error_none,
+    error_expected_value,
+    error_unexpected_input,
+    error_expected_paren,
+    error_cannot_parse_number,
+    error_nested_too_deeply,
+    error_division_or_log,
+    error_multiple_variables,
+    error_non_linear,
+    error_missing_x,
+    error_missing_rhs,
+    error_always_true,
+    error_no_solution,
+    error_division_by_0,
+    error_log_domain,
+    error_system_singular,
+    error_system_no_solution,
+    error_expected_definition,
+    error_undefined_variable,
+    error_circular_reference,
+    error_no_root,
+    error_no_convergence,
+    error_tabulate_equation,
+    error_count         // of codes, keep libcalc.h in step
+};
+const char *error_message(error_code code);
+
+// outcome of expression::try_parse and try_solve: the error and its offset
+// in the parsed text, -1 if it has none
+struct expression_status
+{
+    error_code code;
+    int pos;
+    bool ok() const { return code == error_none; }
+    const char *message() const { return error_message(code); }
+};
+
+// Values of the sub-expressions that several terms share (see
+// expression::share_subexpressions), kept for one evaluation: each one and its
+// log are computed once.
+class eval_cache
+{
+public:
+    eval_cache() : generation(1) {}
+    // uses[i]: how many terms refer to expr i
+    void reset(const std::vector<uint32_t> &uses);
+    void clear() { slot.clear(); }
+    bool empty() const { return slot.empty(); }
+    // forgets the values of the previous evaluation
+    void next();
+    bool shared(node_id expr) const { return slot[expr] != no_node; }
+    // value of term without num_value, its expr is shared; its error is
+    // reported at every use
+    double value(const node_table &nodes, const term_t &term, error_code &error);
+
+private:
+    std::vector<uint32_t> slot;     // by expr id, no_node if not shared
+    std::vector<double> values;     // by 2 * slot + log
+    std::vector<error_code> errors; // the first error of computing values[i]
+    std::vector<uint32_t> done;     // values[i] is valid if done[i] == generation
+    uint32_t generation;
+};
+
+// Runtime errors ("division by 0", "log of negative or 0") set error unless
+// it is already set; evaluation goes on, the result is then meaningless.
+// With cache the shared sub-expressions are looked up there.
+double eval(const node_table &nodes, const expr_t &expr, error_code &error, eval_cache *cache = nullptr);
+double eval(const node_table &nodes, const prod_t &prod, error_code &error, eval_cache *cache = nullptr);
+double eval(const node_table &nodes, const term_t &term, error_code &error, eval_cache *cache = nullptr);
+double eval(const char *expr);
+
+// a*x + b, the value of a node of a linear equation as a function of x, in
+// one pass; each part has the first runtime error of computing it, as if it
+// were evaluated on its own
+struct linear
+{
+    double coef, cons;
+    error_code coef_error, cons_error;
+};
+linear eval_linear(const node_table &nodes, const expr_t &expr, eval_cache *cache = nullptr);
+linear eval_linear(const node_table &nodes, const prod_t &prod, eval_cache *cache = nullptr);
+linear eval_linear(const node_table &nodes, const term_t &term, eval_cache *cache = nullptr);
+
+// The steps eval() and eval_linear() fold the nodes with, for an evaluator
+// that walks them its own way (parallel_eval). term_value: a term from the
+// value of its sub-expression, 1 without one. mul_term: a product times (or
+// divided by) one more term of value x. add_prod: a sum plus one more prod,
+// p being its eval_linear(), or for a prod without x {0, value, error_none,
+// error}. add_linear and mul_linear join two sums or products, the errors
+// of a first.
+double term_value(const term_t &term, double inner, error_code &error);
+double mul_term(double ret, const term_t &term, double x, error_code &error);
+linear term_value(const term_t &term, const linear &inner);
+linear mul_term(linear ret, const term_t &term, double x, error_code x_error);
+linear add_prod(linear ret, const node_table &nodes, const prod_t &prod, const linear &p);
+linear add_linear(linear a, const linear &b);
+linear mul_linear(linear a, const linear &b);
+// false if prod is a bare x times constants, which has no constant part
+inline bool has_constant(const node_table &nodes, const prod_t &prod)
+{
+    return prod.xterm == no_node || nodes.terms[prod.xterm].expr_value != no_node;
+}
+
+// Value of a function of x and its derivative at x, both in one pass over the
+// nodes (forward-mode automatic differentiation). Every x counts, wherever
+// it is; errors as with eval().
+struct dual
+{
+    double value, slope;
+};
+dual eval(const node_table &nodes, const expr_t &expr, double x, error_code &error);
+dual eval(const node_table &nodes, const prod_t &prod, double x, error_code &error);
+dual eval(const node_table &nodes, const term_t &term, double x, error_code &error);
+
+// eval() with every variable bound to its value, values[term.var] (see
+// set_variables); errors as with eval()
+double eval(const node_table &nodes, const expr_t &expr, const double *values, error_code &error);
+double eval(const node_table &nodes, const prod_t &prod, const double *values, error_code &error);
+double eval(const node_table &nodes, const term_t &term, const double *values, error_code &error);
+
+// binds a node to its table for operator<<
+template<class T> struct node_ref
+{
+    const node_table &nodes;
+    const T &node;
+};
+template<class T> inline node_ref<T> ref(const node_table &nodes, const T &node)
+{
+    return node_ref<T>{nodes, node};
+}
+std::ostream& operator<<(std::ostream &os, node_ref<expr_t> expr);
+std::ostream& operator<<(std::ostream &os, node_ref<term_t> term);
+std::ostream& operator<<(std::ostream &os, node_ref<prod_t> prod);
+
+
+class expression_error : public std::invalid_argument
+{
+public:
+    explicit expression_error(const char *msg, const char *p) : std::invalid_argument(msg), p(p) {}
+    const char *p;
+};
+
+
+class program;
+class parallel_eval;
+
+// Names of the variables of a system of equations, see set_variables()
+class variable_table
+{
+public:
+    uint32_t add(const char *name, size_t len);
+    size_t size() const { return names.size(); }
+    const std::string &name(uint32_t i) const { return names[i]; }
+    void clear() { ids.clear(); names.clear(); }
+    // forgets the names added after the first n
+    void truncate(size_t n);
+
+private:
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<std::string> names;
+};
+
+// Parser and evaluator keep all state in the object and use no globals:
+// separate expression objects can be used from different threads.
+class expression
+{
+public:
+    // x_free: parse a function of x instead of an expression or a linear
+    // equation; x may appear anywhere, it is bound when evaluated via program
+    explicit expression(const char *expr = nullptr, bool x_free = false) : text(nullptr), error(error_none), decimal_point('.'), max_depth(default_max_depth), vars(nullptr), nonlinear(false), x_nonlinear(false), parallel(nullptr)
+    {
+        nodes.reserve(16);
+        if (expr)
+            parse(expr, x_free);
+    }
+    void parse(const char *expression, bool x_free = false);
+    // parse() and solve() without exceptions, for input that is often invalid.
+    // try_solve() after a failed try_parse() returns the parse error.
+    expression_status try_parse(const char *expression, bool x_free = false);
+    expression_status try_solve(double &value);
+    // decimal mark of numbers in the following parse() calls, '.' or ','
+    void set_decimal_point(char c) { decimal_point = c; }
+    // nesting of parentheses and log arguments deeper than depth is an error.
+    // Parsing does not recurse; evaluation, printing and compiling still take
+    // about 200 bytes of stack per level, the default fits a 1 MB thread stack.
+    void set_max_depth(unsigned depth) { max_depth = depth; }
+    // Parse equations over any number of variables named [A-Za-z][A-Za-z0-9_]*,
+    // added to vars (see linear_system); nullptr goes back to the single
+    // one-letter variable. Printing shows only the first letter of a name.
+    void set_variables(variable_table *vars) { this->vars = vars; }
+    // Let equations in the following parse() calls use x anywhere: "x*x = 2",
+    // "1/x = 4", "log(x) = 1". solve() then looks for a sign change of
+    // lhs - rhs at 0 and at +-2^k, from the smallest double up to the largest,
+    // and narrows it down with Newton steps that stay inside the bracket,
+    // bisecting where they would not. Without a sign change it runs plain
+    // Newton from the sample closest to a root.
+    // Equations that are linear after all are still solved exactly.
+    void set_nonlinear(bool on) { nonlinear = on; }
+    // solve() evaluates with p (nullptr: eval()), see parallel_eval
+    void set_parallel(const parallel_eval *p) { parallel = p; }
+    // Hash-conses the parsed tree: identical sub-expressions (parenthesized
+    // or log arguments) are kept once, the terms that held a copy refer to
+    // it, and solve() computes each one and its log once. Returns the number
+    // of nodes removed. The next parse starts over without sharing. program
+    // and jit_function still compile a shared sub-expression at every use.
+    size_t share_subexpressions();
+    static const unsigned default_max_depth = 4096;
+
+protected:
+    // a pending call of the parser functions, see expr()
+    struct parse_frame
+    {
+        uint8_t state;
+        bool x_allowed, num_allowed, div, log;
+        node_id e, pr, t, prev, sub;
+        const token *tmp;   // a token to back up to
+    };
+    node_id expr(bool x_allowed);
+    void call(uint8_t state, node_id e, node_id pr, bool x_allowed, bool num_allowed = true, bool div = false, bool log = false);
+    bool value(parse_frame &f);
+    bool x_term(const parse_frame &f);
+    bool num(double &f);
+    // the parser reads the text through tokens: the current one starts at
+    // at(), its first character is cur()
+    const char *at() const { return text + tk->pos; }
+    char cur() const { return tk->c; }
+    void skip_ws();
+    bool next(char c);
+    bool next_term(const char *str);
+    static bool check_term(char c);
+    // records the error of the parse; the parser functions then return at once
+    void err(error_code code, const char *pos);
+    void err(error_code code);
+    bool failed() const { return error != error_none; }
+    expression_status status() const;
+    void raise(const expression_status &s) const;
+    friend class program;
+    friend class linear_system;
+    friend class worksheet;
+    friend class stream_eval;
+    friend std::ostream& operator<<(std::ostream &os, const expression &ep)
+    {
+        if (ep.lhs != no_node)
+            os << ref(ep.nodes, ep.nodes.exprs[ep.lhs]) << '=';
+        return os << ref(ep.nodes, ep.nodes.exprs[ep.rhs]);
+    }
+
+public:
+    double solve();
+
+private:
+    const char *text;
+    std::vector<token> tokens;
+    const token *tk;        // the current token
+    error_code error;
+    const char *error_p;
+    node_table nodes;
+    node_id lhs, rhs;
+    bool x_free;
+    char x_name;
+    char decimal_point;
+    unsigned max_depth;
+    std::vector<parse_frame> stack;
+    variable_table *vars;
+    bool nonlinear;
+    bool x_nonlinear;       // the parsed equation needs it
+    const parallel_eval *parallel;
+    eval_cache cache;       // after share_subexpressions()
+};
+
+
+#endif /* expression_h_ */
@@ -0,0 +1,390 @@
+#include "jit.h"
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_X64
+#include <sys/mman.h>
+#endif
+
+
+#ifdef JIT_X64
+namespace {
+
+// log10 through a function of our own: <cmath> overloads it
+double call_log10(double v)
+{
+    return log10(v);
+}
+
+// Stack slot i of the bytecode lives in xmm<i> for the first reg_slots, the
+// rest in the frame at [rsp + 8*i]. xmm12 holds x; xmm14 and xmm15 are scratch.
+// Every slot also has a frame home where registers are saved around calls.
+const int reg_slots = 12, xmm_x = 12, xmm_t1 = 14, xmm_t2 = 15;
+
+enum sse_op : uint8_t
+{
+    sse_load = 0x10,    // movsd xmm, xmm/m64
+    sse_store = 0x11,   // movsd m64, xmm
+    sse_ucomi = 0x2e,   // ucomisd, with the 0x66 prefix
+    sse_add = 0x58,
+    sse_mul = 0x59,
+    sse_sub = 0x5c,
+    sse_div = 0x5e,
+};
+
+class assembler
+{
+public:
+    std::vector<uint8_t> code;
+
+    void byte(uint8_t b) { code.push_back(b); }
+    void dword(uint32_t v)
+    {
+        for (int i = 0; i < 4; ++i)
+            byte((uint8_t)(v >> (8 * i)));
+    }
+    void qword(uint64_t v)
+    {
+        dword((uint32_t)v);
+        dword((uint32_t)(v >> 32));
+    }
+    // op xmm<reg>, xmm<rm>
+    void sse(sse_op op, int reg, int rm)
+    {
+        prefix(op, reg, rm);
+        byte((uint8_t)(0xc0 | (reg & 7) << 3 | (rm & 7)));
+    }
+    // op xmm<reg>, [rsp + disp]
+    void sse_frame(sse_op op, int reg, int32_t disp)
+    {
+        prefix(op, reg, 0);
+        byte((uint8_t)(0x84 | (reg & 7) << 3));
+        byte(0x24);
+        dword((uint32_t)disp);
+    }
+    // op xmm<reg>, [rip + constant i]
+    void sse_const(sse_op op, int reg, size_t i)
+    {
+        prefix(op, reg, 0);
+        byte((uint8_t)(0x05 | (reg & 7) << 3));
+        const_fixups.push_back(fixup{code.size(), i});
+        dword(0);
+    }
+    // j<cc> to the error exit, cc is the low nibble of the 0f 8x opcode
+    void jump_error(uint8_t cc)
+    {
+        byte(0x0f);
+        byte((uint8_t)(0x80 | cc));
+        error_fixups.push_back(code.size());
+        dword(0);
+    }
+    // jp over a following jump_error()
+    void skip_if_unordered()
+    {
+        byte(0x7a);
+        byte(6);
+    }
+    void frame(bool enter, int32_t size)
+    {
+        byte(0x48);             // sub/add rsp, imm32
+        byte(0x81);
+        byte(enter ? 0xec : 0xc4);
+        dword((uint32_t)size);
+    }
+    void call(const void *fn)
+    {
+        byte(0x48);             // mov rax, imm64
+        byte(0xb8);
+        qword((uint64_t)(uintptr_t)fn);
+        byte(0xff);             // call rax
+        byte(0xd0);
+    }
+    void ret() { byte(0xc3); }
+    void error_exit() { error_label = code.size(); }
+    // appends the constant pool and resolves the rip-relative operands
+    void link(const std::vector<double> &consts)
+    {
+        while (code.size() % 8)
+            byte(0xcc);
+        size_t pool = code.size();
+        for (double c : consts)
+        {
+            uint64_t bits;
+            memcpy(&bits, &c, sizeof(bits));
+            qword(bits);
+        }
+        for (const fixup &f : const_fixups)
+            patch(f.pos, pool + 8 * f.index);
+        for (size_t pos : error_fixups)
+            patch(pos, error_label);
+    }
+
+private:
+    struct fixup
+    {
+        size_t pos, index;
+    };
+    void prefix(sse_op op, int reg, int rm)
+    {
+        byte(op == sse_ucomi ? 0x66 : 0xf2);
+        if (reg >= 8 || rm >= 8)
+            byte((uint8_t)(0x40 | (reg >= 8) << 2 | (rm >= 8)));
+        byte(0x0f);
+        byte(op);
+    }
+    // rel32 at pos, relative to the end of the instruction
+    void patch(size_t pos, size_t target)
+    {
+        int32_t rel = (int32_t)(target - (pos + 4));
+        memcpy(&code[pos], &rel, sizeof(rel));
+    }
+    std::vector<fixup> const_fixups;
+    std::vector<size_t> error_fixups;
+    size_t error_label = 0;
+};
+
+// translates the stack machine code; the constant pool is consts followed by
+// 0 and NaN
+class translator
+{
+public:
+    translator(assembler &as, size_t consts, int depth) : as(as), zero(consts), nan(consts + 1), x_home(8 * depth)
+    {
+        // entry rsp is 8 mod 16, calls need it 16-aligned
+        frame_size = 8 * (depth + 1);
+        if (frame_size % 16 == 0)
+            frame_size += 8;
+    }
+    void prologue()
+    {
+        as.frame(true, frame_size);
+        as.sse_frame(sse_store, 0, x_home);
+        as.sse(sse_load, xmm_x, 0);
+    }
+    void epilogue()
+    {
+        if (!in_reg(0))
+            as.sse_frame(sse_load, 0, home(0));
+        as.frame(false, frame_size);
+        as.ret();
+        as.error_exit();
+        as.sse_const(sse_load, 0, nan);
+        as.frame(false, frame_size);
+        as.ret();
+    }
+    void push_const(int t, size_t i)
+    {
+        if (in_reg(t))
+            as.sse_const(sse_load, t, i);
+        else
+        {
+            as.sse_const(sse_load, xmm_t1, i);
+            as.sse_frame(sse_store, xmm_t1, home(t));
+        }
+    }
+    void push_x(int t)
+    {
+        if (in_reg(t))
+            as.sse(sse_load, t, xmm_x);
+        else
+            as.sse_frame(sse_store, xmm_x, home(t));
+    }
+    // slot a = slot a op slot b
+    void binary(sse_op op, int a, int b)
+    {
+        if (op == sse_div)
+        {
+            // division by 0 unless b is NaN
+            int r = load(b, xmm_t2);
+            as.sse_const(sse_ucomi, r, zero);
+            as.skip_if_unordered();
+            as.jump_error(0x4);     // je
+        }
+        int r = in_reg(a) ? a : xmm_t1;
+        if (!in_reg(a))
+            as.sse_frame(sse_load, r, home(a));
+        apply(op, r, b);
+        if (!in_reg(a))
+            as.sse_frame(sse_store, r, home(a));
+    }
+    void log(int t)
+    {
+        int top = t - 1;
+        load_to(top, xmm_t1);
+        // log of negative or 0 unless NaN
+        as.sse_const(sse_ucomi, xmm_t1, zero);
+        as.skip_if_unordered();
+        as.jump_error(0x6);     // jbe
+        // every xmm register is caller-saved
+        int live = top < reg_slots ? top : reg_slots;
+        for (int i = 0; i < live; ++i)
+            as.sse_frame(sse_store, i, home(i));
+        as.sse(sse_load, 0, xmm_t1);
+        as.call((const void*)&call_log10);
+        as.sse(sse_load, xmm_t1, 0);
+        for (int i = 0; i < live; ++i)
+            as.sse_frame(sse_load, i, home(i));
+        as.sse_frame(sse_load, xmm_x, x_home);
+        store_from(top, xmm_t1);
+    }
+    // a, b, c, d in slots t-4..t-1: slot t-4 = (d - b) / (a - c)
+    void solve(int t)
+    {
+        load_to(t - 4, xmm_t1);
+        apply(sse_sub, xmm_t1, t - 2);
+        load_to(t - 1, xmm_t2);
+        apply(sse_sub, xmm_t2, t - 3);
+        as.sse_const(sse_ucomi, xmm_t1, zero);
+        as.skip_if_unordered();
+        as.jump_error(0x4);     // je
+        as.sse(sse_div, xmm_t2, xmm_t1);
+        store_from(t - 4, xmm_t2);
+    }
+
+private:
+    static bool in_reg(int slot) { return slot < reg_slots; }
+    static int32_t home(int slot) { return 8 * slot; }
+    // xmm<r> = xmm<r> op slot
+    void apply(sse_op op, int r, int slot)
+    {
+        if (in_reg(slot))
+            as.sse(op, r, slot);
+        else
+            as.sse_frame(op, r, home(slot));
+    }
+    void load_to(int slot, int r)
+    {
+        apply(sse_load, r, slot);
+    }
+    void store_from(int slot, int r)
+    {
+        if (in_reg(slot))
+            as.sse(sse_load, slot, r);
+        else
+            as.sse_frame(sse_store, r, home(slot));
+    }
+    // register holding slot, loaded into scratch if it is in the frame
+    int load(int slot, int scratch)
+    {
+        if (in_reg(slot))
+            return slot;
+        as.sse_frame(sse_load, scratch, home(slot));
+        return scratch;
+    }
+
+    assembler &as;
+    size_t zero, nan;
+    int32_t x_home, frame_size;
+};
+
+}
+#endif
+
+bool jit_function::available()
+{
+#ifdef JIT_X64
+    return true;
+#else
+    return false;
+#endif
+}
+
+void jit_function::release()
+{
+#ifdef JIT_X64
+    if (mem)
+        munmap(mem, size);
+#endif
+    fn = nullptr;
+    mem = nullptr;
+    size = 0;
+}
+
+void jit_function::compile(expression &e)
+{
+    release();
+    prog.compile(e);
+#ifdef JIT_X64
+    assembler as;
+    translator tr(as, prog.consts.size(), prog.max_depth);
+    tr.prologue();
+    int t = 0;      // values on the stack
+    size_t c = 0;
+    for (uint8_t op : prog.code)
+    {
+        switch (op)
+        {
+        case op_const:
+            tr.push_const(t++, c++);
+            break;
+        case op_x:
+            tr.push_x(t++);
+            break;
+        case op_add:
+            tr.binary(sse_add, t - 2, t - 1);
+            --t;
+            break;
+        case op_mul:
+            tr.binary(sse_mul, t - 2, t - 1);
+            --t;
+            break;
+        case op_div:
+            tr.binary(sse_div, t - 2, t - 1);
+            --t;
+            break;
+        case op_log:
+            tr.log(t);
+            break;
+        case op_solve:
+            tr.solve(t);
+            t -= 3;
+            break;
+        case op_mul2:
+            tr.binary(sse_mul, t - 3, t - 1);
+            tr.binary(sse_mul, t - 2, t - 1);
+            --t;
+            break;
+        case op_div2:
+            tr.binary(sse_div, t - 3, t - 1);
+            tr.binary(sse_div, t - 2, t - 1);
+            --t;
+            break;
+        case op_mulp:
+            tr.binary(sse_mul, t - 4, t - 2);
+            tr.binary(sse_mul, t - 3, t - 1);
+            t -= 2;
+            break;
+        case op_add2:
+            tr.binary(sse_add, t - 4, t - 2);
+            tr.binary(sse_add, t - 3, t - 1);
+            t -= 2;
+            break;
+        case op_addc:
+            tr.binary(sse_add, t - 4, t - 2);
+            t -= 2;
+            break;
+        case op_addk:
+            tr.binary(sse_add, t - 2, t - 1);
+            --t;
+            break;
+        }
+    }
+    assert(t == 1);
+    tr.epilogue();
+    std::vector<double> consts = prog.consts;
+    consts.push_back(0);
+    consts.push_back(NAN);
+    as.link(consts);
+
+    void *p = mmap(nullptr, as.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return;
+    memcpy(p, &as.code[0], as.code.size());
+    if (mprotect(p, as.code.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(p, as.code.size());
+        return;
+    }
+    mem = p;
+    size = as.code.size();
+    fn = (native_fn)p;
+#endif
+}
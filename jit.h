@@ -0,0 +1,54 @@
+#ifndef jit_h_
+#define jit_h_
+
+#include "bytecode.h"
+
+
+// Native x86-64 code for a parsed expression, for formulas evaluated far
+// more often than they are parsed. The bytecode of program is translated op
+// by op into scalar SSE2 code that keeps the stack in xmm registers and calls
+// log10, so the results are bit for bit those of program::run().
+//
+// The native function has no way to throw: on division by 0, log of negative
+// or 0 and an equation without a single solution it returns NaN. run() then
+// repeats the evaluation on the bytecode to raise the same expression_error.
+// Without the JIT (other cpus, Windows, no executable memory) native() is
+// nullptr and run() evaluates the bytecode.
+class jit_function
+{
+public:
+    typedef double (*native_fn)(double x);
+
+    jit_function() : fn(nullptr), mem(nullptr), size(0) {}
+    explicit jit_function(expression &e) : fn(nullptr), mem(nullptr), size(0) { compile(e); }
+    ~jit_function() { release(); }
+    jit_function(const jit_function&) = delete;
+    jit_function &operator=(const jit_function&) = delete;
+
+    void compile(expression &e);
+    // same result and errors as program(e).run(x)
+    double run(double x = 0) const
+    {
+        if (fn)
+        {
+            double res = fn(x);
+            if (res == res)
+                return res;
+        }
+        return prog.run(x);
+    }
+    native_fn native() const { return fn; }
+    // whether this build and os can run generated code
+    static bool available();
+
+private:
+    void release();
+
+    program prog;
+    native_fn fn;
+    void *mem;
+    size_t size;
+};
+
+
+#endif /* jit_h_ */
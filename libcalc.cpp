@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <limits>
+#include "libcalc.h"
+#include "expression.h"
+#include "bytecode.h"
+
+
+// calc_error is error_code as a C enum, with CALC_ERROR_OUT_OF_MEMORY after
+// its codes
+static_assert(CALC_ERROR_NONE == (int)error_none, "");
+static_assert(CALC_ERROR_EXPECTED_VALUE == (int)error_expected_value, "");
+static_assert(CALC_ERROR_UNEXPECTED_INPUT == (int)error_unexpected_input, "");
+static_assert(CALC_ERROR_EXPECTED_PAREN == (int)error_expected_paren, "");
+static_assert(CALC_ERROR_CANNOT_PARSE_NUMBER == (int)error_cannot_parse_number, "");
+static_assert(CALC_ERROR_NESTED_TOO_DEEPLY == (int)error_nested_too_deeply, "");
+static_assert(CALC_ERROR_DIVISION_OR_LOG == (int)error_division_or_log, "");
+static_assert(CALC_ERROR_MULTIPLE_VARIABLES == (int)error_multiple_variables, "");
+static_assert(CALC_ERROR_NON_LINEAR == (int)error_non_linear, "");
+static_assert(CALC_ERROR_MISSING_X == (int)error_missing_x, "");
+static_assert(CALC_ERROR_MISSING_RHS == (int)error_missing_rhs, "");
+static_assert(CALC_ERROR_ALWAYS_TRUE == (int)error_always_true, "");
+static_assert(CALC_ERROR_NO_SOLUTION == (int)error_no_solution, "");
+static_assert(CALC_ERROR_DIVISION_BY_0 == (int)error_division_by_0, "");
+static_assert(CALC_ERROR_LOG_DOMAIN == (int)error_log_domain, "");
+static_assert(CALC_ERROR_SYSTEM_SINGULAR == (int)error_system_singular, "");
+static_assert(CALC_ERROR_SYSTEM_NO_SOLUTION == (int)error_system_no_solution, "");
+static_assert(CALC_ERROR_EXPECTED_DEFINITION == (int)error_expected_definition, "");
+static_assert(CALC_ERROR_UNDEFINED_VARIABLE == (int)error_undefined_variable, "");
+static_assert(CALC_ERROR_CIRCULAR_REFERENCE == (int)error_circular_reference, "");
+static_assert(CALC_ERROR_NO_ROOT == (int)error_no_root, "");
+static_assert(CALC_ERROR_NO_CONVERGENCE == (int)error_no_convergence, "");
+static_assert(CALC_ERROR_TABULATE_EQUATION == (int)error_tabulate_equation, "");
+static_assert(CALC_ERROR_OUT_OF_MEMORY == (int)error_count, "");
+static_assert(CALC_ERROR_COUNT == (int)error_count + 1, "");
+
+struct calc_context
+{
+    expression parser;
+    std::vector<uint8_t> errs;      // of program::run, for calc_tabulate
+};
+
+struct calc_function
+{
+    program prog;
+};
+
+// std::bad_alloc, the only exception that gets this far, does not unwind
+// into C: calls report CALC_ERROR_OUT_OF_MEMORY instead, and
+// calc_context_create() returns NULL.
+calc_context *calc_context_create(void)
+{
+    try
+    {
+        return new calc_context;
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+void calc_context_destroy(calc_context *ctx)
+{
+    delete ctx;
+}
+void calc_set_decimal_point(calc_context *ctx, char c)
+{
+    ctx->parser.set_decimal_point(c);
+}
+
+size_t calc_solve(calc_context *ctx, const char *const *texts, size_t count, double *values, int32_t *codes, int32_t *positions)
+{
+    size_t solved = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        double value = 0;
+        expression_status s;
+        try
+        {
+            s = ctx->parser.try_parse(texts[i]);
+            if (s.ok())
+                s = ctx->parser.try_solve(value);
+        }
+        catch (...)
+        {
+            values[i] = 0;
+            codes[i] = CALC_ERROR_OUT_OF_MEMORY;
+            positions[i] = -1;
+            continue;
+        }
+        values[i] = value;
+        codes[i] = s.code;
+        positions[i] = s.pos;
+        solved += s.ok();
+    }
+    return solved;
+}
+
+calc_function *calc_parse(calc_context *ctx, const char *text, int32_t *code, int32_t *position)
+{
+    calc_function *fn = nullptr;
+    try
+    {
+        expression_status s = ctx->parser.try_parse(text, true);
+        *code = s.code;
+        *position = s.pos;
+        if (!s.ok())
+            return nullptr;
+        fn = new calc_function;
+        fn->prog.compile(ctx->parser);
+        return fn;
+    }
+    catch (...)
+    {
+        delete fn;
+        *code = CALC_ERROR_OUT_OF_MEMORY;
+        *position = -1;
+        return nullptr;
+    }
+}
+void calc_function_destroy(calc_function *fn)
+{
+    delete fn;
+}
+void calc_tabulate(calc_context *ctx, const calc_function *fn, const double *x, double *y, int32_t *codes, size_t count)
+{
+    if (!count)
+        return;
+    try
+    {
+        ctx->errs.resize(count);
+        fn->prog.run(x, y, &ctx->errs[0], count);
+    }
+    catch (...)
+    {
+        std::fill(y, y + count, std::numeric_limits<double>::quiet_NaN());
+        std::fill(codes, codes + count, (int32_t)CALC_ERROR_OUT_OF_MEMORY);
+        return;
+    }
+    for (size_t i = 0; i < count; ++i)
+        codes[i] = ctx->errs[i];
+}
+
+const char *calc_error_message(int32_t code)
+{
+    if (code == CALC_ERROR_OUT_OF_MEMORY)
+        return "out of memory";
+    return code >= 0 && code < CALC_ERROR_OUT_OF_MEMORY ? error_message((error_code)code) : "unknown error";
+}
@@ -0,0 +1,93 @@
+#ifndef libcalc_h_
+#define libcalc_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* C interface of libcalc (make libcalc.a libcalc.so), made for calling from
+ * other languages once per batch of inputs rather than once per expression.
+ *
+ * A calc_context holds a parser and the buffers it reuses; it is used by one
+ * thread at a time, so threads each take their own. Nothing else is shared:
+ * calls on different contexts run in parallel. A calc_function is read only
+ * once parsed, any number of threads can tabulate it at the same time.
+ *
+ * Error codes are a calc_error, CALC_ERROR_NONE (0) if there is none;
+ * calc_error_message() turns them into the text calc prints. Positions are
+ * byte offsets into the text, -1 for errors that have none (such as
+ * "division by 0"). No call lets an exception out: running out of memory is
+ * CALC_ERROR_OUT_OF_MEMORY. */
+#if defined(__GNUC__)
+#define CALC_API __attribute__((visibility("default")))
+#else
+#define CALC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum calc_error
+{
+    CALC_ERROR_NONE,
+    CALC_ERROR_EXPECTED_VALUE,
+    CALC_ERROR_UNEXPECTED_INPUT,
+    CALC_ERROR_EXPECTED_PAREN,
+    CALC_ERROR_CANNOT_PARSE_NUMBER,
+    CALC_ERROR_NESTED_TOO_DEEPLY,
+    CALC_ERROR_DIVISION_OR_LOG,
+    CALC_ERROR_MULTIPLE_VARIABLES,
+    CALC_ERROR_NON_LINEAR,
+    CALC_ERROR_MISSING_X,
+    CALC_ERROR_MISSING_RHS,
+    CALC_ERROR_ALWAYS_TRUE,
+    CALC_ERROR_NO_SOLUTION,
+    CALC_ERROR_DIVISION_BY_0,
+    CALC_ERROR_LOG_DOMAIN,
+    CALC_ERROR_SYSTEM_SINGULAR,
+    CALC_ERROR_SYSTEM_NO_SOLUTION,
+    CALC_ERROR_EXPECTED_DEFINITION,
+    CALC_ERROR_UNDEFINED_VARIABLE,
+    CALC_ERROR_CIRCULAR_REFERENCE,
+    CALC_ERROR_NO_ROOT,
+    CALC_ERROR_NO_CONVERGENCE,
+    CALC_ERROR_TABULATE_EQUATION,
+    CALC_ERROR_OUT_OF_MEMORY,   /* of libcalc only, calc never reports it */
+    CALC_ERROR_COUNT
+} calc_error;
+
+typedef struct calc_context calc_context;
+typedef struct calc_function calc_function;
+
+/* NULL if out of memory */
+CALC_API calc_context *calc_context_create(void);
+CALC_API void calc_context_destroy(calc_context *ctx);
+/* decimal mark of numbers in the following calls, '.' (default) or ',' */
+CALC_API void calc_set_decimal_point(calc_context *ctx, char c);
+
+/* Evaluates texts[0..count), each an expression or a linear equation in x,
+ * as calc does: values[i] is its value or x, codes[i] and positions[i] its
+ * error (values[i] is then 0). Returns the number of texts without error. */
+CALC_API size_t calc_solve(calc_context *ctx, const char *const *texts, size_t count,
+    double *values, int32_t *codes, int32_t *positions);
+
+/* Parses text as a function of x, where x may appear anywhere ("x*x + 1",
+ * "log x"). NULL on an error, which is then stored in *code and *position. */
+CALC_API calc_function *calc_parse(calc_context *ctx, const char *text, int32_t *code, int32_t *position);
+CALC_API void calc_function_destroy(calc_function *fn);
+/* y[i] = fn(x[i]) for i in [0, count), with the SIMD kernels of the bytecode
+ * interpreter. Elements that fail get NaN and CALC_ERROR_DIVISION_BY_0 or
+ * CALC_ERROR_LOG_DOMAIN in codes[i], the others 0. Out of memory, all of
+ * them fail with CALC_ERROR_OUT_OF_MEMORY. */
+CALC_API void calc_tabulate(calc_context *ctx, const calc_function *fn, const double *x, double *y, int32_t *codes, size_t count);
+
+/* "unknown error" for codes outside [0, CALC_ERROR_COUNT) */
+CALC_API const char *calc_error_message(int32_t code);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* libcalc_h_ */
@@ -0,0 +1,605 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "number.h"
+
+
+namespace {
+// Unsigned big integer for the slow path, 32-bit limbs, least significant first.
+struct big
+{
+    std::vector<uint32_t> limbs;
+
+    bool zero() const { return limbs.empty(); }
+    int bits() const
+    {
+        if (limbs.empty())
+            return 0;
+        int n = 32 * (int)(limbs.size() - 1);
+        for (uint32_t top = limbs.back(); top; top >>= 1)
+            ++n;
+        return n;
+    }
+    bool bit(int i) const { return (limbs[i / 32] >> (i % 32)) & 1; }
+    // this = this * m + a
+    void mul_add(uint32_t m, uint32_t a)
+    {
+        uint64_t carry = a;
+        for (auto &l : limbs)
+        {
+            carry += (uint64_t)l * m;
+            l = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry)
+            limbs.push_back((uint32_t)carry);
+    }
+    void shl(int n)
+    {
+        if (limbs.empty() || n == 0)
+            return;
+        limbs.insert(limbs.begin(), n / 32, 0);
+        n %= 32;
+        if (!n)
+            return;
+        uint32_t carry = 0;
+        for (auto &l : limbs)
+        {
+            uint32_t next = l >> (32 - n);
+            l = (l << n) | carry;
+            carry = next;
+        }
+        if (carry)
+            limbs.push_back(carry);
+    }
+    void shr1()
+    {
+        for (size_t i = 0; i < limbs.size(); ++i)
+            limbs[i] = (limbs[i] >> 1) | (i + 1 < limbs.size() ? limbs[i + 1] << 31 : 0);
+        trim();
+    }
+    bool operator>=(const big &b) const
+    {
+        if (limbs.size() != b.limbs.size())
+            return limbs.size() > b.limbs.size();
+        for (size_t i = limbs.size(); i-- > 0;)
+            if (limbs[i] != b.limbs[i])
+                return limbs[i] > b.limbs[i];
+        return true;
+    }
+    // this -= b, this >= b
+    void sub(const big &b)
+    {
+        int64_t borrow = 0;
+        for (size_t i = 0; i < limbs.size(); ++i)
+        {
+            borrow += (int64_t)limbs[i] - (i < b.limbs.size() ? b.limbs[i] : 0);
+            limbs[i] = (uint32_t)borrow;
+            borrow = borrow < 0 ? -1 : 0;
+        }
+        trim();
+    }
+    void trim()
+    {
+        while (!limbs.empty() && !limbs.back())
+            limbs.pop_back();
+    }
+};
+}
+
+static const double pow10_table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+static const uint64_t max_exact = 1ull << 53;
+// decimal digits kept by the slow path; more than the 768 significant digits
+// a halfway point between two doubles can have
+static const int max_digits = 800;
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Rounds (m + sticky * epsilon) * 2^e2 to the nearest double, ties to even.
+static double round_to_double(uint64_t m, int e2, bool sticky)
+{
+    while (!(m >> 63))
+    {
+        m <<= 1;
+        --e2;
+    }
+    // bits below the last mantissa bit: 11 for normal results, more for
+    // subnormals whose last bit is 2^-1074
+    int drop = e2 + 63 < -1022 ? -1074 - e2 : 11;
+    if (drop > 64)
+        return 0;
+    uint64_t res = drop < 64 ? m >> drop : 0;
+    bool round = (m >> (drop - 1)) & 1;
+    bool rest = sticky || (m & ((1ull << (drop - 1)) - 1));
+    if (round && (rest || (res & 1)))
+        ++res;
+    // res <= 2^53 is exact, ldexp overflows to inf
+    return ldexp((double)res, e2 + drop);
+}
+
+// Exact conversion of digits * 10^e10.
+static double slow_path(const big &digits, int e10)
+{
+    big num = digits;
+    if (e10 >= 0)
+    {
+        for (; e10 > 0; --e10)
+            num.mul_add(10, 0);
+        int bits = num.bits(), shift = bits > 64 ? bits - 64 : 0;
+        uint64_t m = 0;
+        for (int i = 63; i >= 0; --i)
+            m = (m << 1) | (shift + i < bits && num.bit(shift + i));
+        bool sticky = false;
+        for (int i = 0; i < shift && !sticky; ++i)
+            sticky = num.bit(i);
+        return round_to_double(m, shift, sticky);
+    }
+    // digits / 10^n = digits / 5^n * 2^-n; the quotient gets 63-64 bits
+    int e2 = e10;
+    big den;
+    den.limbs.push_back(1);
+    for (; e10 < 0; ++e10)
+        den.mul_add(5, 0);
+    int s = den.bits() + 63 - num.bits();
+    if (s > 0)
+        num.shl(s);
+    else
+        den.shl(-s);
+    e2 -= s;
+    int k = num.bits() - den.bits();
+    den.shl(k);
+    uint64_t q = 0;
+    for (int i = k; i >= 0; --i)
+    {
+        if (num >= den)
+        {
+            num.sub(den);
+            q |= 1ull << i;
+        }
+        den.shr1();
+    }
+    return round_to_double(q, e2, !num.zero());
+}
+
+const char *parse_number(const char *s, double &value, char decimal_point)
+{
+    // first pass keeps up to 19 significant digits, enough for the fast path
+    const char *p = s;
+    uint64_t mant = 0;
+    int sig = 0, e10 = 0;
+    bool any = false, truncated = false, frac = false;
+    for (;; ++p)
+    {
+        if (*p == decimal_point && !frac)
+        {
+            frac = true;
+            continue;
+        }
+        if (!is_digit(*p))
+            break;
+        any = true;
+        unsigned d = *p - '0';
+        if (sig == 0 && d == 0)
+            e10 -= frac;
+        else if (sig < 19)
+        {
+            mant = mant * 10 + d;
+            ++sig;
+            e10 -= frac;
+        }
+        else
+        {
+            truncated |= d != 0;
+            e10 += !frac;
+        }
+    }
+    if (!any)
+        return nullptr;
+    const char *mant_end = p;
+    int exp = 0;
+    if (*p == 'e' || *p == 'E')
+    {
+        const char *q = p + 1;
+        bool neg = *q == '-';
+        if (*q == '-' || *q == '+')
+            ++q;
+        if (is_digit(*q))
+        {
+            for (; is_digit(*q); ++q)
+                if (exp < 100000)
+                    exp = exp * 10 + (*q - '0');
+            if (neg)
+                exp = -exp;
+            p = q;
+        }
+    }
+    e10 += exp;
+
+    if (mant == 0)
+    {
+        value = 0;
+        return p;
+    }
+    // fast path: mantissa and power of 10 are exact doubles, one rounding
+    if (!truncated && mant <= max_exact)
+    {
+        double m = (double)mant;
+        if (e10 >= -22 && e10 <= 22)
+        {
+            value = e10 < 0 ? m / pow10_table[-e10] : m * pow10_table[e10];
+            return p;
+        }
+        // 123e25 == 123000e22 as long as the mantissa stays exact
+        if (e10 > 22 && e10 <= 22 + 15)
+        {
+            m *= pow10_table[e10 - 22];
+            if (m <= max_exact)
+            {
+                value = m * pow10_table[22];
+                return p;
+            }
+        }
+    }
+    // exponent of the leading digit: 1e309 overflows, below 1e-325 rounds to 0
+    int lead = sig + e10 - 1;
+    if (lead > 308 || lead < -325)
+    {
+        value = lead > 0 ? HUGE_VAL : 0;
+        return p;
+    }
+
+    // slow path: all digits as a big integer
+    big digits;
+    int e = exp, count = 0;
+    bool dropped = false;
+    frac = false;
+    for (const char *q = s; q < mant_end; ++q)
+    {
+        if (*q == decimal_point)
+        {
+            frac = true;
+            continue;
+        }
+        unsigned d = *q - '0';
+        if (count == 0 && d == 0)
+            e -= frac;
+        else if (count < max_digits)
+        {
+            digits.mul_add(10, d);
+            ++count;
+            e -= frac;
+        }
+        else
+        {
+            dropped |= d != 0;
+            e += !frac;
+        }
+    }
+    // the dropped digits only decide ties: any nonzero digit beyond the last
+    // kept one moves the value off the halfway point
+    if (dropped)
+    {
+        digits.mul_add(10, 1);
+        --e;
+    }
+    value = slow_path(digits, e);
+    return p;
+}
+
+
+namespace {
+// f * 2^e
+struct diy_fp
+{
+    uint64_t f;
+    int e;
+};
+struct cached_power
+{
+    uint64_t f;
+    int16_t e, dec;     // f * 2^e ~ 10^dec
+};
+}
+
+// 10^-348 .. 10^340 in steps of 8, significands rounded to nearest
+static const cached_power cached_powers[] = {
+    {0xfa8fd5a0081c0288ull, -1220, -348},
+    {0xbaaee17fa23ebf76ull, -1193, -340},
+    {0x8b16fb203055ac76ull, -1166, -332},
+    {0xcf42894a5dce35eaull, -1140, -324},
+    {0x9a6bb0aa55653b2dull, -1113, -316},
+    {0xe61acf033d1a45dfull, -1087, -308},
+    {0xab70fe17c79ac6caull, -1060, -300},
+    {0xff77b1fcbebcdc4full, -1034, -292},
+    {0xbe5691ef416bd60cull, -1007, -284},
+    {0x8dd01fad907ffc3cull, -980, -276},
+    {0xd3515c2831559a83ull, -954, -268},
+    {0x9d71ac8fada6c9b5ull, -927, -260},
+    {0xea9c227723ee8bcbull, -901, -252},
+    {0xaecc49914078536dull, -874, -244},
+    {0x823c12795db6ce57ull, -847, -236},
+    {0xc21094364dfb5637ull, -821, -228},
+    {0x9096ea6f3848984full, -794, -220},
+    {0xd77485cb25823ac7ull, -768, -212},
+    {0xa086cfcd97bf97f4ull, -741, -204},
+    {0xef340a98172aace5ull, -715, -196},
+    {0xb23867fb2a35b28eull, -688, -188},
+    {0x84c8d4dfd2c63f3bull, -661, -180},
+    {0xc5dd44271ad3cdbaull, -635, -172},
+    {0x936b9fcebb25c996ull, -608, -164},
+    {0xdbac6c247d62a584ull, -582, -156},
+    {0xa3ab66580d5fdaf6ull, -555, -148},
+    {0xf3e2f893dec3f126ull, -529, -140},
+    {0xb5b5ada8aaff80b8ull, -502, -132},
+    {0x87625f056c7c4a8bull, -475, -124},
+    {0xc9bcff6034c13053ull, -449, -116},
+    {0x964e858c91ba2655ull, -422, -108},
+    {0xdff9772470297ebdull, -396, -100},
+    {0xa6dfbd9fb8e5b88full, -369, -92},
+    {0xf8a95fcf88747d94ull, -343, -84},
+    {0xb94470938fa89bcfull, -316, -76},
+    {0x8a08f0f8bf0f156bull, -289, -68},
+    {0xcdb02555653131b6ull, -263, -60},
+    {0x993fe2c6d07b7facull, -236, -52},
+    {0xe45c10c42a2b3b06ull, -210, -44},
+    {0xaa242499697392d3ull, -183, -36},
+    {0xfd87b5f28300ca0eull, -157, -28},
+    {0xbce5086492111aebull, -130, -20},
+    {0x8cbccc096f5088ccull, -103, -12},
+    {0xd1b71758e219652cull, -77, -4},
+    {0x9c40000000000000ull, -50, 4},
+    {0xe8d4a51000000000ull, -24, 12},
+    {0xad78ebc5ac620000ull, 3, 20},
+    {0x813f3978f8940984ull, 30, 28},
+    {0xc097ce7bc90715b3ull, 56, 36},
+    {0x8f7e32ce7bea5c70ull, 83, 44},
+    {0xd5d238a4abe98068ull, 109, 52},
+    {0x9f4f2726179a2245ull, 136, 60},
+    {0xed63a231d4c4fb27ull, 162, 68},
+    {0xb0de65388cc8ada8ull, 189, 76},
+    {0x83c7088e1aab65dbull, 216, 84},
+    {0xc45d1df942711d9aull, 242, 92},
+    {0x924d692ca61be758ull, 269, 100},
+    {0xda01ee641a708deaull, 295, 108},
+    {0xa26da3999aef774aull, 322, 116},
+    {0xf209787bb47d6b85ull, 348, 124},
+    {0xb454e4a179dd1877ull, 375, 132},
+    {0x865b86925b9bc5c2ull, 402, 140},
+    {0xc83553c5c8965d3dull, 428, 148},
+    {0x952ab45cfa97a0b3ull, 455, 156},
+    {0xde469fbd99a05fe3ull, 481, 164},
+    {0xa59bc234db398c25ull, 508, 172},
+    {0xf6c69a72a3989f5cull, 534, 180},
+    {0xb7dcbf5354e9beceull, 561, 188},
+    {0x88fcf317f22241e2ull, 588, 196},
+    {0xcc20ce9bd35c78a5ull, 614, 204},
+    {0x98165af37b2153dfull, 641, 212},
+    {0xe2a0b5dc971f303aull, 667, 220},
+    {0xa8d9d1535ce3b396ull, 694, 228},
+    {0xfb9b7cd9a4a7443cull, 720, 236},
+    {0xbb764c4ca7a44410ull, 747, 244},
+    {0x8bab8eefb6409c1aull, 774, 252},
+    {0xd01fef10a657842cull, 800, 260},
+    {0x9b10a4e5e9913129ull, 827, 268},
+    {0xe7109bfba19c0c9dull, 853, 276},
+    {0xac2820d9623bf429ull, 880, 284},
+    {0x80444b5e7aa7cf85ull, 907, 292},
+    {0xbf21e44003acdd2dull, 933, 300},
+    {0x8e679c2f5e44ff8full, 960, 308},
+    {0xd433179d9c8cb841ull, 986, 316},
+    {0x9e19db92b4e31ba9ull, 1013, 324},
+    {0xeb96bf6ebadf77d9ull, 1039, 332},
+    {0xaf87023b9bf0ee6bull, 1066, 340},
+};
+
+static diy_fp multiply(diy_fp a, diy_fp b)
+{
+    const uint64_t m32 = 0xffffffffu;
+    uint64_t a_hi = a.f >> 32, a_lo = a.f & m32, b_hi = b.f >> 32, b_lo = b.f & m32;
+    uint64_t ac = a_hi * b_hi, bc = a_lo * b_hi, ad = a_hi * b_lo, bd = a_lo * b_lo;
+    uint64_t mid = (bd >> 32) + (ad & m32) + (bc & m32) + (1u << 31);
+    return diy_fp{ac + (ad >> 32) + (bc >> 32) + (mid >> 32), a.e + b.e + 64};
+}
+static diy_fp normalize(diy_fp v)
+{
+    while (!(v.f >> 63))
+    {
+        v.f <<= 1;
+        --v.e;
+    }
+    return v;
+}
+
+// Moves the last digit of buf towards w and checks that the result is the
+// closest shortest representation (round_weed of Grisu3). All distances are
+// scaled by 2^-e; unit is the uncertainty of the scaled values.
+static bool round_weed(char *buf, int len, uint64_t too_high_w, uint64_t unsafe, uint64_t rest, uint64_t ten_kappa, uint64_t unit)
+{
+    uint64_t small = too_high_w - unit, large = too_high_w + unit;
+    while (rest < small && unsafe - rest >= ten_kappa &&
+        (rest + ten_kappa < small || small - rest >= rest + ten_kappa - small))
+    {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+    if (rest < large && unsafe - rest >= ten_kappa &&
+        (rest + ten_kappa < large || large - rest > rest + ten_kappa - large))
+        return false;
+    return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+// Grisu3: shortest digits of v (finite, > 0) with v ~ digits * 10^exp10.
+// Returns false for the ~0.5% of values it cannot decide.
+static bool grisu3(double v, char *buf, int &len, int &exp10)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    uint64_t frac = bits & ((1ull << 52) - 1);
+    int be = (int)(bits >> 52);
+    diy_fp d = be ? diy_fp{frac | (1ull << 52), be - 1075} : diy_fp{frac, -1074};
+    diy_fp w = normalize(d);
+    // boundaries halfway to the neighbours, the lower one is closer at a power of 2
+    diy_fp plus = normalize(diy_fp{(d.f << 1) + 1, d.e - 1});
+    diy_fp minus = frac == 0 && be > 1 ? diy_fp{(d.f << 2) - 1, d.e - 2} : diy_fp{(d.f << 1) - 1, d.e - 1};
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    // cached power that brings the exponent of w * c into [-60, -32]
+    int i = (int)ceil((-60 - (w.e + 64) + 63) * 0.30102999566398114);
+    i = (i + 348 - 1) / 8 + 1;
+    while (i > 0 && w.e + cached_powers[i].e + 64 > -32)
+        --i;
+    while (w.e + cached_powers[i].e + 64 < -60)
+        ++i;
+    const cached_power &cp = cached_powers[i];
+    diy_fp c = {cp.f, cp.e};
+    diy_fp sw = multiply(w, c), sminus = multiply(minus, c), splus = multiply(plus, c);
+
+    // digit generation from the upper bound, each product is off by < 1 unit
+    uint64_t unit = 1;
+    uint64_t too_low = sminus.f - unit, too_high = splus.f + unit;
+    uint64_t unsafe = too_high - too_low;
+    int shift = -sw.e;
+    uint64_t one = 1ull << shift;
+    uint32_t integrals = (uint32_t)(too_high >> shift);
+    uint64_t fractionals = too_high & (one - 1);
+    uint32_t divisor = 1;
+    int kappa = 0;
+    while (integrals / divisor >= 10)
+    {
+        divisor *= 10;
+        ++kappa;
+    }
+    ++kappa;
+    len = 0;
+    while (kappa > 0)
+    {
+        buf[len++] = (char)('0' + integrals / divisor);
+        integrals %= divisor;
+        --kappa;
+        uint64_t rest = ((uint64_t)integrals << shift) + fractionals;
+        if (rest < unsafe)
+        {
+            exp10 = kappa - cp.dec;
+            return round_weed(buf, len, too_high - sw.f, unsafe, rest, (uint64_t)divisor << shift, unit);
+        }
+        divisor /= 10;
+    }
+    for (;;)
+    {
+        fractionals *= 10;
+        unit *= 10;
+        unsafe *= 10;
+        buf[len++] = (char)('0' + (fractionals >> shift));
+        fractionals &= one - 1;
+        --kappa;
+        if (fractionals < unsafe)
+        {
+            exp10 = kappa - cp.dec;
+            return round_weed(buf, len, (too_high - sw.f) * unit, unsafe, fractionals, one, unit);
+        }
+    }
+}
+
+// Exact fallback: the shortest correctly rounded precision that parses back.
+static void shortest_exact(double v, char *buf, int &len, int &exp10)
+{
+    char str[40];
+    for (int prec = 0; prec < 17; ++prec)
+    {
+        snprintf(str, sizeof(str), "%.*e", prec, v);
+        // digits, a locale dependent decimal mark, then "e[+-]dd"
+        const char *s = str;
+        len = 0;
+        for (; *s != 'e'; ++s)
+            if (*s >= '0' && *s <= '9')
+                buf[len++] = *s;
+        exp10 = atoi(s + 1) - (len - 1);
+        double back;
+        char text[40];
+        memcpy(text, buf, len);
+        snprintf(text + len, sizeof(text) - len, "e%d", exp10);
+        if (parse_number(text, back) && back == v)
+            break;
+    }
+    while (len > 1 && buf[len - 1] == '0')
+    {
+        --len;
+        ++exp10;
+    }
+}
+
+int format_number(double value, char *buf, char decimal_point)
+{
+    char *p = buf;
+    if (signbit(value))
+    {
+        *p++ = '-';
+        value = -value;
+    }
+    if (value != value || value == HUGE_VAL)
+    {
+        memcpy(p, value == HUGE_VAL ? "inf" : "nan", 4);
+        return (int)(p + 3 - buf);
+    }
+    if (value == 0)
+    {
+        memcpy(p, "0", 2);
+        return (int)(p + 1 - buf);
+    }
+    char digits[20];
+    int len, exp10;
+    if (!grisu3(value, digits, len, exp10))
+        shortest_exact(value, digits, len, exp10);
+
+    // %.17g layout: fixed notation for leading digit exponents -4 .. 16
+    int lead = len + exp10 - 1;
+    if (lead < -4 || lead > 16)
+    {
+        *p++ = digits[0];
+        if (len > 1)
+        {
+            *p++ = decimal_point;
+            memcpy(p, digits + 1, len - 1);
+            p += len - 1;
+        }
+        *p++ = 'e';
+        *p++ = lead < 0 ? '-' : '+';
+        int e = lead < 0 ? -lead : lead;
+        if (e >= 100)
+            *p++ = (char)('0' + e / 100);
+        *p++ = (char)('0' + e / 10 % 10);
+        *p++ = (char)('0' + e % 10);
+    }
+    else if (lead < 0)
+    {
+        *p++ = '0';
+        *p++ = decimal_point;
+        for (int i = lead + 1; i < 0; ++i)
+            *p++ = '0';
+        memcpy(p, digits, len);
+        p += len;
+    }
+    else
+    {
+        for (int i = 0; i <= lead; ++i)
+            *p++ = i < len ? digits[i] : '0';
+        if (len > lead + 1)
+        {
+            *p++ = decimal_point;
+            memcpy(p, digits + lead + 1, len - lead - 1);
+            p += len - lead - 1;
+        }
+    }
+    *p = '\0';
+    return (int)(p - buf);
+}
@@ -0,0 +1,23 @@
+#ifndef number_h_
+#define number_h_
+
+#include <stddef.h>
+
+
+// Parses a decimal number at s: digits with an optional decimal_point and
+// fraction ("12", "1.", ".5"), optionally followed by an exponent ("0.001e10",
+// "1E-3"). An 'e' without exponent digits is not part of the number. The
+// result is correctly rounded (overflow gives inf) and does not depend on the
+// C locale. Returns the end of the number, or nullptr if s has no digits.
+const char *parse_number(const char *s, double &value, char decimal_point = '.');
+
+// buffer size format_number needs, the longest text is "-2.2250738585072014e-308"
+static const size_t number_buffer_size = 32;
+
+// Writes the shortest text that parse_number reads back as exactly value,
+// laid out like "%.17g" ("0.1", "1e+100", "-0", "inf", "nan"). buf needs
+// number_buffer_size chars; returns the length without the terminating NUL.
+int format_number(double value, char *buf, char decimal_point = '.');
+
+
+#endif /* number_h_ */
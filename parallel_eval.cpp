@@ -0,0 +1,170 @@
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include "parallel_eval.h"
+#include "stats.h"
+
+
+namespace {
+// A job evaluates its run without a pool: a huge list nested in it is cut
+// the same way but its runs stay on the thread of the job.
+struct context
+{
+    thread_pool *pool;
+    size_t chunk;
+};
+}
+
+// The runs of a long list after the first one, from i on: each run folded
+// from init on its own, the results folded into ret in order with combine.
+// Every run is a job on c.pool, submitted as soon as the walk down the list
+// reaches it.
+template<class T, class Next, class Step, class Combine>
+static T fold_runs(const context &c, node_id i, T init, T ret, Next next, Step step, Combine combine, error_code &error)
+{
+    struct run
+    {
+        node_id first;
+        T result;
+        error_code error;
+    };
+    std::vector<std::unique_ptr<run>> runs;
+    std::mutex m;
+    std::condition_variable cv;
+    size_t left = 0;
+    const context inner = {nullptr, c.chunk};
+    auto fold = [&](run &r)
+    {
+        node_id j = r.first;
+        for (size_t n = 0; n < c.chunk && j != no_node; ++n, j = next(j))
+            r.result = step(inner, j, r.result, r.error);
+    };
+    for (size_t n = 0; i != no_node; i = next(i))
+    {
+        if (n++ % c.chunk)
+            continue;
+        runs.emplace_back(new run{i, init, error_none});
+        run *r = runs.back().get();
+        if (!c.pool)
+            continue;
+        {
+            std::lock_guard<std::mutex> lock(m);
+            ++left;
+        }
+        c.pool->submit([&, r]
+        {
+            fold(*r);
+            std::lock_guard<std::mutex> lock(m);
+            if (--left == 0)
+                cv.notify_one();
+        });
+    }
+    if (c.pool)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&] { return left == 0; });
+    }
+    else
+        for (auto &r : runs)
+            fold(*r);
+    for (auto &r : runs)
+    {
+        ret = combine(ret, r->result);
+        if (!error)
+            error = r->error;
+    }
+    return ret;
+}
+// Folds the items of a list, from first on, into init with ret = step(c, i,
+// ret, error) as eval() does; a linear carries its own errors and leaves
+// error alone. A list of more than c.chunk items is cut into
+// runs of c.chunk: the first run is the one folded while looking for the
+// end of a short list, fold_runs() does the others.
+template<class T, class Next, class Step, class Combine>
+static T reduce(const context &c, node_id first, T init, Next next, Step step, Combine combine, error_code &error)
+{
+    T ret = init;
+    node_id i = first;
+    for (size_t n = 0; i != no_node && n < c.chunk; ++n, i = next(i))
+        ret = step(c, i, ret, error);
+    if (i == no_node)
+        return ret;
+    return fold_runs(c, i, init, combine(init, ret), next, step, combine, error);
+}
+
+// The eval() and eval_linear() overloads of expression.cpp, with their steps.
+static double eval(const context &c, const node_table &nodes, const expr_t &expr, error_code &error);
+static double eval(const context &c, const node_table &nodes, const term_t &term, error_code &error)
+{
+    double inner = term.expr_value == no_node ? 1 : eval(c, nodes, nodes.exprs[term.expr_value], error);
+    return term_value(term, inner, error);
+}
+static double eval(const context &c, const node_table &nodes, const prod_t &prod, error_code &error)
+{
+    auto next = [&](node_id i) { return nodes.terms[i].next; };
+    auto step = [&](const context &in, node_id i, double ret, error_code &error)
+    {
+        const term_t &term = nodes.terms[i];
+        return mul_term(ret, term, eval(in, nodes, term, error), error);
+    };
+    return reduce(c, prod.first, 1.0, next, step, [](double a, double b) { return a * b; }, error);
+}
+static double eval(const context &c, const node_table &nodes, const expr_t &expr, error_code &error)
+{
+    auto next = [&](node_id i) { return nodes.prods[i].next; };
+    auto step = [&](const context &in, node_id i, double ret, error_code &error)
+    {
+        return ret + eval(in, nodes, nodes.prods[i], error);
+    };
+    return reduce(c, expr.first, 0.0, next, step, [](double a, double b) { return a + b; }, error);
+}
+
+static linear eval_linear(const context &c, const node_table &nodes, const expr_t &expr);
+static linear eval_linear(const context &c, const node_table &nodes, const term_t &term)
+{
+    const linear one = {1, 1, error_none, error_none};
+    return term_value(term, term.expr_value == no_node ? one : eval_linear(c, nodes, nodes.exprs[term.expr_value]));
+}
+static linear eval_linear(const context &c, const node_table &nodes, const prod_t &prod)
+{
+    auto next = [&](node_id i) { return nodes.terms[i].next; };
+    auto step = [&](const context &in, node_id i, linear ret, error_code &)
+    {
+        const term_t &term = nodes.terms[i];
+        if (i == prod.xterm)
+            return mul_linear(ret, eval_linear(in, nodes, term));
+        error_code error = error_none;
+        double x = eval(in, nodes, term, error);
+        return mul_term(ret, term, x, error);
+    };
+    error_code unused = error_none;
+    return reduce(c, prod.first, linear{1, 1, error_none, error_none}, next, step, mul_linear, unused);
+}
+static linear eval_linear(const context &c, const node_table &nodes, const expr_t &expr)
+{
+    auto next = [&](node_id i) { return nodes.prods[i].next; };
+    auto step = [&](const context &in, node_id i, linear ret, error_code &)
+    {
+        const prod_t &prod = nodes.prods[i];
+        if (prod.xterm != no_node)
+            return add_prod(ret, nodes, prod, eval_linear(in, nodes, prod));
+        linear p = {0, 0, error_none, error_none};
+        p.cons = eval(in, nodes, prod, p.cons_error);
+        return add_prod(ret, nodes, prod, p);
+    };
+    error_code unused = error_none;
+    return reduce(c, expr.first, linear{0, 0, error_none, error_none}, next, step, add_linear, unused);
+}
+
+double parallel_eval::eval(const node_table &nodes, const expr_t &expr, error_code &error) const
+{
+    STAT_SCOPE(phase_eval);
+    const context c = {&pool, chunk};
+    return ::eval(c, nodes, expr, error);
+}
+linear parallel_eval::eval_linear(const node_table &nodes, const expr_t &expr) const
+{
+    STAT_SCOPE(phase_eval);
+    const context c = {&pool, chunk};
+    return ::eval_linear(c, nodes, expr);
+}
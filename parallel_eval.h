@@ -0,0 +1,31 @@
+#ifndef parallel_eval_h_
+#define parallel_eval_h_
+
+#include "expression.h"
+#include "thread_pool.h"
+
+
+// eval() and eval_linear() for expressions with huge sums or products. A sum
+// of more than chunk prods, or a product of more than chunk terms, is cut into
+// runs of chunk items; every run is evaluated as eval() would, the runs as jobs on pool,
+// and their results are then added (multiplied) in order. The grouping only
+// depends on chunk, so the result has the same bits with any number of
+// threads, one included. It can differ from eval() in the last bits.
+//
+// Errors are the ones eval() reports first. Shared sub-expressions (see
+// expression::share_subexpressions) are computed at every use. Must not be
+// called from a job of pool: it waits for the jobs it submits.
+class parallel_eval
+{
+public:
+    explicit parallel_eval(thread_pool &pool, size_t chunk = 1 << 14) : pool(pool), chunk(chunk) {}
+    double eval(const node_table &nodes, const expr_t &expr, error_code &error) const;
+    linear eval_linear(const node_table &nodes, const expr_t &expr) const;
+
+private:
+    thread_pool &pool;
+    size_t chunk;
+};
+
+
+#endif /* parallel_eval_h_ */
@@ -0,0 +1,239 @@
+#include "program_file.h"
+#include <algorithm>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PROGRAM_FILE_MMAP
+#endif
+
+
+static const char program_file_magic[8] = "calcprg";
+static const uint32_t byte_order_mark = 0x01020304;
+
+static size_t words(size_t bytes)
+{
+    return (bytes + 7) / 8;
+}
+
+void program_file_writer::add(const program &p)
+{
+    program_view v = p.view();
+    program_record r = {v.code_size, v.const_count, (uint32_t)v.max_depth, 0};
+    std::vector<uint64_t> rec(words(sizeof(r)) + v.const_count + words(v.code_size));
+    uint8_t *out = (uint8_t*)&rec[0];
+    memcpy(out, &r, sizeof(r));
+    out += sizeof(r);
+    memcpy(out, v.consts, 8 * v.const_count);
+    out += 8 * v.const_count;
+    memcpy(out, v.code, v.code_size);
+    programs.push_back(rec);
+}
+std::vector<uint64_t> program_file_writer::image() const
+{
+    size_t size = words(sizeof(program_file_header)) + programs.size();
+    for (const std::vector<uint64_t> &rec : programs)
+        size += rec.size();
+    std::vector<uint64_t> img(size);
+    program_file_header h;
+    memcpy(h.magic, program_file_magic, sizeof(h.magic));
+    h.version = program_file_version;
+    h.byte_order = byte_order_mark;
+    h.count = programs.size();
+    h.size = 8 * size;
+    memcpy(&img[0], &h, sizeof(h));
+    uint64_t *offsets = &img[words(sizeof(h))];
+    size_t pos = words(sizeof(h)) + programs.size();
+    for (size_t i = 0; i < programs.size(); ++i)
+    {
+        offsets[i] = 8 * pos;
+        std::copy(programs[i].begin(), programs[i].end(), img.begin() + pos);
+        pos += programs[i].size();
+    }
+    return img;
+}
+bool program_file_writer::save(const char *path) const
+{
+    std::vector<uint64_t> img = image();
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    bool ok = fwrite(&img[0], 8, img.size(), f) == img.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok)
+        fprintf(stderr, "cannot write %s\n", path);
+    return ok;
+}
+
+// whether the code is a well-formed program for program_view::run(): known
+// opcodes, no stack underflow, max_depth and const_count as declared, one
+// value left
+static bool check_code(const program_view &v)
+{
+    int depth = 0;
+    uint32_t consts = 0;
+    for (uint32_t i = 0; i < v.code_size; ++i)
+    {
+        switch (v.code[i])
+        {
+        case op_const:
+            ++consts;
+            ++depth;
+            break;
+        case op_x:
+            ++depth;
+            break;
+        case op_add:
+        case op_mul:
+        case op_div:
+            if (depth < 2)
+                return false;
+            --depth;
+            break;
+        case op_log:
+            if (depth < 1)
+                return false;
+            break;
+        case op_solve:
+            if (depth < 4)
+                return false;
+            depth -= 3;
+            break;
+        case op_mul2:
+        case op_div2:
+        case op_addk:
+            if (depth < 3)
+                return false;
+            --depth;
+            break;
+        case op_mulp:
+        case op_add2:
+        case op_addc:
+            if (depth < 4)
+                return false;
+            depth -= 2;
+            break;
+        default:
+            return false;
+        }
+        if (depth > v.max_depth)
+            return false;
+    }
+    return depth == 1 && consts == v.const_count;
+}
+
+bool program_file::open(const char *path)
+{
+    close();
+#ifdef PROGRAM_FILE_MMAP
+    int fd = ::open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    void *p = st.st_size ? mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        fprintf(stderr, "cannot map %s\n", path);
+        return false;
+    }
+    data = (const uint8_t*)p;
+    data_size = (size_t)st.st_size;
+    mapped = true;
+#else
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    uint64_t chunk[4096];
+    size_t bytes = 0;
+    for (size_t n; (n = fread(chunk, 1, sizeof(chunk), f)) > 0; bytes += n)
+    {
+        buf.resize(words(bytes + n));
+        memcpy((uint8_t*)&buf[0] + bytes, chunk, n);
+    }
+    fclose(f);
+    data = buf.empty() ? nullptr : (const uint8_t*)&buf[0];
+    data_size = bytes;
+#endif
+    if (const char *msg = check())
+    {
+        fprintf(stderr, "%s: %s\n", path, msg);
+        close();
+        return false;
+    }
+    return true;
+}
+bool program_file::attach(const void *data, size_t size)
+{
+    close();
+    this->data = (const uint8_t*)data;
+    data_size = size;
+    if (check())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+void program_file::close()
+{
+#ifdef PROGRAM_FILE_MMAP
+    if (mapped)
+        munmap((void*)data, data_size);
+#endif
+    data = nullptr;
+    data_size = 0;
+    mapped = false;
+    buf.clear();
+    views.clear();
+}
+// validates data and fills views; returns what is wrong or nullptr
+const char *program_file::check()
+{
+    program_file_header h;
+    if (data_size < sizeof(h) || (uintptr_t)data % 8)
+        return "not a calc program file";
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, program_file_magic, sizeof(h.magic)))
+        return "not a calc program file";
+    if (h.byte_order != byte_order_mark)
+        return "program file of another byte order";
+    if (h.version != program_file_version)
+        return "unsupported program file version";
+    if (h.size != data_size || h.count > (data_size - sizeof(h)) / 8)
+        return "truncated program file";
+    const uint64_t *offsets = (const uint64_t*)(data + sizeof(h));
+    views.resize((size_t)h.count);
+    for (size_t i = 0; i < views.size(); ++i)
+    {
+        uint64_t off = offsets[i];
+        program_record r;
+        if (off % 8 || off < sizeof(h) + 8 * h.count || off > data_size - sizeof(r))
+            return "bad program offset";
+        memcpy(&r, data + off, sizeof(r));
+        uint64_t end = off + sizeof(r) + 8ull * r.const_count + r.code_size;
+        if (end > data_size)
+            return "truncated program file";
+        program_view &v = views[i];
+        v.consts = (const double*)(data + off + sizeof(r));
+        v.code = data + off + sizeof(r) + 8 * (size_t)r.const_count;
+        v.code_size = r.code_size;
+        v.const_count = r.const_count;
+        v.max_depth = (int)std::min(r.max_depth, r.code_size);
+        if (!check_code(v))
+            return "bad program code";
+    }
+    return nullptr;
+}
@@ -0,0 +1,82 @@
+#ifndef program_file_h_
+#define program_file_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "bytecode.h"
+
+
+// Binary file of compiled programs: a formula library is compiled once, then
+// mapped read-only at startup and run in place, nothing is parsed or copied.
+//
+//   header     program_file_header
+//   offsets    uint64_t[count], file offset of each record
+//   records    program_record, const_count doubles, code_size opcodes,
+//              zero padding to a multiple of 8
+//
+// Integers and doubles are in the byte order of the writer; a file from a
+// machine of the other order is rejected. Every part starts 8-aligned.
+static const uint32_t program_file_version = 1;
+
+struct program_file_header
+{
+    char magic[8];          // "calcprg" and NUL
+    uint32_t version;       // program_file_version
+    uint32_t byte_order;    // 0x01020304 as written
+    uint64_t count;         // programs in the file
+    uint64_t size;          // bytes of the whole file
+};
+struct program_record
+{
+    uint32_t code_size, const_count;
+    uint32_t max_depth, reserved;
+};
+
+// builds a program file in memory
+class program_file_writer
+{
+public:
+    program_file_writer() {}
+    void add(const program &p);
+    size_t size() const { return programs.size(); }
+    // the file image, 8-aligned like the mapped file
+    std::vector<uint64_t> image() const;
+    bool save(const char *path) const;
+
+private:
+    std::vector<std::vector<uint64_t>> programs;    // record, constants and code of each
+};
+
+// Programs of a file mapped (or read, where there is no mmap) by open(), or of
+// an image in memory given to attach(). Both check the whole file: the opcodes,
+// stack depths and constants of every record, so a bad file cannot make
+// run() read out of bounds.
+class program_file
+{
+public:
+    program_file() : data(nullptr), data_size(0), mapped(false) {}
+    ~program_file() { close(); }
+    program_file(const program_file&) = delete;
+    program_file &operator=(const program_file&) = delete;
+
+    // false, with a message on stderr, if the file cannot be read or is invalid
+    bool open(const char *path);
+    // data must be 8-aligned and outlive the object; false if it is invalid
+    bool attach(const void *data, size_t size);
+    void close();
+    size_t size() const { return views.size(); }
+    const program_view &operator[](size_t i) const { return views[i]; }
+
+private:
+    const char *check();
+
+    const uint8_t *data;
+    size_t data_size;
+    bool mapped;
+    std::vector<uint64_t> buf;      // file contents without mmap
+    std::vector<program_view> views;
+};
+
+
+#endif /* program_file_h_ */
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include "result_cache.h"
+#include "number.h"
+
+
+static bool is_letter(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// Builds the key of line: the tokens without blanks. A name is followed by
+// ' ' if it ends there for the parser (see expression::check_term) or by '_'
+// if the next character continues it ("x1", "x_"); a number is '\0' and the 8
+// bytes of its value. Only these bytes follow a name or a '\0'.
+void result_cache::tokenize(const char *line)
+{
+    key.clear();
+    starts.clear();
+    ends.clear();
+    const char *s = line;
+    while (*s)
+    {
+        if (*s == ' ' || *s == '\t')
+        {
+            ++s;
+            continue;
+        }
+        const char *start = s;
+        double value;
+        const char *end;
+        if (is_letter(*s))
+        {
+            while (is_letter(*s))
+                ++s;
+            key.append(start, s);
+            key += *s == '0' || *s == '1' || *s == '_' ? '_' : ' ';
+        }
+        else if (((*s >= '0' && *s <= '9') || *s == decimal_point) && (end = parse_number(s, value, decimal_point)))
+        {
+            key += '\0';
+            key.append((const char*)&value, sizeof(value));
+            s = end;
+        }
+        else
+            key += *s++;
+        starts.push_back((int)(start - line));
+        ends.push_back((int)(s - line));
+    }
+    // the end of the line is an empty last token
+    starts.push_back((int)(s - line));
+    ends.push_back((int)(s - line));
+}
+
+// position of the error of e in the current line, false if the tokens do not
+// tell it: the error was right between two tokens that now have blanks between them
+bool result_cache::position(const entry &e, int &pos) const
+{
+    switch (e.kind)
+    {
+    case pos_none:
+        pos = -1;
+        return true;
+    case pos_start:
+        pos = starts[e.pos_token];
+        return true;
+    case pos_end:
+        pos = ends[e.pos_token - 1];
+        return true;
+    case pos_boundary:
+        pos = starts[e.pos_token];
+        return ends[e.pos_token - 1] == pos;
+    }
+    return false;
+}
+// stores pos of the current line in e, false if it is not at a token boundary
+bool result_cache::set_position(entry &e, int pos) const
+{
+    e.kind = pos_none;
+    if (pos < 0)
+        return true;
+    size_t i = std::lower_bound(starts.begin(), starts.end(), pos) - starts.begin();
+    bool at_start = i < starts.size() && starts[i] == pos;
+    bool at_end = i > 0 && ends[i - 1] == pos;
+    if (!at_start && !at_end)
+        return false;
+    e.kind = at_start && at_end ? pos_boundary : at_start ? pos_start : pos_end;
+    e.pos_token = (uint32_t)i;
+    return true;
+}
+
+expression_status result_cache::eval(const char *line, double &value)
+{
+    tokenize(line);
+    auto it = entries.find(key);
+    expression_status res;
+    if (it != entries.end() && position(it->second, res.pos))
+    {
+        ++hit_count;
+        lru.splice(lru.begin(), lru, it->second.lru);
+        value = it->second.value;
+        res.code = it->second.error;
+        return res;
+    }
+    ++miss_count;
+    res = parser.try_parse(line);
+    if (res.ok())
+        res = parser.try_solve(value);
+    else
+        value = 0;
+    if (!capacity)
+        return res;
+    if (it == entries.end())
+    {
+        it = entries.emplace(key, entry()).first;
+        lru.push_front(&it->first);
+        it->second.lru = lru.begin();
+    }
+    else
+        lru.splice(lru.begin(), lru, it->second.lru);
+    entry &e = it->second;
+    e.value = value;
+    e.error = res.code;
+    if (!set_position(e, res.pos))
+    {
+        lru.erase(e.lru);
+        entries.erase(it);
+    }
+    while (entries.size() > capacity)
+    {
+        entries.erase(entries.find(*lru.back()));
+        lru.pop_back();
+    }
+    return res;
+}
+
+void result_cache::set_decimal_point(char c)
+{
+    decimal_point = c;
+    parser.set_decimal_point(c);
+    clear();
+}
+void result_cache::set_nonlinear(bool on)
+{
+    parser.set_nonlinear(on);
+    clear();
+}
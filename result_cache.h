@@ -0,0 +1,62 @@
+#ifndef result_cache_h_
+#define result_cache_h_
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "expression.h"
+
+
+// Bounded LRU cache of line results. Lines are keyed by their token stream
+// without blanks, numbers by their value, so "2x+1 = 0.50" and "2x + 1=.5"
+// share an entry. Errors are cached too, with the position kept relative to
+// the tokens.
+class result_cache
+{
+public:
+    explicit result_cache(size_t capacity = 4096) : capacity(capacity), hit_count(0), miss_count(0), decimal_point('.') {}
+    // try_parse(line) and try_solve(value) of an expression
+    expression_status eval(const char *line, double &value);
+    void set_decimal_point(char c);
+    // see expression::set_nonlinear()
+    void set_nonlinear(bool on);
+    // see expression::set_parallel()
+    void set_parallel(const parallel_eval *p) { parser.set_parallel(p); }
+    void clear() { entries.clear(); lru.clear(); }
+    size_t size() const { return entries.size(); }
+    size_t hits() const { return hit_count; }
+    size_t misses() const { return miss_count; }
+
+private:
+    enum pos_kind : uint8_t
+    {
+        pos_none,
+        pos_start,          // start of token pos_token
+        pos_end,            // end of token pos_token - 1
+        pos_boundary,       // both, there were no blanks between them
+    };
+    struct entry
+    {
+        double value;
+        error_code error;
+        pos_kind kind;
+        uint32_t pos_token;
+        std::list<const std::string*>::iterator lru;
+    };
+    void tokenize(const char *line);
+    bool position(const entry &e, int &pos) const;
+    bool set_position(entry &e, int pos) const;
+
+    size_t capacity, hit_count, miss_count;
+    char decimal_point;
+    expression parser;
+    std::unordered_map<std::string, entry> entries;
+    std::list<const std::string*> lru;     // keys of entries, most recent first
+    // key, start and end offsets of the tokens of the current line
+    std::string key;
+    std::vector<int> starts, ends;
+};
+
+
+#endif /* result_cache_h_ */
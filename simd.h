@@ -0,0 +1,109 @@
+#ifndef simd_h_
+#define simd_h_
+
+#include <math.h>
+#include "batch.h"
+#include "expression.h"
+
+
+// Batch kernels written once against a vector traits class V, which wraps
+// one instruction set (see batch.cpp and batch_avx2.cpp):
+//   reg, ireg, width         double and 64-bit integer vectors, lanes
+//   load, store, set1, zero
+//   add, sub, mul, div
+//   eq, ne, lt, le           lane masks; ne is true for NaN
+//   select(m, a, b)          m ? a : b
+//   mask_bits(m)             one bit per lane
+//   as_bits, from_bits       reinterpret between reg and ireg
+//   iset1, iadd, iand, ior, srl52
+template<class V> struct simd_kernels
+{
+    typedef typename V::reg reg;
+    typedef typename V::ireg ireg;
+
+    static void flag(uint8_t *err, int bits, uint8_t code)
+    {
+        for (int i = 0; i < V::width; ++i)
+        {
+            if ((bits & (1 << i)) && !err[i])
+                err[i] = code;
+        }
+    }
+    static void add(double *out, const double *a, const double *b, size_t n)
+    {
+        for (size_t i = 0; i < n; i += V::width)
+            V::store(out + i, V::add(V::load(a + i), V::load(b + i)));
+    }
+    static void mul(double *out, const double *a, const double *b, size_t n)
+    {
+        for (size_t i = 0; i < n; i += V::width)
+            V::store(out + i, V::mul(V::load(a + i), V::load(b + i)));
+    }
+    static void div(double *out, const double *a, const double *b, uint8_t *err, size_t n)
+    {
+        for (size_t i = 0; i < n; i += V::width)
+        {
+            reg d = V::load(b + i);
+            if (int bits = V::mask_bits(V::eq(d, V::zero())))
+                flag(err + i, bits, error_division_by_0);
+            V::store(out + i, V::div(V::load(a + i), d));
+        }
+    }
+    static void log(double *out, const double *a, uint8_t *err, size_t n)
+    {
+        for (size_t i = 0; i < n; i += V::width)
+        {
+            reg x = V::load(a + i);
+            if (int bits = V::mask_bits(V::le(x, V::zero())))
+                flag(err + i, bits, error_log_domain);
+            V::store(out + i, log10(x));
+        }
+    }
+
+    // log10 as in fdlibm/musl: x = 2^k*(1+f) with 1+f in [sqrt(2)/2, sqrt(2)),
+    // log(1+f) from a minimax polynomial in s = f/(2+f), then scaled by
+    // log10(e) and log10(2) in hi/lo parts. Within 2 ulp of the C library.
+    // Non-positive x gives NaN, NaN and +inf pass through.
+    static reg log10(reg x)
+    {
+        const double Lg1 = 6.666666666666735130e-01, Lg2 = 3.999999999940941908e-01,
+            Lg3 = 2.857142874366239149e-01, Lg4 = 2.222219843214978396e-01,
+            Lg5 = 1.818357216161805012e-01, Lg6 = 1.531383769920937332e-01,
+            Lg7 = 1.479819860511658591e-01;
+        const double ivln10hi = 4.34294481878168880939e-01, ivln10lo = 2.50829467116452752298e-11,
+            log10_2hi = 3.01029995663611771306e-01, log10_2lo = 3.69423907715893078616e-13;
+
+        // scale subnormals up by 2^54
+        reg tiny = V::lt(x, V::set1(2.2250738585072014e-308));
+        reg xs = V::select(tiny, V::mul(x, V::set1(18014398509481984.0)), x);
+        ireg u = V::iadd(V::as_bits(xs), V::iset1(0x3ff0000000000000LL - 0x3fe6a09e00000000LL));
+        // k = biased exponent - 1023, converted through the 2^52 bit pattern
+        reg k = V::sub(V::from_bits(V::ior(V::srl52(u), V::iset1(0x4330000000000000LL))), V::set1(4503599627370496.0 + 1023));
+        k = V::sub(k, V::select(tiny, V::set1(54), V::zero()));
+        reg f = V::sub(V::from_bits(V::iadd(V::iand(u, V::iset1(0x000fffffffffffffLL)), V::iset1(0x3fe6a09e00000000LL))), V::set1(1));
+
+        reg hfsq = V::mul(V::set1(0.5), V::mul(f, f));
+        reg s = V::div(f, V::add(V::set1(2), f));
+        reg z = V::mul(s, s);
+        reg w = V::mul(z, z);
+        reg t1 = V::mul(w, V::add(V::set1(Lg2), V::mul(w, V::add(V::set1(Lg4), V::mul(w, V::set1(Lg6))))));
+        reg t2 = V::mul(z, V::add(V::set1(Lg1), V::mul(w, V::add(V::set1(Lg3), V::mul(w, V::add(V::set1(Lg5), V::mul(w, V::set1(Lg7))))))));
+        reg r = V::add(t2, t1);
+
+        // hi keeps the upper 32 bits of f-hfsq so hi*ivln10hi is exact
+        reg hi = V::from_bits(V::iand(V::as_bits(V::sub(f, hfsq)), V::iset1((long long)0xffffffff00000000ULL)));
+        reg lo = V::add(V::sub(V::sub(f, hi), hfsq), V::mul(s, V::add(hfsq, r)));
+        reg val_hi = V::mul(hi, V::set1(ivln10hi));
+        reg y = V::mul(k, V::set1(log10_2hi));
+        reg val_lo = V::add(V::add(V::mul(k, V::set1(log10_2lo)), V::mul(V::add(lo, hi), V::set1(ivln10lo))), V::mul(lo, V::set1(ivln10hi)));
+        w = V::add(y, val_hi);
+        val_lo = V::add(val_lo, V::add(V::sub(y, w), val_hi));
+        r = V::add(val_lo, w);
+
+        r = V::select(V::le(x, V::zero()), V::set1(NAN), r);
+        return V::select(V::ne(x, x), x, V::select(V::eq(x, V::set1(INFINITY)), x, r));
+    }
+};
+
+
+#endif /* simd_h_ */
@@ -0,0 +1,434 @@
+#ifndef static_expression_h_
+#define static_expression_h_
+
+#include <stdint.h>
+#include <limits>
+#include "expression.h"
+
+
+// calc::compile() parses a formula of the grammar of expression.h in a
+// constant expression:
+//
+//     constexpr calc::formula f = calc::compile("2x + 1");
+//     static_assert(f(3) == 7, "");
+//     static_assert(calc::compile("2x + 1 = 2(1-x)").solve() == 0.25, "");
+//
+// With the default settings of expression (decimal point '.', one variable
+// named by any letter, x linear), a syntax error throws, so in a constant
+// expression it does not compile. At run time it throws expression_error
+// with the message and position that expression::parse() gives.
+//
+// x being linear, every formula comes out as a*x + b: its value needs no
+// nodes, and solve() computes what expression::try_solve() does with the same
+// operations in the same order. Only C++11 constexpr is used, one return
+// statement per function. Limits:
+// - numbers off the fast path of parse_number() are scaled from their first
+//   30 digits in double-double arithmetic and rounded once, subnormals too.
+//   parse_number() keeps up to 800, so a number with more than 30 that is
+//   within about 10^-30 of a tie between two doubles, say the exact decimal
+//   of the tie, can round the other way;
+// - log10 is computed in double-double arithmetic and rounded once, the C
+//   library's log10 is not, so the last bit of anything with a log can
+//   differ from solve();
+// - a constant expression is not allowed to divide by 0 or to overflow: a
+//   runtime error such as division by 0 is kept in the parts, but a value
+//   that reaches inf or nan does not compile;
+// - recursion grows with the length of sums, products and numbers, the
+//   compiler's limit (-fconstexpr-depth, 512 by default) bounds it.
+namespace calc {
+
+// a part of a formula and the first runtime error of computing it
+struct part
+{
+    double value;
+    error_code error;
+};
+
+// A formula compile() parsed: lhs = a*x + b, and for an equation rhs = c*x + d;
+// an expression has c = d = 0. Each part is computed as eval_linear() would do
+// it, so solve() has the same errors in the same order.
+struct formula
+{
+    part a, b, c, d;
+    bool equation;
+    bool has_x;
+    size_t end;             // offset of the end of the text, where a missing right hand side is reported
+
+    // the value of the expression, or of lhs - rhs, at x; meaningless if
+    // error() is set
+    constexpr double operator()(double x) const { return (a.value - c.value) * x + (b.value - d.value); }
+    // the first runtime error, in the order solve() computes the parts
+    constexpr error_code error() const { return a.error ? a.error : b.error ? b.error : c.error ? c.error : d.error; }
+    // expression::solve(): the value of an expression without x, the x of an
+    // equation. The formula keeps no pointer into the text it was compiled
+    // from: given that text, a missing right hand side is reported at its
+    // end, otherwise without a position.
+    constexpr double solve(const char *text = nullptr) const;
+};
+
+namespace detail {
+
+// throws: not a constant expression, so a syntax error stops the compilation
+template<class T> inline T fail(error_code code, const char *p)
+{
+    throw expression_error(error_message(code), p);
+}
+
+// the classes of characters of tokenize()
+constexpr bool is_digit(char c) { return c >= '0' && c <= '9'; }
+constexpr bool is_letter(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+constexpr bool is_blank(char c) { return c == ' ' || c == '\t'; }
+// expression::check_term()
+constexpr bool check_term(char c) { return !(is_letter(c) || (c >= '0' && c <= '1') || c == '_'); }
+constexpr const char *skip_ws(const char *p) { return is_blank(*p) ? skip_ws(p + 1) : p; }
+
+constexpr double square(double v) { return v * v; }
+// the table of parse_number(), k <= 22
+constexpr double pow10(int k) { return k == 0 ? 1 : 10 * pow10(k - 1); }
+constexpr double pow2(int k) { return k == 0 ? 1 : k % 2 ? 2 * pow2(k - 1) : square(pow2(k / 2)); }
+
+// double-double arithmetic for the slow path of numbers and log10, a value
+// being the sum hi + lo
+struct dd
+{
+    double hi, lo;
+};
+constexpr dd fast_two_sum(double s, double e) { return dd{s + e, e - ((s + e) - s)}; }
+constexpr dd two_sum(double a, double b, double s) { return dd{s, (a - (s - (s - a))) + (b - (s - a))}; }
+constexpr dd two_sum(double a, double b) { return two_sum(a, b, a + b); }
+constexpr dd split(double a, double t) { return dd{t - (t - a), a - (t - (t - a))}; }
+constexpr dd split(double a) { return split(a, 134217729.0 * a); }
+constexpr dd split_prod(double p, dd a, dd b) { return dd{p, ((a.hi * b.hi - p) + a.hi * b.lo + a.lo * b.hi) + a.lo * b.lo}; }
+constexpr dd two_prod(double a, double b) { return split_prod(a * b, split(a), split(b)); }
+constexpr dd renorm(dd s, double lo) { return fast_two_sum(s.hi, s.lo + lo); }
+constexpr dd add(dd a, dd b) { return renorm(two_sum(a.hi, b.hi), a.lo + b.lo); }
+constexpr dd mul(dd a, dd b) { return renorm(two_prod(a.hi, b.hi), a.hi * b.lo + a.lo * b.hi); }
+// f / d, q the first quotient
+constexpr dd div(dd f, dd d, double q, dd qd) { return fast_two_sum(q, ((f.hi - qd.hi) - qd.lo + f.lo - q * d.lo) / d.hi); }
+constexpr dd div(dd f, dd d) { return div(f, d, f.hi / d.hi, two_prod(f.hi / d.hi, d.hi)); }
+constexpr dd square(dd a) { return mul(a, a); }
+constexpr double sum(dd v) { return v.hi + v.lo; }
+
+// parse_number() with decimal point '.': the first pass over the digits
+struct number
+{
+    const char *end;
+    uint64_t mant;
+    int sig, e10;
+    bool any, truncated, frac;
+};
+constexpr number digit(number n, unsigned d)
+{
+    return n.sig == 0 && d == 0 ? number{n.end + 1, n.mant, n.sig, n.e10 - n.frac, true, n.truncated, n.frac}
+        : n.sig < 19 ? number{n.end + 1, n.mant * 10 + d, n.sig + 1, n.e10 - n.frac, true, n.truncated, n.frac}
+        : number{n.end + 1, n.mant, n.sig, n.e10 + !n.frac, true, n.truncated || d != 0, n.frac};
+}
+constexpr number digits(number n)
+{
+    return *n.end == '.' && !n.frac ? digits(number{n.end + 1, n.mant, n.sig, n.e10, n.any, n.truncated, true})
+        : is_digit(*n.end) ? digits(digit(n, *n.end - '0'))
+        : n;
+}
+constexpr number exponent_digits(number n, const char *q, int exp, bool neg)
+{
+    return is_digit(*q) ? exponent_digits(n, q + 1, exp < 100000 ? exp * 10 + (*q - '0') : exp, neg)
+        : number{q, n.mant, n.sig, n.e10 + (neg ? -exp : exp), n.any, n.truncated, n.frac};
+}
+// q: after the 'e' and its sign
+constexpr number exponent(number n, const char *q, bool neg)
+{
+    return is_digit(*q) ? exponent_digits(n, q, 0, neg) : n;
+}
+constexpr number exponent(number n)
+{
+    return *n.end == 'e' || *n.end == 'E' ? exponent(n, n.end[1] == '-' || n.end[1] == '+' ? n.end + 2 : n.end + 1, n.end[1] == '-') : n;
+}
+// 5^k, exact up to 5^22; 10^k = 5^k*2^k keeps the slow path below the
+// largest double
+constexpr dd pow5(int k) { return k <= 22 ? dd{k ? 5 * pow5(k - 1).hi : 1, 0} : k % 2 ? mul(dd{5, 0}, pow5(k - 1)) : square(pow5(k / 2)); }
+// the slow path of parse_number() reads the digits again: the first 30
+// significant ones, exact in m below 2^100, and whether a later one is nonzero
+struct wide
+{
+    dd m;
+    int sig;
+    bool sticky;
+};
+constexpr wide wide_digits(const char *q, wide w, bool frac)
+{
+    return *q == '.' && !frac ? wide_digits(q + 1, w, true)
+        : !is_digit(*q) ? w
+        : w.sig == 0 && *q == '0' ? wide_digits(q + 1, w, frac)
+        : w.sig < 30 ? wide_digits(q + 1, wide{add(mul(w.m, dd{10, 0}), dd{(double)(*q - '0'), 0}), w.sig + 1, w.sticky}, frac)
+        : wide_digits(q + 1, wide{w.m, w.sig, w.sticky || *q != '0'}, frac);
+}
+// y / 2^k below the smallest normal double, c = 2^(k-1022): c + y.hi rounds
+// y.hi to the subnormal grid, multiples of g = 2^(k-1074); y.lo only decides
+// a tie, so the value is rounded once
+constexpr double subnormal(dd s, double lo, double c, double g, int k)
+{
+    return (s.hi - c + (2 * s.lo == g && lo > 0 ? g : 2 * s.lo == -g && lo < 0 ? -g : 0)) / pow2(k);
+}
+constexpr double subnormal(dd y, int k, double c) { return subnormal(two_sum(c, y.hi), y.lo, c, c / pow2(52), k); }
+constexpr double scale_down(dd y, int k, double c) { return y.hi <= c ? subnormal(y, k, c) : sum(y) / pow2(k); }
+// m * 10^e10 rounded once
+constexpr double scale(dd m, int e10)
+{
+    return e10 >= 0 ? sum(mul(m, pow5(e10))) * pow2(e10) : scale_down(div(m, pow5(-e10)), -e10, 1 / pow2(1022 + e10));
+}
+// as parse_number(), a nonzero digit after the kept ones adds a 1 after them,
+// which keeps a value just above a tie from rounding as the tie
+constexpr double scale(const wide &w, int e10)
+{
+    return w.sticky ? scale(add(mul(w.m, dd{10, 0}), dd{1, 0}), e10 - 1) : scale(w.m, e10);
+}
+// each digit kept after the first pass's 19 moves e10 down by one
+constexpr double scale(const number &n, const wide &w) { return scale(w, n.e10 - (w.sig - n.sig)); }
+constexpr double value(const char *p, const number &n, double m)
+{
+    return n.mant == 0 ? 0
+        : !n.truncated && n.mant <= (1ull << 53) && n.e10 >= -22 && n.e10 <= 22 ? (n.e10 < 0 ? m / pow10(-n.e10) : m * pow10(n.e10))
+        : !n.truncated && n.mant <= (1ull << 53) && n.e10 > 22 && n.e10 <= 22 + 15 && m * pow10(n.e10 - 22) <= (1ull << 53) ? m * pow10(n.e10 - 22) * pow10(22)
+        : n.sig + n.e10 - 1 > 308 ? std::numeric_limits<double>::infinity()
+        : n.sig + n.e10 - 1 < -325 ? 0
+        : scale(n, wide_digits(p, wide{dd{0, 0}, 0, false}, false));
+}
+// a number and its end, nullptr if there are no digits
+struct parsed_number
+{
+    const char *end;
+    double value;
+};
+constexpr parsed_number read_number(const char *p, const number &n)
+{
+    return n.any ? parsed_number{n.end, value(p, n, (double)n.mant)} : parsed_number{nullptr, 0};
+}
+constexpr parsed_number read_number(const char *p)
+{
+    return read_number(p, exponent(digits(number{p, 0, 0, 0, false, false, false})));
+}
+
+
+constexpr dd inv_ln10 = {0.4342944819032518, 1.098319650216765e-17};
+constexpr dd log10_2 = {0.3010299956639812, -2.8037281277851704e-18};
+constexpr dd two_thirds = {0.6666666666666666, 3.700743415417188e-17};
+
+// 2/(2k+1) + 2s2/(2k+3) + ..., |s| < 0.172 leaves s^32 below 2^-80
+constexpr double atanh_tail(double s2, int k) { return k > 16 ? 0 : 2.0 / (2 * k + 1) + s2 * atanh_tail(s2, k + 1); }
+// ln((1+s)/(1-s)) = 2s + 2s^3/3 + 2s^5/5 + ...
+constexpr dd ln_series(dd s, dd s3, double s2)
+{
+    return add(add(dd{2 * s.hi, 2 * s.lo}, mul(s3, two_thirds)), dd{s3.hi * s2 * atanh_tail(s2, 2), 0});
+}
+constexpr dd ln_s(dd s) { return ln_series(s, mul(mul(s, s), s), s.hi * s.hi); }
+// ln(1 + f) for 1 + f in [sqrt(1/2), sqrt(2)], f exact
+constexpr dd ln1p(double f) { return ln_s(div(dd{f, 0}, two_sum(2, f))); }
+
+// x = m*2^e with m in [1, 2), by halving or doubling in steps of 2^512 down to 2
+struct scaled
+{
+    double m;
+    int e;
+};
+constexpr scaled down(scaled s, int k) { return s.m >= pow2(k) ? down(scaled{s.m / pow2(k), s.e + k}, k) : k > 1 ? down(s, k / 2) : s; }
+constexpr scaled up(scaled s, int k) { return s.m * pow2(k) < 2 ? up(scaled{s.m * pow2(k), s.e - k}, k) : k > 1 ? up(s, k / 2) : s; }
+constexpr scaled centered(scaled s) { return s.m > 1.4142135623730951 ? scaled{s.m / 2, s.e + 1} : s; }
+constexpr double log10(scaled s)
+{
+    return sum(add(mul(ln1p(s.m - 1), inv_ln10), renorm(two_prod(s.e, log10_2.hi), s.e * log10_2.lo)));
+}
+// x > 0
+constexpr double log10(double x)
+{
+    return x != x || x == std::numeric_limits<double>::infinity() ? x : log10(centered(x >= 1 ? down(scaled{x, 0}, 512) : up(scaled{x, 0}, 512)));
+}
+
+// eval() steps on parts: a term of a product, a prod of a sum, a log
+constexpr part times(part a, part t, bool div)
+{
+    return part{div ? (t.value == 0 ? 0 : a.value / t.value) : a.value * t.value,
+        a.error ? a.error : t.error ? t.error : div && t.value == 0 ? error_division_by_0 : error_none};
+}
+constexpr part plus(part a, part p)
+{
+    return part{a.value + p.value, a.error ? a.error : p.error};
+}
+constexpr part log_of(part a, double num)
+{
+    return part{a.error || a.value <= 0 ? 0 : num * log10(a.value), a.error ? a.error : a.value <= 0 ? error_log_domain : error_none};
+}
+
+// A parsed expr, prod or term: where the text goes on after it and its parts,
+// the coefficient of x and the constant part (the value if it has no x).
+struct node
+{
+    const char *p;          // nullptr: no term, see term_name()
+    char x;                 // the name of x once it came up
+    bool has_x;
+    bool constant;          // has a constant part: not a bare x times constants
+    part coef, cons;
+};
+// the flags of a term as in expression::parse_frame, prod_x: its prod
+// already has a term with x
+struct frame
+{
+    bool x_allowed, num_allowed, div, log, prod_x;
+    unsigned depth;
+};
+
+constexpr node expr(const char *p, char x, bool x_allowed, unsigned depth);
+constexpr node term(const char *p, char x, frame f);
+
+constexpr node add(node sum, node prod)
+{
+    return node{prod.p, prod.x, sum.has_x || prod.has_x, true,
+        prod.has_x ? plus(sum.coef, prod.coef) : sum.coef,
+        prod.constant ? plus(sum.cons, prod.cons) : sum.cons};
+}
+constexpr node mul(node prod, node term, bool div)
+{
+    return node{term.p, term.x, prod.has_x || term.has_x, term.has_x ? term.constant : prod.constant,
+        times(prod.coef, term.has_x ? term.coef : term.cons, div), times(prod.cons, term.cons, div)};
+}
+
+// term_group: q after the sub-expression and its blanks
+constexpr node term_close(const char *q, node sub, frame f, double num)
+{
+    return *q && *q != ')' && *q != '=' ? fail<node>(error_unexpected_input, q)
+        : *q != ')' ? fail<node>(error_expected_paren, q)
+        : sub.has_x && f.prod_x ? fail<node>(error_non_linear, q + 1)
+        : node{q + 1, sub.x, sub.has_x, true, part{num * sub.coef.value, sub.coef.error}, part{num * sub.cons.value, sub.cons.error}};
+}
+constexpr node term_group(node sub, frame f, double num)
+{
+    return term_close(skip_ws(sub.p), sub, f, num);
+}
+// term_log: the argument is a sub-expression of one term, 0 + 1*arg
+constexpr node term_log(node arg, double num)
+{
+    return node{arg.p, arg.x, false, true, part{0, error_none}, log_of(part{0 + 1 * arg.cons.value, arg.cons.error}, num)};
+}
+constexpr node term_x(const char *p, char x, frame f, double num)
+{
+    return !(f.x_allowed && !f.div && !f.log) ? fail<node>(error_division_or_log, p)
+        : x && x != *p ? fail<node>(error_multiple_variables, p)
+        : f.prod_x ? fail<node>(error_non_linear, p + 1)
+        : node{p + 1, *p, true, false, part{num, error_none}, part{0, error_none}};
+}
+constexpr bool is_log(const char *p) { return p[0] == 'l' && p[1] == 'o' && p[2] == 'g' && check_term(p[3]); }
+// a term without a number: log, x or a parenthesized expression
+constexpr node term_name(const char *p, char x, frame f, double num)
+{
+    return is_log(p) ? (f.depth == expression::default_max_depth ? fail<node>(error_nested_too_deeply, p)
+            : term_log(term(p + 3, x, frame{false, true, false, true, false, f.depth + 1}), num))
+        : is_letter(*p) && check_term(p[1]) ? term_x(p, x, f, num)
+        : *p != '(' ? (f.num_allowed ? fail<node>(error_expected_value, p) : node{nullptr, x, false, true, part{0, error_none}, part{0, error_none}})
+        : f.depth == expression::default_max_depth ? fail<node>(error_nested_too_deeply, p)
+        : term_group(expr(p + 1, x, f.x_allowed && !f.div && !f.log, f.depth + 1), f, num);
+}
+constexpr node term_number(const char *p, char x, parsed_number n, bool neg)
+{
+    return n.end ? node{n.end, x, false, true, part{0, error_none}, part{neg ? n.value * -1 : n.value, error_none}}
+        : fail<node>(error_cannot_parse_number, p);
+}
+// expression::value(): minus signs, then a number or the rest of the term
+constexpr node term_signs(const char *p, char x, frame f, bool neg)
+{
+    return f.num_allowed && *p == '-' ? term_signs(skip_ws(p + 1), x, f, !neg)
+        : f.num_allowed && (is_digit(*p) || *p == '.' || *p == ',') ? term_number(p, x, read_number(p), neg)
+        : term_name(p, x, f, neg ? -1 : 1);
+}
+constexpr node term(const char *p, char x, frame f)
+{
+    return term_signs(skip_ws(p), x, f, false);
+}
+
+// PROD: TERM([*\/]TERM)*, a term followed by the implicit products of term_more
+constexpr node prod_term(node acc, const char *p, bool x_allowed, bool div, unsigned depth);
+constexpr node prod_op(node acc, const char *q, bool x_allowed, unsigned depth)
+{
+    return *q == '/' || *q == '*' ? prod_term(acc, q + 1, x_allowed, *q == '/', depth) : acc;
+}
+constexpr node implicit(node acc, bool x_allowed, unsigned depth);
+// t: the term after acc, no term goes back to before the blanks
+constexpr node implicit_more(node acc, node t, bool x_allowed, unsigned depth)
+{
+    return t.p ? implicit(mul(acc, t, false), x_allowed, depth) : prod_op(acc, skip_ws(acc.p), x_allowed, depth);
+}
+constexpr node implicit_term(node acc, const char *q, bool x_allowed, unsigned depth)
+{
+    return is_letter(*q) || *q == '(' ? implicit_more(acc, term(q, acc.x, frame{x_allowed, false, false, false, acc.has_x, depth}), x_allowed, depth)
+        : prod_op(acc, q, x_allowed, depth);
+}
+constexpr node implicit(node acc, bool x_allowed, unsigned depth)
+{
+    return implicit_term(acc, skip_ws(acc.p), x_allowed, depth);
+}
+constexpr node prod_term(node acc, const char *p, bool x_allowed, bool div, unsigned depth)
+{
+    return implicit(mul(acc, term(p, acc.x, frame{x_allowed, true, div, false, acc.has_x, depth}), div), x_allowed, depth);
+}
+constexpr node prod(const char *p, char x, bool x_allowed, unsigned depth)
+{
+    return prod_term(node{p, x, false, true, part{1, error_none}, part{1, error_none}}, p, x_allowed, false, depth);
+}
+
+// EXPR: PROD([+\-]PROD)*, a '-' stays with its prod
+constexpr node sum_next(node acc, bool x_allowed, unsigned depth);
+constexpr node sum_op(node acc, const char *q, bool x_allowed, unsigned depth)
+{
+    return *q == '+' ? sum_next(add(acc, prod(q + 1, acc.x, x_allowed, depth)), x_allowed, depth)
+        : *q == '-' ? sum_next(add(acc, prod(q, acc.x, x_allowed, depth)), x_allowed, depth)
+        : acc;
+}
+constexpr node sum_next(node acc, bool x_allowed, unsigned depth)
+{
+    return sum_op(acc, skip_ws(acc.p), x_allowed, depth);
+}
+constexpr node expr(const char *p, char x, bool x_allowed, unsigned depth)
+{
+    return sum_next(add(node{p, x, false, true, part{0, error_none}, part{0, error_none}}, prod(p, x, x_allowed, depth)), x_allowed, depth);
+}
+
+// expression::try_parse(), q after the blanks that follow the lhs or rhs
+constexpr formula equation(node lhs, node rhs, const char *q, const char *text)
+{
+    return *q ? fail<formula>(error_unexpected_input, q)
+        : !lhs.has_x && !rhs.has_x ? fail<formula>(error_missing_x, nullptr)
+        : formula{lhs.coef, lhs.cons, rhs.coef, rhs.cons, true, true, (size_t)(q - text)};
+}
+constexpr formula equation(node lhs, node rhs, const char *text)
+{
+    return equation(lhs, rhs, skip_ws(rhs.p), text);
+}
+constexpr formula top(node lhs, const char *q, const char *text)
+{
+    return *q == '=' ? equation(lhs, expr(q + 1, lhs.x, true, 0), text)
+        : *q ? fail<formula>(error_unexpected_input, q)
+        : formula{lhs.coef, lhs.cons, part{0, error_none}, part{0, error_none}, false, lhs.has_x, (size_t)(q - text)};
+}
+constexpr formula top(node lhs, const char *text)
+{
+    return top(lhs, skip_ws(lhs.p), text);
+}
+
+} // namespace detail
+
+// Parses text, an expression or an equation: "2x + 1", "log 100", "2x = 1"
+constexpr formula compile(const char *text)
+{
+    return detail::top(detail::expr(text, 0, true, 0), text);
+}
+
+constexpr double formula::solve(const char *text) const
+{
+    return !equation ? (has_x ? detail::fail<double>(error_missing_rhs, text ? text + end : nullptr) : b.error ? detail::fail<double>(b.error, nullptr) : b.value)
+        : error() ? detail::fail<double>(error(), nullptr)
+        : a.value - c.value == 0.0 ? detail::fail<double>(d.value - b.value == 0.0 ? error_always_true : error_no_solution, nullptr)
+        : (d.value - b.value) / (a.value - c.value);
+}
+
+} // namespace calc
+
+
+#endif /* static_expression_h_ */
@@ -0,0 +1,206 @@
+#include "stats.h"
+
+#ifdef CALC_STATS
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+calc_stats stats;
+static thread_local uint64_t alloc_count;
+
+// the thread_stats of the running threads, and the sums of the exited ones
+static std::mutex threads_mutex;
+static std::vector<thread_stats*> threads;
+static uint64_t exited_calls[phase_count], exited_nodes;
+thread_local thread_stats this_thread_stats;
+
+thread_stats::thread_stats() : calls(), nodes(0)
+{
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    threads.push_back(this);
+}
+thread_stats::~thread_stats()
+{
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    for (int i = 0; i < phase_count; ++i)
+        exited_calls[i] += calls[i];
+    exited_nodes += nodes;
+    for (size_t i = 0; i < threads.size(); ++i)
+        if (threads[i] == this)
+        {
+            threads[i] = threads.back();
+            threads.pop_back();
+            break;
+        }
+}
+
+uint64_t thread_allocations()
+{
+    return alloc_count;
+}
+void count_allocation()
+{
+    ++alloc_count;
+}
+
+static const char *const phase_names[phase_count] = {"parse", "solve", "eval"};
+
+static uint64_t now_ns()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct trace_event
+{
+    stat_phase phase;
+    unsigned tid;
+    uint64_t start, ns;
+};
+// the trace keeps at most max_events, about 24 MB
+static const size_t max_events = 1 << 20;
+static std::atomic<bool> tracing(false);
+static std::mutex trace_mutex;
+static std::vector<trace_event> events;
+static uint64_t trace_start;
+static std::atomic<unsigned> thread_count(0);
+
+static unsigned thread_id()
+{
+    static thread_local unsigned id = thread_count++;
+    return id;
+}
+
+static thread_local unsigned scope_depth[phase_count];
+
+stat_scope::stat_scope(stat_phase phase) : phase(phase), outer(scope_depth[phase]++ == 0)
+{
+    stat_count(this_thread_stats.calls[phase]);
+    if (outer)
+    {
+        allocs = alloc_count;
+        start = now_ns();
+    }
+}
+stat_scope::~stat_scope()
+{
+    --scope_depth[phase];
+    if (!outer)
+        return;
+    uint64_t ns = now_ns() - start;
+    phase_stats &p = stats.phases[phase];
+    p.outer.fetch_add(1, std::memory_order_relaxed);
+    p.ns.fetch_add(ns, std::memory_order_relaxed);
+    p.allocs.fetch_add(alloc_count - allocs, std::memory_order_relaxed);
+    if (tracing.load(std::memory_order_relaxed) && start >= trace_start)
+    {
+        trace_event e = {phase, thread_id(), start, ns};
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        if (events.size() < max_events)
+            events.push_back(e);
+    }
+}
+
+void print_stats(FILE *f)
+{
+    // time and allocations are of the outer calls, nested ones are inside them
+    uint64_t calls[phase_count], nodes;
+    {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        for (int i = 0; i < phase_count; ++i)
+            calls[i] = exited_calls[i];
+        nodes = exited_nodes;
+        for (const thread_stats *t : threads)
+        {
+            for (int i = 0; i < phase_count; ++i)
+                calls[i] += t->calls[i].load(std::memory_order_relaxed);
+            nodes += t->nodes.load(std::memory_order_relaxed);
+        }
+    }
+    fprintf(f, "%-8s %12s %12s %12s %10s %12s\n", "phase", "calls", "outer", "ms", "ns/outer", "allocs");
+    for (int i = 0; i < phase_count; ++i)
+    {
+        const phase_stats &p = stats.phases[i];
+        uint64_t outer = p.outer, ns = p.ns;
+        fprintf(f, "%-8s %12llu %12llu %12.3f %10.1f %12llu\n", phase_names[i], (unsigned long long)calls[i],
+            (unsigned long long)outer, ns / 1e6, outer ? (double)ns / outer : 0.0, (unsigned long long)p.allocs);
+    }
+    fprintf(f, "%llu nodes created, max nesting depth %llu\n",
+        (unsigned long long)nodes, (unsigned long long)stats.max_depth);
+}
+// A count a running thread bumps while it is reset can survive the reset.
+void reset_stats()
+{
+    for (phase_stats &p : stats.phases)
+        p.outer = p.ns = p.allocs = 0;
+    stats.max_depth = 0;
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    for (int i = 0; i < phase_count; ++i)
+        exited_calls[i] = 0;
+    exited_nodes = 0;
+    for (thread_stats *t : threads)
+    {
+        for (int i = 0; i < phase_count; ++i)
+            t->calls[i].store(0, std::memory_order_relaxed);
+        t->nodes.store(0, std::memory_order_relaxed);
+    }
+}
+
+bool start_trace()
+{
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    events.clear();
+    trace_start = now_ns();
+    tracing = true;
+    return true;
+}
+bool write_trace(const char *path)
+{
+    tracing = false;
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        const trace_event &e = events[i];
+        // microseconds from start_trace(), complete ("X") events
+        fprintf(f, "{\"name\":\"%s\",\"cat\":\"calc\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+            phase_names[e.phase], e.tid, (e.start - trace_start) / 1e3, e.ns / 1e3, i + 1 < events.size() ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+    if (events.size() == max_events)
+        fprintf(stderr, "trace truncated to %zu events\n", max_events);
+    return true;
+}
+
+#else
+
+static void not_compiled(FILE *f)
+{
+    fprintf(f, "calc was built without CALC_STATS, rebuild with: make clean && make STATS=1\n");
+}
+void print_stats(FILE *f)
+{
+    not_compiled(f);
+}
+void reset_stats()
+{
+}
+bool start_trace()
+{
+    not_compiled(stderr);
+    return false;
+}
+bool write_trace(const char *)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef stats_h_
+#define stats_h_
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+// Instrumentation of the parser and evaluator: calls, time and heap
+// allocations per phase, nodes created and the deepest nesting parsed.
+// Compiled in with -DCALC_STATS (make STATS=1); otherwise the STAT_ macros
+// expand to nothing. Unlike the rest of the evaluator the counters are
+// process-wide, shared by all threads; the ones bumped for every call or node
+// are kept per thread and added up by print_stats().
+enum stat_phase
+{
+    phase_parse,        // expression::parse
+    phase_solve,        // expression::solve
+    phase_eval,         // the eval() overloads
+    phase_count
+};
+
+#ifdef CALC_STATS
+
+#include <atomic>
+
+struct phase_stats
+{
+    std::atomic<uint64_t> outer;    // calls not nested in another of the phase
+    std::atomic<uint64_t> ns;       // of the outer calls
+    std::atomic<uint64_t> allocs;   // made during the outer calls
+};
+struct calc_stats
+{
+    phase_stats phases[phase_count];
+    std::atomic<uint64_t> max_depth;
+};
+extern calc_stats stats;
+// The counters of one thread: only that thread writes them, with a plain
+// load and store rather than a locked add, print_stats() reads them.
+struct thread_stats
+{
+    std::atomic<uint64_t> calls[phase_count];  // including nested ones
+    std::atomic<uint64_t> nodes;
+
+    thread_stats();
+    // adds the counts to the ones of the threads that have exited
+    ~thread_stats();
+};
+extern thread_local thread_stats this_thread_stats;
+inline void stat_count(std::atomic<uint64_t> &n)
+{
+    n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+// operator new calls of the current thread, counted by the operator new of
+// stats_alloc.cpp; always 0 in a program without it, such as one using libcalc
+uint64_t thread_allocations();
+void count_allocation();
+
+// counts a call of phase; times it if no call of phase encloses it
+class stat_scope
+{
+public:
+    explicit stat_scope(stat_phase phase);
+    ~stat_scope();
+
+private:
+    stat_phase phase;
+    bool outer;
+    uint64_t start, allocs;
+};
+
+inline void stat_depth(uint64_t depth)
+{
+    uint64_t max = stats.max_depth.load(std::memory_order_relaxed);
+    while (depth > max && !stats.max_depth.compare_exchange_weak(max, depth, std::memory_order_relaxed))
+        ;
+}
+
+#define STAT_SCOPE(phase) stat_scope stat_scope_(phase)
+#define STAT_NODE() stat_count(this_thread_stats.nodes)
+#define STAT_DEPTH(depth) stat_depth(depth)
+
+#else
+
+#define STAT_SCOPE(phase)
+#define STAT_NODE()
+#define STAT_DEPTH(depth)
+
+#endif
+
+// prints the counters, or that they are not compiled in
+void print_stats(FILE *f);
+void reset_stats();
+// Records the outermost calls of each phase until write_trace(), which saves
+// them as Chrome trace events (chrome://tracing, Perfetto). Returns false if
+// the counters are not compiled in.
+bool start_trace();
+bool write_trace(const char *path);
+
+
+#endif /* stats_h_ */
@@ -0,0 +1,24 @@
+#include "stats.h"
+
+// The operator new of the calc and calc_bench executables, which counts the
+// allocations of each thread for thread_allocations(). It is kept out of
+// libcalc (LIB_OBJS in the Makefile): a library must not replace the
+// allocator of the program that links it.
+#ifdef CALC_STATS
+
+#include <stdlib.h>
+#include <new>
+
+void *operator new(size_t size)
+{
+    count_allocation();
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+#endif
@@ -0,0 +1,301 @@
+#include "stream_eval.h"
+#include "number.h"
+
+
+stream_status stream_eval::eval(FILE *f, double &value)
+{
+    this->f = f;
+    buf.resize(chunk);
+    begin = p = end = &buf[0];
+    base = 0;
+    return run(value);
+}
+stream_status stream_eval::eval(const char *data, size_t size, double &value)
+{
+    f = nullptr;
+    begin = p = data;
+    end = data + size;
+    base = 0;
+    return run(value);
+}
+// Moves the bytes from p to the front of buf and reads after them until
+// peek(k) is there or f ends.
+char stream_eval::fill(size_t k)
+{
+    if (!f)
+        return '\0';
+    size_t kept = end - p;
+    base += p - begin;
+    memmove(&buf[0], p, kept);
+    if (buf.size() < k + 1)
+        buf.resize(k + 1);
+    begin = p = &buf[0];
+    end = p + kept;
+    while ((size_t)(end - p) <= k)
+    {
+        size_t n = fread(&buf[0] + kept, 1, buf.size() - kept, f);
+        if (!n)
+            break;
+        kept += n;
+        end += n;
+    }
+    return p + k < end ? p[k] : '\0';
+}
+bool stream_eval::at_end()
+{
+    size_t k = peek() == '\r' && peek(1) == '\n' ? 2 : peek() == '\n';
+    return !peek(k) && p + k == end;
+}
+void stream_eval::skip_ws()
+{
+    while (peek() == ' ' || peek() == '\t')
+        ++p;
+}
+bool stream_eval::next(char c)
+{
+    if (peek() != c)
+        return false;
+    ++p;
+    return true;
+}
+bool stream_eval::fail(error_code code, int64_t pos)
+{
+    error = code;
+    error_pos = pos;
+    return false;
+}
+
+// states of the frames, as in expression::expr()
+enum
+{
+    expr_start, expr_next,
+    prod_start, prod_next,
+    term_start, term_log, term_group, term_more, term_more_end,
+};
+
+void stream_eval::call(uint8_t state, uint32_t target, bool num_allowed, bool div, bool log)
+{
+    frame f = {state, num_allowed, div, log, 0, 1, target};
+    stack.push_back(f);
+}
+void stream_eval::apply(const frame &f, double t)
+{
+    double &ret = stack[f.target].value;
+    if (f.div && !t && !error)
+        error = error_division_by_0;
+    if (f.div)
+        ret /= t;
+    else
+        ret *= t;
+}
+// the number of term f, collected as far as parse_number reads
+bool stream_eval::number(frame &f)
+{
+    int64_t start = offset();
+    bool point = false;
+    digits.clear();
+    for (char c = peek(); (c >= '0' && c <= '9') || (c == decimal_point && !point); c = peek())
+    {
+        point |= c == decimal_point;
+        digits += c;
+        ++p;
+    }
+    if (peek() == 'e' || peek() == 'E')
+    {
+        size_t k = peek(1) == '-' || peek(1) == '+' ? 2 : 1;
+        if (peek(k) >= '0' && peek(k) <= '9')
+        {
+            for (; k; --k)
+                digits += *p++;
+            while (peek() >= '0' && peek() <= '9')
+                digits += *p++;
+        }
+    }
+    if (!parse_number(digits.c_str(), f.num, decimal_point))
+        return fail(error_cannot_parse_number, start);
+    return true;
+}
+
+// expression::expr() with the values computed where it adds nodes. Terms
+// multiply their frame target at once, implicit products after them; a
+// parse error ends the evaluation, a runtime one is kept for the end.
+stream_status stream_eval::run(double &value)
+{
+    error = error_none;
+    error_pos = -1;
+    stack.clear();
+    call(expr_start, 0);
+    double ret = 0;
+    bool ret_ok = false;
+    unsigned depth = 0;
+    bool parsed = true;
+    while (parsed && !stack.empty())
+    {
+        uint32_t self = (uint32_t)(stack.size() - 1);
+        frame &f = stack.back();
+        switch (f.state)
+        {
+        case expr_start:
+            f.state = expr_next;
+            call(prod_start, self);
+            continue;
+        case expr_next:
+            f.value += ret;
+            skip_ws();
+            if (!next('+') && peek() != '-')
+            {
+                ret = f.value;
+                break;
+            }
+            call(prod_start, self);
+            continue;
+
+        case prod_start:
+            f.value = 1;
+            f.state = prod_next;
+            call(term_start, self);
+            continue;
+        case prod_next:
+            skip_ws();
+            if (!next('/') && !next('*'))
+            {
+                ret = f.value;
+                break;
+            }
+            call(term_start, self, true, p[-1] == '/');
+            continue;
+
+        case term_start:
+        {
+            skip_ws();
+            bool neg = false, has_value = false;
+            if (f.num_allowed)
+            {
+                while (next('-'))
+                {
+                    skip_ws();
+                    neg = !neg;
+                }
+                char c = peek();
+                if ((c >= '0' && c <= '9') || c == '.' || c == ',')
+                {
+                    if (!(parsed = number(f)))
+                        continue;
+                    has_value = true;
+                }
+                if (neg)
+                    f.num *= -1;
+            }
+            if (has_value)
+            {
+                apply(f, f.num * 1.0);
+                f.state = term_more;
+                continue;
+            }
+            char c = peek();
+            bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+            if (letter && c == 'l' && peek(1) == 'o' && peek(2) == 'g' && expression::check_term(peek(3)))
+            {
+                if (depth++ == max_depth)
+                {
+                    parsed = fail(error_nested_too_deeply, offset());
+                    continue;
+                }
+                p += 3;
+                f.value = 1;
+                f.state = term_log;
+                call(term_start, self, true, false, true);
+                continue;
+            }
+            if (letter && expression::check_term(peek(1)))
+            {
+                // a variable: there is no x to solve for
+                parsed = fail(error_unexpected_input, offset());
+                continue;
+            }
+            if (peek() != '(')
+            {
+                if (f.num_allowed)
+                {
+                    parsed = fail(error_expected_value, offset());
+                    continue;
+                }
+                ret_ok = false;
+                break;
+            }
+            if (depth++ == max_depth)
+            {
+                parsed = fail(error_nested_too_deeply, offset());
+                continue;
+            }
+            ++p;
+            f.state = term_group;
+            call(expr_start, 0);
+            continue;
+        }
+        case term_log:
+        {
+            --depth;
+            double arg = 0 + f.value;
+            if (arg <= 0 && !error)
+                error = error_log_domain;
+            apply(f, f.num * log10(arg));
+            f.state = term_more;
+            continue;
+        }
+        case term_group:
+            --depth;
+            skip_ws();
+            if (!at_end() && peek() != ')' && peek() != '=')
+            {
+                parsed = fail(error_unexpected_input, offset());
+                continue;
+            }
+            if (!next(')'))
+            {
+                parsed = fail(error_expected_paren, offset());
+                continue;
+            }
+            apply(f, f.num * ret);
+            f.state = term_more;
+            continue;
+        case term_more:
+        {
+            // implicit products: 5log 100, 2(1+3)log 7
+            if (!f.num_allowed || f.log)
+            {
+                ret_ok = true;
+                break;
+            }
+            skip_ws();
+            char c = peek();
+            if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '('))
+            {
+                ret_ok = true;
+                break;
+            }
+            f.state = term_more_end;
+            call(term_start, f.target, false);
+            continue;
+        }
+        case term_more_end:
+            if (!ret_ok)
+            {
+                ret_ok = true;
+                break;
+            }
+            f.state = term_more;
+            continue;
+        }
+        stack.pop_back();
+    }
+    if (parsed)
+    {
+        skip_ws();
+        if (!at_end())
+            fail(error_unexpected_input, offset());
+    }
+    value = error ? 0 : ret;
+    stream_status s = {error, error_pos};
+    return s;
+}
@@ -0,0 +1,82 @@
+#ifndef stream_eval_h_
+#define stream_eval_h_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "expression.h"
+
+
+// expression_status with a 64-bit offset: inputs can be larger than 2 GB
+struct stream_status
+{
+    error_code code;
+    int64_t pos;
+    bool ok() const { return code == error_none; }
+    const char *message() const { return error_message(code); }
+};
+
+// Evaluates one arithmetic expression of any size while reading it, without
+// building nodes. The grammar is the one of expression without x: numbers,
+// + - * /, parentheses, log and implicit products. Values have the same bits
+// as expression::solve() and errors are the same, at the same offsets,
+// counted from the start of the input. Memory grows with the nesting depth
+// and the longest number, not with the input.
+//
+// A name other than log, or "=" after the expression, is
+// error_unexpected_input. A "\n" or "\r\n" at the end of the input is
+// ignored.
+class stream_eval
+{
+public:
+    explicit stream_eval(size_t chunk = 1 << 20) : chunk(chunk), decimal_point('.'), max_depth(expression::default_max_depth) {}
+    void set_decimal_point(char c) { decimal_point = c; }
+    void set_max_depth(unsigned depth) { max_depth = depth; }
+    // reads f to its end, chunk bytes at a time
+    stream_status eval(FILE *f, double &value);
+    // the size bytes at data, a mapped file for example
+    stream_status eval(const char *data, size_t size, double &value);
+
+private:
+    // a pending expr, prod or term, as expression::parse_frame
+    struct frame
+    {
+        uint8_t state;
+        bool num_allowed, div, log;
+        double value;       // the sum of an expr, product of a prod, log argument of a term
+        double num;         // num_value of a term
+        uint32_t target;    // the frame a term multiplies, a prod or a log term
+    };
+    stream_status run(double &value);
+    void call(uint8_t state, uint32_t target, bool num_allowed = true, bool div = false, bool log = false);
+    // multiplies frame target of term f by t as eval() does
+    void apply(const frame &f, double t);
+    bool number(frame &f);
+
+    // The input is read through p: the current character is peek(), the ones
+    // after it peek(k). Past the end they are '\0'.
+    char peek(size_t k = 0) { return p + k < end ? p[k] : fill(k); }
+    char fill(size_t k);
+    // at the end of input or before a final "\n" or "\r\n"
+    bool at_end();
+    int64_t offset() const { return base + (p - begin); }
+    void skip_ws();
+    bool next(char c);
+    bool fail(error_code code, int64_t pos);
+
+    size_t chunk;
+    char decimal_point;
+    unsigned max_depth;
+    FILE *f;
+    std::vector<char> buf;
+    const char *begin, *p, *end;    // of the bytes read
+    int64_t base;                   // offset of begin
+    std::vector<frame> stack;
+    std::string digits;             // the current number
+    error_code error;               // the first one, of parsing or evaluation
+    int64_t error_pos;
+};
+
+
+#endif /* stream_eval_h_ */
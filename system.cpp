@@ -0,0 +1,391 @@
+#include "system.h"
+#include <algorithm>
+#include <functional>
+#include <queue>
+
+
+expression_status linear_system::add(const char *equation)
+{
+    size_t known = vars.size();
+    expression_status s = parser.try_parse(equation);
+    if (s.ok() && parser.lhs == no_node)
+        s.code = error_missing_rhs, s.pos = -1;
+    error_code error = error_none;
+    if (s.ok())
+    {
+        // lhs - rhs = 0: the coefficients go to entries, the constant to rhs
+        current.entries.clear();
+        current.rhs = 0;
+        collect(parser.nodes, parser.nodes.exprs[parser.lhs], 1, error);
+        collect(parser.nodes, parser.nodes.exprs[parser.rhs], -1, error);
+        s.code = error;
+    }
+    if (!s.ok())
+    {
+        // the names of a rejected equation are not variables of the system
+        vars.truncate(known);
+        return s;
+    }
+    std::vector<entry> &es = current.entries;
+    std::sort(es.begin(), es.end(), [](const entry &a, const entry &b) { return a.col < b.col; });
+    size_t n = 0;
+    for (size_t i = 0; i < es.size(); ++i)
+    {
+        if (n && es[n - 1].col == es[i].col)
+            es[n - 1].value += es[i].value;
+        else
+            es[n++] = es[i];
+    }
+    es.resize(n);
+    es.erase(std::remove_if(es.begin(), es.end(), [](const entry &e) { return e.value == 0; }), es.end());
+    current.rhs = -current.rhs;
+    rows.push_back(current);
+    return s;
+}
+void linear_system::clear()
+{
+    vars.clear();
+    rows.clear();
+}
+
+// Adds scale times the node to current. Every product holds at most one
+// variable (in its xterm), the other terms are constants.
+void linear_system::collect(const node_table &nodes, const expr_t &expr, double scale, error_code &error)
+{
+    for (node_id i = expr.first; i != no_node; i = nodes.prods[i].next)
+        collect(nodes, nodes.prods[i], scale, error);
+}
+void linear_system::collect(const node_table &nodes, const prod_t &prod, double scale, error_code &error)
+{
+    double factor = 1;
+    for (node_id i = prod.first; i != no_node; i = nodes.terms[i].next)
+    {
+        if (i == prod.xterm)
+            continue;
+        const term_t &term = nodes.terms[i];
+        double x = eval(nodes, term, error);
+        if (term.div && !x && !error)
+            error = error_division_by_0;
+        if (term.div)
+            factor /= x;
+        else
+            factor *= x;
+    }
+    if (prod.xterm == no_node)
+        current.rhs += scale * factor;
+    else
+        collect(nodes, nodes.terms[prod.xterm], scale * factor, error);
+}
+void linear_system::collect(const node_table &nodes, const term_t &term, double scale, error_code &error)
+{
+    scale *= term.num_value;
+    if (term.expr_value == no_node)
+        current.entries.push_back(entry{term.var, scale});
+    else
+        collect(nodes, nodes.exprs[term.expr_value], scale, error);
+}
+
+expression_status linear_system::solve(std::vector<double> &values) const
+{
+    return vars.size() <= dense_limit ? solve_dense(values) : solve_sparse(values);
+}
+
+// Entries below tol (relative to the largest coefficient) count as 0, a
+// right hand side left without coefficients is a contradiction above btol.
+static const double zero_tolerance = 1e-12, rhs_tolerance = 1e-10;
+// the sparse solver finishes with dense elimination once at most this many
+// columns are left and a quarter of their entries are nonzero
+static const size_t dense_tail_limit = 2048;
+
+// Gaussian elimination with partial pivoting on the n x (m + 1) matrix a, the
+// last column is the right hand side. x gets the m values.
+static expression_status solve_matrix(std::vector<double> &a, size_t n, size_t m, double tol, double btol,
+    std::vector<double> &x)
+{
+    size_t w = m + 1;
+    std::vector<size_t> pivot_col;
+    bool singular = false;
+    for (size_t c = 0; c < m; ++c)
+    {
+        size_t k = pivot_col.size(), best = k;
+        for (size_t i = k; i < n; ++i)
+            if (fabs(a[i * w + c]) > fabs(a[best * w + c]))
+                best = i;
+        if (best >= n || fabs(a[best * w + c]) <= tol)
+        {
+            singular = true;
+            continue;
+        }
+        if (best != k)
+            std::swap_ranges(a.begin() + best * w, a.begin() + (best + 1) * w, a.begin() + k * w);
+        const double *p = &a[k * w];
+        for (size_t i = k + 1; i < n; ++i)
+        {
+            double *r = &a[i * w], f = r[c] / p[c];
+            if (f == 0)
+                continue;
+            r[c] = 0;
+            for (size_t j = c + 1; j < w; ++j)
+                r[j] -= f * p[j];
+        }
+        pivot_col.push_back(c);
+    }
+    for (size_t i = pivot_col.size(); i < n; ++i)
+        if (fabs(a[i * w + m]) > btol)
+            return expression_status{error_system_no_solution, -1};
+    if (singular)
+        return expression_status{error_system_singular, -1};
+    x.assign(m, 0);
+    for (size_t k = pivot_col.size(); k-- > 0;)
+    {
+        size_t c = pivot_col[k];
+        const double *p = &a[k * w];
+        double v = p[m];
+        for (size_t j = c + 1; j < m; ++j)
+            v -= p[j] * x[j];
+        x[c] = v / p[c];
+    }
+    return expression_status{error_none, -1};
+}
+
+expression_status linear_system::solve_dense(std::vector<double> &values) const
+{
+    size_t n = rows.size(), m = vars.size(), w = m + 1;
+    std::vector<double> a(n * w);
+    double scale = 0, bscale = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (const entry &e : rows[i].entries)
+        {
+            a[i * w + e.col] = e.value;
+            scale = std::max(scale, fabs(e.value));
+        }
+        a[i * w + m] = rows[i].rhs;
+        bscale = std::max(bscale, fabs(rows[i].rhs));
+    }
+    return solve_matrix(a, n, m, zero_tolerance * scale, rhs_tolerance * bscale, values);
+}
+
+expression_status linear_system::solve_sparse(std::vector<double> &values) const
+{
+    size_t n = rows.size(), m = vars.size();
+    std::vector<row> a(rows);
+    double scale = 0, bscale = 0;
+    for (const row &r : a)
+    {
+        for (const entry &e : r.entries)
+            scale = std::max(scale, fabs(e.value));
+        bscale = std::max(bscale, fabs(r.rhs));
+    }
+    const double tol = zero_tolerance * scale, btol = rhs_tolerance * bscale;
+
+    // rows that hold each column (may list a row twice or one that lost the
+    // entry), and how many active rows really do
+    std::vector<std::vector<uint32_t>> col_rows(m);
+    std::vector<uint32_t> col_count(m, 0);
+    std::vector<char> row_done(n, 0), col_done(m, 0);
+    bool singular = false, no_solution = false;
+    size_t remaining = m, active_entries = 0;     // of the columns and rows not pivoted yet
+    // marks an active row that has lost its last entry
+    auto row_emptied = [&](uint32_t r)
+    {
+        row_done[r] = 1;
+        if (fabs(a[r].rhs) > btol)
+            no_solution = true;
+    };
+    for (uint32_t r = 0; r < n; ++r)
+    {
+        if (a[r].entries.empty())
+            row_emptied(r);
+        active_entries += a[r].entries.size();
+        for (const entry &e : a[r].entries)
+        {
+            col_rows[e.col].push_back(r);
+            ++col_count[e.col];
+        }
+    }
+    // columns by active row count, stale items are skipped when popped
+    typedef std::pair<uint32_t, uint32_t> column_item;
+    std::priority_queue<column_item, std::vector<column_item>, std::greater<column_item>> queue;
+    for (uint32_t c = 0; c < m; ++c)
+        queue.push(column_item(col_count[c], c));
+
+    struct candidate
+    {
+        uint32_t row;
+        double value;
+    };
+    std::vector<candidate> cands;
+    std::vector<uint32_t> seen(n, 0);
+    std::vector<uint32_t> where(m, 0), hit;     // pivot row positions + 1, see below
+    std::vector<double> pivot_values;
+    std::vector<std::pair<uint32_t, uint32_t>> pivots;     // row, column
+    uint32_t step = 0;
+    while (!queue.empty())
+    {
+        // the rest is dense enough that dense elimination does less work
+        if (remaining <= dense_tail_limit && active_entries * 4 >= remaining * remaining)
+            break;
+        column_item top = queue.top();
+        queue.pop();
+        uint32_t c = top.second;
+        if (col_done[c] || top.first != col_count[c])
+            continue;
+        col_done[c] = 1;
+        --remaining;
+        ++step;
+        cands.clear();
+        double max_abs = 0;
+        for (uint32_t r : col_rows[c])
+        {
+            if (row_done[r] || seen[r] == step)
+                continue;
+            seen[r] = step;
+            const std::vector<entry> &es = a[r].entries;
+            auto it = std::find_if(es.begin(), es.end(), [c](const entry &e) { return e.col == c; });
+            if (it == es.end())
+                continue;
+            cands.push_back(candidate{r, it->value});
+            max_abs = std::max(max_abs, fabs(it->value));
+        }
+        std::vector<uint32_t>().swap(col_rows[c]);
+        if (max_abs <= tol)
+        {
+            // no pivot: a free variable, its leftover entries are rounding noise
+            singular = true;
+            for (const candidate &cand : cands)
+            {
+                std::vector<entry> &es = a[cand.row].entries;
+                es.erase(std::find_if(es.begin(), es.end(), [c](const entry &e) { return e.col == c; }));
+                --active_entries;
+                if (es.empty())
+                    row_emptied(cand.row);
+            }
+            continue;
+        }
+        const candidate *best = nullptr;
+        for (const candidate &cand : cands)
+            if (fabs(cand.value) >= 0.1 * max_abs && (!best || a[cand.row].entries.size() < a[best->row].entries.size()))
+                best = &cand;
+        uint32_t pr = best->row;
+        double pv = best->value;
+        row_done[pr] = 1;
+        active_entries -= a[pr].entries.size();
+        pivots.push_back(std::make_pair(pr, c));
+        const row &p = a[pr];
+        // by where[col], 0 for the columns not in the pivot row
+        pivot_values.assign(1, 0);
+        for (size_t k = 0; k < p.entries.size(); ++k)
+        {
+            where[p.entries[k].col] = (uint32_t)k + 1;
+            pivot_values.push_back(p.entries[k].value);
+            if (p.entries[k].col != c)
+                --col_count[p.entries[k].col];
+        }
+        // row -= f * pivot row: entries of both are updated in place, without
+        // branches on the columns, those only in the pivot row are appended as
+        // fill-in
+        hit.assign(p.entries.size() + 1, 0);
+        uint32_t cand_id = 0;
+        for (const candidate &cand : cands)
+        {
+            if (cand.row == pr)
+                continue;
+            ++cand_id;
+            row &r = a[cand.row];
+            double f = cand.value / pv;
+            std::vector<entry> &es = r.entries;
+            active_entries -= es.size();
+            size_t n = 0;
+            for (size_t k = 0; k < es.size(); ++k)
+            {
+                entry e = es[k];
+                uint32_t w = where[e.col];
+                hit[w] = cand_id;
+                e.value -= f * pivot_values[w];
+                // column c is done, its count does not matter
+                bool keep = fabs(e.value) > tol && e.col != c;
+                col_count[e.col] -= !keep;
+                es[n] = e;
+                n += keep;
+            }
+            es.resize(n);
+            // every candidate has column c, it is hit
+            for (size_t k = 0; k < p.entries.size(); ++k)
+            {
+                const entry &e = p.entries[k];
+                if (hit[k + 1] == cand_id)
+                    continue;
+                es.push_back(entry{e.col, -f * e.value});
+                col_rows[e.col].push_back(cand.row);
+                ++col_count[e.col];
+            }
+            r.rhs -= f * p.rhs;
+            active_entries += es.size();
+            if (es.empty())
+                row_emptied(cand.row);
+        }
+        for (const entry &e : p.entries)
+        {
+            where[e.col] = 0;
+            if (e.col != c)
+                queue.push(column_item(col_count[e.col], e.col));
+        }
+    }
+    // the columns left, numbered in order, and the rows that hold them
+    std::vector<uint32_t> tail_cols, tail_rows;
+    std::vector<double> tail_values;
+    if (remaining)
+    {
+        std::vector<uint32_t> &index = where;
+        for (uint32_t c = 0; c < m; ++c)
+        {
+            if (!col_done[c])
+            {
+                index[c] = (uint32_t)tail_cols.size();
+                tail_cols.push_back(c);
+            }
+        }
+        for (uint32_t r = 0; r < n; ++r)
+            if (!row_done[r])
+                tail_rows.push_back(r);
+        size_t k = tail_cols.size(), w = k + 1;
+        std::vector<double> d(tail_rows.size() * w);
+        for (size_t i = 0; i < tail_rows.size(); ++i)
+        {
+            const row &r = a[tail_rows[i]];
+            for (const entry &e : r.entries)
+                d[i * w + index[e.col]] = e.value;
+            d[i * w + k] = r.rhs;
+        }
+        expression_status s = solve_matrix(d, tail_rows.size(), k, tol, btol, tail_values);
+        if (s.code == error_system_no_solution)
+            no_solution = true;
+        else if (s.code == error_system_singular)
+            singular = true;
+    }
+    if (no_solution)
+        return expression_status{error_system_no_solution, -1};
+    if (singular)
+        return expression_status{error_system_singular, -1};
+
+    // the other columns of a pivot row were pivoted after it
+    values.assign(m, 0);
+    for (size_t i = 0; i < tail_cols.size(); ++i)
+        values[tail_cols[i]] = tail_values[i];
+    for (size_t k = pivots.size(); k-- > 0;)
+    {
+        const row &p = a[pivots[k].first];
+        uint32_t c = pivots[k].second;
+        double v = p.rhs, pv = 0;
+        for (const entry &e : p.entries)
+        {
+            if (e.col == c)
+                pv = e.value;
+            else
+                v -= e.value * values[e.col];
+        }
+        values[c] = v / pv;
+    }
+    return expression_status{error_none, -1};
+}
@@ -0,0 +1,60 @@
+#ifndef system_h_
+#define system_h_
+
+#include "expression.h"
+
+
+// System of linear equations over named variables, "2a + b = 3(c - 1)" and
+// so on. Every equation is parsed once and its row of the coefficient
+// matrix is read straight off the tree: the constant factors of each product
+// are evaluated, the term holding the variable is followed down.
+//
+// solve() eliminates with partial pivoting on a dense matrix for up to
+// dense_limit variables. Larger systems use a sparse LU: the pivot column is
+// the one in the fewest remaining rows, the pivot row the shortest one whose
+// entry is at least a tenth of the largest in the column (Markowitz with
+// threshold pivoting), so the fill-in of sparse balance equations stays low.
+// Once the columns left are few and a quarter full, they are finished with
+// dense elimination.
+class linear_system
+{
+public:
+    linear_system() : dense_limit(default_dense_limit) { parser.set_variables(&vars); }
+    // parses and adds an equation; the error position is in equation
+    expression_status add(const char *equation);
+    // values of the variables by variable_table index. A system with a free
+    // variable is error_system_singular, one with contradicting equations
+    // error_system_no_solution.
+    expression_status solve(std::vector<double> &values) const;
+    const variable_table &variables() const { return vars; }
+    size_t size() const { return rows.size(); }
+    void clear();
+    void set_dense_limit(size_t n) { dense_limit = n; }
+    static const size_t default_dense_limit = 64;
+
+private:
+    struct entry
+    {
+        uint32_t col;
+        double value;
+    };
+    struct row
+    {
+        std::vector<entry> entries;     // one per column, no zeros
+        double rhs;
+    };
+    void collect(const node_table &nodes, const expr_t &expr, double scale, error_code &error);
+    void collect(const node_table &nodes, const prod_t &prod, double scale, error_code &error);
+    void collect(const node_table &nodes, const term_t &term, double scale, error_code &error);
+    expression_status solve_dense(std::vector<double> &values) const;
+    expression_status solve_sparse(std::vector<double> &values) const;
+
+    expression parser;
+    variable_table vars;
+    std::vector<row> rows;
+    row current;            // being collected
+    size_t dense_limit;
+};
+
+
+#endif /* system_h_ */
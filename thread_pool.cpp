@@ -0,0 +1,77 @@
+#include <algorithm>
+#include "thread_pool.h"
+
+
+thread_pool::thread_pool(unsigned threads) : pending(0), idle(0), stop(false), next(0)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < threads; ++i)
+        queues.emplace_back(new queue);
+    for (unsigned i = 0; i < threads; ++i)
+        workers.emplace_back(&thread_pool::work, this, i);
+}
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m);
+        stop = true;
+    }
+    cv.notify_all();
+    for (auto &t : workers)
+        t.join();
+}
+void thread_pool::submit(job j)
+{
+    queue &q = *queues[next++ % queues.size()];
+    {
+        std::lock_guard<std::mutex> lock(q.m);
+        q.jobs.push_back(std::move(j));
+        ++pending;
+    }
+    // A worker counts itself idle before it checks pending, so either it
+    // sees this job or this sees it; taking m then waits until it is in
+    // cv.wait, where the notification cannot be missed.
+    if (idle > 0)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        cv.notify_one();
+    }
+}
+// takes the oldest job of self, or steals the oldest one of another worker
+bool thread_pool::pop(unsigned self, job &j)
+{
+    for (size_t i = 0; i < queues.size(); ++i)
+    {
+        queue &q = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(q.m);
+        if (!q.jobs.empty())
+        {
+            j = std::move(q.jobs.front());
+            q.jobs.pop_front();
+            --pending;
+            return true;
+        }
+    }
+    return false;
+}
+void thread_pool::work(unsigned self)
+{
+    for (;;)
+    {
+        job j;
+        if (pop(self, j))
+        {
+            j();
+            continue;
+        }
+        // pending counts queued jobs only, so a wake up always finds one
+        // unless another worker took it first
+        std::unique_lock<std::mutex> lock(m);
+        ++idle;
+        cv.wait(lock, [this] { return stop || pending > 0; });
+        --idle;
+        if (stop && pending == 0)
+            return;
+    }
+}
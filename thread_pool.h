@@ -0,0 +1,51 @@
+#ifndef thread_pool_h_
+#define thread_pool_h_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of worker threads, each with its own job queue. Jobs are handed
+// out round-robin; a worker that runs out of jobs steals the oldest job of
+// another worker, so one slow job only holds up the thread running it.
+class thread_pool
+{
+public:
+    typedef std::function<void()> job;
+
+    // threads == 0: one per hardware thread
+    explicit thread_pool(unsigned threads);
+    // runs the remaining jobs, then joins the workers
+    ~thread_pool();
+    void submit(job j);
+    unsigned size() const { return (unsigned)workers.size(); }
+
+private:
+    struct queue
+    {
+        std::mutex m;
+        std::deque<job> jobs;
+    };
+    bool pop(unsigned self, job &j);
+    void work(unsigned self);
+
+    std::vector<std::unique_ptr<queue>> queues;
+    std::vector<std::thread> workers;
+    // Idle workers sleep on cv. m guards stop and the wait itself; busy
+    // workers and submit() never take it while no worker sleeps.
+    std::mutex m;
+    std::condition_variable cv;
+    std::atomic<size_t> pending;    // jobs in the queues, kept under their locks
+    std::atomic<unsigned> idle;     // workers in (or about to enter) cv.wait
+    bool stop;
+    std::atomic<unsigned> next;
+};
+
+
+#endif /* thread_pool_h_ */
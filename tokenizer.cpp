@@ -0,0 +1,74 @@
+#include <string.h>
+#include <algorithm>
+#include "tokenizer.h"
+#if defined(__x86_64__) || defined(_M_X64)
+#define TOKENIZER_X64
+#include <emmintrin.h>
+#endif
+
+
+static size_t scan_tokens_scalar(const char *text, size_t len, token *out)
+{
+    token *t = out;
+    token_kind prev = token_end;
+    for (size_t i = 0; i < len; ++i)
+    {
+        char c = text[i], lower = c | 0x20;
+        token_kind kind = c >= '0' && c <= '9' ? token_digits : lower >= 'a' && lower <= 'z' ? token_letters
+            : c == ' ' || c == '\t' ? token_blank : token_char;
+        if (kind != prev || kind == token_char)
+            *t++ = token((uint32_t)i, kind, c);
+        prev = kind;
+    }
+    return t - out;
+}
+
+#ifdef TOKENIZER_X64
+namespace {
+struct sse2
+{
+    typedef __m128i reg;
+    static const int width = 16;
+    static reg load(const char *p) { return _mm_load_si128((const __m128i*)p); }
+    // lanes with lo <= c < lo + n: the unsigned compare done signed
+    static reg in_range(reg c, char lo, int n)
+    {
+        reg d = _mm_xor_si128(_mm_sub_epi8(c, _mm_set1_epi8(lo)), _mm_set1_epi8(-128));
+        return _mm_cmplt_epi8(d, _mm_set1_epi8((char)(n - 128)));
+    }
+    static reg digits(reg c) { return in_range(c, '0', 10); }
+    static reg letters(reg c) { return in_range(_mm_or_si128(c, _mm_set1_epi8(0x20)), 'a', 26); }
+    static reg blanks(reg c) { return _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\t'))); }
+    static uint32_t bits(reg m) { return (uint32_t)_mm_movemask_epi8(m); }
+    // token_char minus the class: digits 2, letters 1, blanks 3
+    static void store_kinds(uint8_t *p, reg d, reg l, reg b)
+    {
+        reg k = _mm_sub_epi8(_mm_set1_epi8(token_char), _mm_and_si128(d, _mm_set1_epi8(token_char - token_digits)));
+        k = _mm_sub_epi8(k, _mm_and_si128(l, _mm_set1_epi8(token_char - token_letters)));
+        _mm_store_si128((__m128i*)p, _mm_sub_epi8(k, _mm_and_si128(b, _mm_set1_epi8(token_char - token_blank))));
+    }
+};
+}
+#endif
+
+void tokenize(const char *text, std::vector<token> &tokens, simd_level level)
+{
+    level = std::min(level, detect_simd_level());
+#if defined(__SANITIZE_ADDRESS__)
+    // the aligned loads read past the text (never past its page), which the
+    // address sanitizer reports
+    level = simd_scalar;
+#endif
+    size_t len = strlen(text), n;
+    tokens.resize(len + 1);
+#ifdef TOKENIZER_X64
+    if (level == simd_avx2)
+        n = scan_tokens_avx2(text, len, &tokens[0]);
+    else if (level == simd_sse2)
+        n = scan_tokens<sse2>(text, len, &tokens[0]);
+    else
+#endif
+        n = scan_tokens_scalar(text, len, &tokens[0]);
+    tokens[n] = token((uint32_t)len, token_end, '\0');
+    tokens.resize(n + 1);
+}
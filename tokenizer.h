@@ -0,0 +1,95 @@
+#ifndef tokenizer_h_
+#define tokenizer_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "batch.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+// Tokens of the parser input: runs of blanks (' ', '\t'), of digits and of
+// letters, every other character (operators, parentheses, '.', '_', ...)
+// alone, and token_end at the terminating NUL. Every position the parser can
+// stop at is the start of a token, so expression keeps reporting errors at
+// the same offsets as the character parser did.
+enum token_kind : uint8_t
+{
+    token_end,
+    token_blank,
+    token_digits,
+    token_letters,
+    token_char,
+};
+struct token
+{
+    token() {}      // left uninitialized, see tokenize()
+    token(uint32_t pos, token_kind kind, char c) : pos(pos), kind(kind), c(c) {}
+    uint32_t pos;   // offset in the text
+    token_kind kind;
+    char c;         // the first character, '\0' for token_end
+};
+
+// splits the NUL-terminated text into tokens, reusing the storage of tokens;
+// level picks the scanner as in program::run
+void tokenize(const char *text, std::vector<token> &tokens, simd_level level = simd_auto);
+
+// index of the lowest set bit of a nonzero mask
+inline unsigned lowest_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, mask);
+    return (unsigned)i;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+// Scans the len characters of text in blocks of V::width bytes and writes
+// their tokens to out (room for len). The blocks are aligned loads around
+// text, they never cross a page the text does not touch. V wraps one
+// instruction set (see tokenizer.cpp and tokenizer_avx2.cpp):
+//   reg, width                 byte vector, lanes
+//   load(p)                    aligned load
+//   digits, letters, blanks    lanes of the class set to 0xff
+//   bits(m)                    the top bit of each lane
+//   store_kinds(p, d, l, b)    the token_kind of each lane to p
+template<class V> size_t scan_tokens(const char *text, size_t len, token *out)
+{
+    const uintptr_t w = V::width;
+    const char *end = text + len, *b = (const char*)((uintptr_t)text & ~(w - 1));
+    uint32_t prev_digit = 0, prev_letter = 0, prev_blank = 0;     // class of the byte before the block
+    token *t = out;
+    for (; b < end; b += w)
+    {
+        typename V::reg c = V::load(b), d = V::digits(c), l = V::letters(c), s = V::blanks(c);
+        uint32_t valid = ~0u;
+        if (b < text)
+            valid <<= text - b;
+        if (end - b < (ptrdiff_t)w)
+            valid &= (1u << (end - b)) - 1;
+        if (w < 32)
+            valid &= (1u << (w & 31)) - 1;
+        uint32_t digit = V::bits(d) & valid, letter = V::bits(l) & valid, blank = V::bits(s) & valid;
+        uint32_t starts = (valid & ~(digit | letter | blank)) | (digit & ~(digit << 1 | prev_digit))
+            | (letter & ~(letter << 1 | prev_letter)) | (blank & ~(blank << 1 | prev_blank));
+        prev_digit = digit >> (w - 1);
+        prev_letter = letter >> (w - 1);
+        prev_blank = blank >> (w - 1);
+        alignas(32) uint8_t kinds[32];
+        V::store_kinds(kinds, d, l, s);
+        for (; starts; starts &= starts - 1)
+        {
+            unsigned i = lowest_bit(starts);
+            *t++ = token((uint32_t)(b + i - text), (token_kind)kinds[i], b[i]);
+        }
+    }
+    return t - out;
+}
+size_t scan_tokens_avx2(const char *text, size_t len, token *out);
+
+
+#endif /* tokenizer_h_ */
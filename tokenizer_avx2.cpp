@@ -0,0 +1,45 @@
+// AVX2 instantiation of the tokenizer, reached only after the cpu check in
+// batch.cpp. Like batch_avx2.cpp it keeps std library code out: <vector> is
+// included before the target pragma, tokenizer.h only for scan_tokens.
+#include <vector>
+#include "batch.h"
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#ifdef __GNUC__
+#pragma GCC target("avx2")
+#endif
+#include "tokenizer.h"
+
+
+namespace {
+struct avx2
+{
+    typedef __m256i reg;
+    static const int width = 32;
+    static reg load(const char *p) { return _mm256_load_si256((const __m256i*)p); }
+    // lanes with lo <= c < lo + n: the unsigned compare done signed
+    static reg in_range(reg c, char lo, int n)
+    {
+        reg d = _mm256_xor_si256(_mm256_sub_epi8(c, _mm256_set1_epi8(lo)), _mm256_set1_epi8(-128));
+        return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(n - 128)), d);
+    }
+    static reg digits(reg c) { return in_range(c, '0', 10); }
+    static reg letters(reg c) { return in_range(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), 'a', 26); }
+    static reg blanks(reg c)
+    {
+        return _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\t')));
+    }
+    static uint32_t bits(reg m) { return (uint32_t)_mm256_movemask_epi8(m); }
+    static void store_kinds(uint8_t *p, reg d, reg l, reg b)
+    {
+        reg k = _mm256_sub_epi8(_mm256_set1_epi8(token_char), _mm256_and_si256(d, _mm256_set1_epi8(token_char - token_digits)));
+        k = _mm256_sub_epi8(k, _mm256_and_si256(l, _mm256_set1_epi8(token_char - token_letters)));
+        _mm256_store_si256((__m256i*)p, _mm256_sub_epi8(k, _mm256_and_si256(b, _mm256_set1_epi8(token_char - token_blank))));
+    }
+};
+}
+size_t scan_tokens_avx2(const char *text, size_t len, token *out)
+{
+    return scan_tokens<avx2>(text, len, out);
+}
+#endif
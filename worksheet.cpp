@@ -0,0 +1,269 @@
+#include "worksheet.h"
+#include <algorithm>
+
+
+expression_status worksheet::set(const char *line)
+{
+    cycle_names.clear();
+    const char *name = line + strspn(line, " \t"), *p = name;
+    if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'))
+        while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_')
+            ++p;
+    size_t len = p - name;
+    p += strspn(p, " \t");
+    // "log" is always the function in a formula
+    if (!len || *p != '=' || (len == 3 && !memcmp(name, "log", 3)))
+        return expression_status{error_expected_definition, (int)((len ? p : name) - line)};
+    ++p;
+    size_t known = names.size();
+    uint32_t id = names.add(name, len);
+    expression_status s = parser.try_parse(p, true);
+    if (s.pos >= 0)
+        s.pos += (int)(p - line);
+    resize(names.size());
+    if (s.ok())
+    {
+        uses.clear();
+        for (const term_t &term : parser.nodes.terms)
+            if (term.x)
+                uses.push_back(term.var);
+        std::sort(uses.begin(), uses.end());
+        uses.erase(std::unique(uses.begin(), uses.end()), uses.end());
+        if (find_cycle(id, uses))
+            s = expression_status{error_circular_reference, (int)(name - line)};
+    }
+    if (!s.ok())
+    {
+        // nothing refers to the names of a rejected line
+        names.truncate(known);
+        resize(known);
+        return s;
+    }
+
+    define(id);
+    return s;
+}
+
+// Replaces the formula of name by the one parsed, with its names in uses.
+void worksheet::define(uint32_t name)
+{
+    cell &c = cells[name];
+    for (uint32_t i = c.first.uses; i < c.first.uses + c.count.uses; ++i)
+    {
+        std::vector<uint32_t> &users = cells[use_list[i]].users;
+        *std::find(users.begin(), users.end(), name) = users.back();
+        users.pop_back();
+    }
+    uint32_t level = 0;
+    for (uint32_t u : uses)
+    {
+        cells[u].users.push_back(name);
+        level = std::max(level, cells[u].level + 1);
+    }
+    if (level > c.level)
+    {
+        // lift the names that depend on name above it, as far as needed
+        c.level = level;
+        stack.assign(1, name);
+        while (!stack.empty())
+        {
+            uint32_t n = stack.back();
+            stack.pop_back();
+            for (uint32_t u : cells[n].users)
+                if (cells[u].level <= cells[n].level)
+                {
+                    cells[u].level = cells[n].level + 1;
+                    stack.push_back(u);
+                }
+        }
+    }
+    if (c.root != no_node)
+        dead += c.count.exprs + c.count.prods + c.count.terms + c.count.uses;
+    const node_table &from = parser.nodes;
+    block first = {0, 0, 0, 0}, count = {(uint32_t)from.exprs.size(), (uint32_t)from.prods.size(),
+        (uint32_t)from.terms.size(), (uint32_t)uses.size()};
+    c.first = block{(uint32_t)nodes.exprs.size(), (uint32_t)nodes.prods.size(), (uint32_t)nodes.terms.size(),
+        (uint32_t)use_list.size()};
+    c.count = count;
+    c.root = c.first.exprs + parser.rhs;
+    copy_nodes(from, first, count, nodes);
+    use_list.insert(use_list.end(), uses.begin(), uses.end());
+    if (!c.dirty)
+    {
+        c.dirty = true;
+        dirty.push_back(name);
+    }
+    if (2 * dead > nodes.exprs.size() + nodes.prods.size() + nodes.terms.size() + use_list.size())
+        compact();
+}
+// Appends the nodes of from in the block at first of size count to to, the
+// ids they hold moved along.
+void worksheet::copy_nodes(const node_table &from, const block &first, const block &count, node_table &to)
+{
+    node_id exprs = (node_id)to.exprs.size() - first.exprs, prods = (node_id)to.prods.size() - first.prods;
+    node_id terms = (node_id)to.terms.size() - first.terms;
+    auto move = [](node_id id, node_id by) { return id == no_node ? no_node : id + by; };
+    for (uint32_t i = first.exprs; i < first.exprs + count.exprs; ++i)
+    {
+        expr_t e = from.exprs[i];
+        e.first = move(e.first, prods);
+        e.last = move(e.last, prods);
+        to.exprs.push_back(e);
+    }
+    for (uint32_t i = first.prods; i < first.prods + count.prods; ++i)
+    {
+        prod_t p = from.prods[i];
+        p.first = move(p.first, terms);
+        p.last = move(p.last, terms);
+        p.next = move(p.next, prods);
+        p.xterm = move(p.xterm, terms);
+        to.prods.push_back(p);
+    }
+    for (uint32_t i = first.terms; i < first.terms + count.terms; ++i)
+    {
+        term_t t = from.terms[i];
+        t.expr_value = move(t.expr_value, exprs);
+        t.next = move(t.next, terms);
+        to.terms.push_back(t);
+    }
+}
+void worksheet::compact()
+{
+    node_table live;
+    std::vector<uint32_t> live_uses;
+    for (cell &c : cells)
+    {
+        if (c.root == no_node)
+            continue;
+        block first = {(uint32_t)live.exprs.size(), (uint32_t)live.prods.size(), (uint32_t)live.terms.size(),
+            (uint32_t)live_uses.size()};
+        copy_nodes(nodes, c.first, c.count, live);
+        live_uses.insert(live_uses.end(), use_list.begin() + c.first.uses, use_list.begin() + c.first.uses + c.count.uses);
+        c.root = c.root - c.first.exprs + first.exprs;
+        c.first = first;
+    }
+    std::swap(nodes, live);
+    use_list.swap(live_uses);
+    dead = 0;
+}
+
+// The new formula of name closes a cycle if one of the names it uses already
+// depends on name: walk from name to the formulas using it, and on to theirs.
+bool worksheet::find_cycle(uint32_t name, const std::vector<uint32_t> &uses)
+{
+    if (std::binary_search(uses.begin(), uses.end(), name))
+    {
+        cycle_names.assign(2, name);
+        return true;
+    }
+    if (uses.empty() || cells[name].users.empty())
+        return false;
+    next_generation();
+    visit[name] = generation;
+    stack.assign(1, name);
+    while (!stack.empty())
+    {
+        uint32_t n = stack.back();
+        stack.pop_back();
+        for (uint32_t u : cells[n].users)
+        {
+            if (visit[u] == generation)
+                continue;
+            visit[u] = generation;
+            parent[u] = n;
+            if (std::binary_search(uses.begin(), uses.end(), u))
+            {
+                // name uses u, u uses parent[u] and so on back to name
+                cycle_names.assign(1, name);
+                for (uint32_t v = u; v != name; v = parent[v])
+                    cycle_names.push_back(v);
+                cycle_names.push_back(name);
+                return true;
+            }
+            stack.push_back(u);
+        }
+    }
+    return false;
+}
+
+// The users of a name are on higher levels: when a level is reached all the
+// names it may queue are already queued.
+const std::vector<uint32_t> &worksheet::recompute()
+{
+    changed.clear();
+    evaluated_count = 0;
+    next_generation();
+    size_t level = SIZE_MAX;
+    top = 0;
+    for (uint32_t d : dirty)
+    {
+        schedule(d);
+        level = std::min(level, (size_t)cells[d].level);
+    }
+    dirty.clear();
+    for (; level <= top; ++level)
+    {
+        // evaluate() may grow queued
+        for (size_t i = 0; i < queued[level].size(); ++i)
+            evaluate(queued[level][i]);
+        queued[level].clear();
+    }
+    return changed;
+}
+void worksheet::schedule(uint32_t name)
+{
+    if (visit[name] == generation)
+        return;
+    visit[name] = generation;
+    uint32_t level = cells[name].level;
+    if (queued.size() <= level)
+        queued.resize(level + 1);
+    queued[level].push_back(name);
+    top = std::max(top, (size_t)level);
+}
+void worksheet::evaluate(uint32_t name)
+{
+    cell &c = cells[name];
+    error_code error = error_none;
+    for (uint32_t i = c.first.uses; i < c.first.uses + c.count.uses && !error; ++i)
+        error = errors[use_list[i]];
+    double v = 0;
+    if (!error)
+    {
+        v = eval(nodes, nodes.exprs[c.root], values.data(), error);
+        if (error)
+            v = 0;
+    }
+    ++evaluated_count;
+    bool differs = error != errors[name] || memcmp(&v, &values[name], sizeof(v));
+    if (c.dirty || differs)
+        changed.push_back(name);
+    if (differs)
+        for (uint32_t u : c.users)
+            schedule(u);
+    errors[name] = error;
+    c.dirty = false;
+    values[name] = v;
+}
+
+expression_status worksheet::value(uint32_t name, double &v) const
+{
+    v = values[name];
+    return expression_status{errors[name], -1};
+}
+void worksheet::resize(size_t n)
+{
+    cells.resize(n);
+    values.resize(n, 0);
+    errors.resize(n, error_undefined_variable);
+    visit.resize(n, 0);
+    parent.resize(n);
+}
+void worksheet::next_generation()
+{
+    if (++generation == 0)
+    {
+        std::fill(visit.begin(), visit.end(), 0);
+        generation = 1;
+    }
+}
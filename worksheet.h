@@ -0,0 +1,83 @@
+#ifndef worksheet_h_
+#define worksheet_h_
+
+#include "expression.h"
+
+
+// Named formulas that refer to each other, "rate = 0.05", "y = 2*rate(1+rate)",
+// in any order and with any use of the names (not only linear). Each formula
+// is parsed once; the names it uses are the edges of a dependency graph.
+//
+// set() only records a definition, recompute() then evaluates the changed
+// formulas and the ones that depend on them. Every name has a level above
+// the levels of the names it uses and evaluation goes level by level: a
+// formula runs once all its inputs are final, and only if one of them got a
+// new value, so an update that leaves a value as it was stops there.
+//
+// A name that is used but not defined has error_undefined_variable, a
+// formula using a name with an error gets the same error.
+class worksheet
+{
+public:
+    worksheet() : dead(0), top(0), generation(0), evaluated_count(0) { parser.set_variables(&names); }
+    // defines or redefines a name from "name = formula"; error positions are
+    // in line. A definition that would make the name depend on itself is
+    // rejected with error_circular_reference, cycle() has the names then.
+    expression_status set(const char *line);
+    // evaluates what changed since the last call and returns the names whose
+    // value or error changed, redefined ones always, in evaluation order
+    const std::vector<uint32_t> &recompute();
+    // value of a name as of the last recompute(), or its error
+    expression_status value(uint32_t name, double &v) const;
+    bool defined(uint32_t name) const { return cells[name].root != no_node; }
+    const variable_table &variables() const { return names; }
+    // the rejected cycle: a name, each one the previous one uses, the first again
+    const std::vector<uint32_t> &cycle() const { return cycle_names; }
+    // formulas evaluated by the last recompute()
+    size_t evaluated() const { return evaluated_count; }
+
+private:
+    // where the nodes of a formula and the names it uses are, or how many
+    struct block
+    {
+        uint32_t exprs, prods, terms, uses;
+    };
+    struct cell
+    {
+        cell() : root(no_node), first(), count(), level(0), dirty(false) {}
+        node_id root;                   // the formula in nodes, no_node if not defined
+        block first, count;             // its nodes, and its names in use_list, sorted
+        std::vector<uint32_t> users;    // names whose formula uses this one
+        uint32_t level;
+        bool dirty;                     // redefined since the last recompute()
+    };
+    void define(uint32_t name);
+    static void copy_nodes(const node_table &from, const block &first, const block &count, node_table &to);
+    // copies the live formulas to new tables once the replaced ones fill half of them
+    void compact();
+    bool find_cycle(uint32_t name, const std::vector<uint32_t> &uses);
+    void evaluate(uint32_t name);
+    // queues name for evaluation in this recompute()
+    void schedule(uint32_t name);
+    void resize(size_t n);
+    // starts a graph walk or a recompute(): visit entries from before are stale
+    void next_generation();
+
+    expression parser;
+    variable_table names;
+    std::vector<cell> cells;            // by variable_table index
+    node_table nodes;                   // of every formula, each one in a block
+    std::vector<uint32_t> use_list;
+    size_t dead;                        // nodes and uses of replaced formulas
+    std::vector<double> values;         // by variable_table index, 0 with an error
+    std::vector<error_code> errors;
+    std::vector<uint32_t> dirty, changed, cycle_names, uses;
+    std::vector<uint32_t> visit, parent, stack;
+    std::vector<std::vector<uint32_t>> queued;  // by level, the names to evaluate
+    size_t top;                         // highest level queued
+    uint32_t generation;
+    size_t evaluated_count;
+};
+
+
+#endif /* worksheet_h_ */